@@ -1,13 +1,29 @@
 #include "app.h"
+#include "appevt.h"
+#include "apppm.h"
+#include "appsched.h"
+#include "appwork.h"
 #include "esp32.h"
 #include "led.h"
+#include "mempool.h"
 #include "mlog.h"
 #include "nvram.h"
+#include "taskmon.h"
 #include "wifi.h"
 
+#define MLOG_MODULE lmApp
+
 #ifdef CONFIG_FAT_FS
-// Path for the MLOG.TXT file
-const char *mlogFilePath = CONFIG_FAT_FS_MOUNT_POINT "/MLOG.TXT";
+// Base path of the MLOG.NNN log segment files
+#if defined(CONFIG_MSG_LOG_BINARY) && defined(CONFIG_MSG_LOG_COMPRESS)
+const char *mlogFilePath = CONFIG_FAT_FS_MOUNT_POINT "/MLOGBZ";
+#elif defined(CONFIG_MSG_LOG_BINARY)
+const char *mlogFilePath = CONFIG_FAT_FS_MOUNT_POINT "/MLOGB";
+#elif defined(CONFIG_MSG_LOG_COMPRESS)
+const char *mlogFilePath = CONFIG_FAT_FS_MOUNT_POINT "/MLOGZ";
+#else
+const char *mlogFilePath = CONFIG_FAT_FS_MOUNT_POINT "/MLOG";
+#endif
 #endif
 
 void getSerialNumber(AppData *appData)
@@ -30,7 +46,9 @@ int restartDevice(void)
     vTaskDelay(pdMS_TO_TICKS(250));
 #endif
 
-    // Disable message logging
+    // Write out the log lines still buffered in RAM,
+    // and disable message logging.
+    msgLogFlush();
     msgLogSetLevel(none);
 
     // THE END
@@ -48,54 +66,134 @@ int clearConfig(void)
 int dumpMlogFile(bool warn)
 {
 #ifdef CONFIG_FAT_FS
-    FILE *fp;
-
-    if ((fp = fopen(mlogFilePath, "r")) != NULL) {
-        char lineBuf[CONFIG_MSG_LOG_MAX_LEN];
-        int n = 0;
+    char path[64];
+    unsigned seg;
+
+    // Make sure any log lines still buffered in
+    // RAM make it to the file.
+    msgLogFlush();
+
+    // Dump the log segments, from the oldest to
+    // the newest one.
+    for (seg = 0; msgLogGetSegPath(seg, path, sizeof (path)) == 0; seg++) {
+        FILE *fp;
+
+        if ((fp = msgLogSegOpen(path)) == NULL) {
+            if (errno == ENOENT) {
+                // The segment was deleted by a log
+                // rotation while we were dumping.
+                continue;
+            }
+            mlog(errNo, "Failed to open %s!", path);
+            return -1;
+        }
 
-        printf("\n### Dump of MLOG.TXT ###\n");
+        printf("\n### Dump of %s ###\n", path);
 
-        while (fgets(lineBuf, sizeof (lineBuf), fp) != NULL) {
-            printf("MLOG: %s", lineBuf);
-            if (++n == 100) {
-                // This delay is to prevent the task
-                // watchdog to expire...
-                vTaskDelay(1);
-                n = 0;
+#ifdef CONFIG_MSG_LOG_BINARY
+        msgLogDumpRecords(fp);
+#else
+        {
+            char lineBuf[CONFIG_MSG_LOG_MAX_LEN];
+            int n = 0;
+
+            while (fgets(lineBuf, sizeof (lineBuf), fp) != NULL) {
+                printf("MLOG: %s", lineBuf);
+                if (++n == 100) {
+                    // This delay is to prevent the task
+                    // watchdog to expire...
+                    vTaskDelay(1);
+                    n = 0;
+                }
             }
         }
+#endif
 
         printf("### End of dump ###\n\n");
 
         fclose(fp);
-    } else if (errno == ENOENT) {
+    }
+
+    if ((seg == 0) && warn) {
         // This is not necessarily an error. Warn the
         // user only if asked by the caller...
-        if (warn) {
-            mlog(info, "%s not available!", mlogFilePath);
+        mlog(info, "%s.NNN not available!", mlogFilePath);
+    }
+#endif
+
+    return 0;
+}
+
+// Dump the log lines with a timestamp in the [from, to]
+// window [in usec].
+int dumpMlogWindow(uint64_t from, uint64_t to)
+{
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    static MsgLogQuery query;
+    char lineBuf[MSG_LOG_QUERY_LINE_LEN];
+    int len;
+    int n = 0;
+
+    if (msgLogQueryOpen(&query, from, to) != 0) {
+        mlog(errNo, "Failed to query the log!");
+        return -1;
+    }
+
+    printf("\n### Dump of %s.NNN window ###\n", mlogFilePath);
+
+    while ((len = msgLogQueryNext(&query, lineBuf, sizeof (lineBuf))) > 0) {
+        printf("MLOG: %s", lineBuf);
+        if (++n == 100) {
+            // This delay is to prevent the task
+            // watchdog to expire...
+            vTaskDelay(1);
+            n = 0;
         }
-    } else {
-        mlog(errNo, "Failed to open %s!", mlogFilePath);
+    }
+
+    printf("### End of dump ###\n\n");
+
+    msgLogQueryClose(&query);
+
+    if (len < 0) {
+        mlog(errNo, "Failed to read the log!");
         return -1;
     }
-#endif
 
     return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
+#ifdef CONFIG_APP_MAIN_TASK
+// Handle the log window dump requested via the BLE
+// command, so that the dump doesn't hold up the NimBLE
+// host task.
+void dumpMlogWindowEvt(AppData *appData, const AppEvt *evt)
+{
+    uint32_t from = evt->arg;
+    uint32_t to = (uint32_t) (uintptr_t) evt->data;
+
+    dumpMlogWindow((from * 1000000ULL), ((to * 1000000ULL) + 999999));
+}
+#endif
+
 int deleteMlogFile(bool warn)
 {
 #ifdef CONFIG_FAT_FS
-    if (unlink(mlogFilePath) != 0) {
+    // The current log segment may be open, so let
+    // the msgLog API delete the segment files.
+    if (msgLogDeleteFile() != 0) {
         if (errno == ENOENT) {
             // This is not necessarily an error. Warn the
             // user only if asked by the caller...
             if (warn) {
-                mlog(info, "%s not available!", mlogFilePath);
+                mlog(info, "%s.NNN not available!", mlogFilePath);
             }
         } else {
-            mlog(errNo, "Failed to delete %s!", mlogFilePath);
+            mlog(errNo, "Failed to delete %s.NNN!", mlogFilePath);
             return -1;
         }
     }
@@ -104,21 +202,188 @@ int deleteMlogFile(bool warn)
     return 0;
 }
 
+// Save the crash log recovered at boot, if any, to the
+// CRASH.TXT file, so that it's kept across the next
+// resets.
+int saveCrashLog(void)
+{
+#if defined(CONFIG_FAT_FS) && defined(CONFIG_MSG_LOG_CRASH_LOG)
+    const char *crashFilePath = CONFIG_FAT_FS_MOUNT_POINT "/CRASH.TXT";
+    const char *crashLog;
+    size_t len;
+    FILE *fp;
+
+    if ((len = msgLogGetCrashLog(&crashLog)) == 0) {
+        return 0;
+    }
+
+    if ((fp = fopen(crashFilePath, "w")) == NULL) {
+        mlog(errNo, "Failed to open %s!", crashFilePath);
+        return -1;
+    }
+    if (fwrite(crashLog, 1, len, fp) != len) {
+        mlog(errNo, "Failed to write %s!", crashFilePath);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    mlog(info, "Crash log saved to %s", crashFilePath);
+#endif
+
+    return 0;
+}
+
 #ifdef CONFIG_APP_MAIN_TASK
+// Periodic tick of the work loop
+static void tickJob(AppData *appData)
+{
+    // Custom app code goes here...
+    {
+        mlog(info, "TICK!");
+    }
+}
+
 // Custom app initialization
 static int appCustInit(AppData *appData)
 {
-    // TBD
+    // Add the periodic jobs, each one with its own
+    // period and phase, and register the handlers of
+    // the events (timers, GPIO, WiFi/IP, BLE commands,
+    // app messages) here.
+    if (appSchedAdd("tick", (CONFIG_MAIN_TASK_WAKEUP_PERIOD * 1000), 0, tickJob) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+static AppData *statsAppData;
+
+// Lock used to protect the stats of the last window,
+// as they are read by the BLE and web server tasks.
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void logHistSummary(const char *name, const HdrHistSummary *hs)
+{
+    mlog(trace, "%s: n=%lu min=%lu avg=%lu p50=%lu p90=%lu p99=%lu p99.9=%lu max=%lu",
+         name, hs->count, hs->min, hs->avg, hs->p50, hs->p90, hs->p99, hs->p999, hs->max);
+}
+
+// Update the work loop timing stats: the work time is
+// the time spent running the jobs that were due, and the
+// wake up lateness is how late the loop woke up for them.
+// If the loop had to wait for their deadline, the sleep
+// time is how long it waited, and the sleep exit is how
+// late it was woken up, i.e. the part of the lateness
+// added by the chip coming out of light sleep, when the
+// power save mode is enabled. At the end of each stats
+// window, its percentiles are saved and logged, along
+// with the event and job stats.
+static void updateWorkLoopStats(AppData *appData, int64_t wakeupDeadline, int64_t sleepStart, int64_t wakeupTime, int64_t startTime, int64_t endTime)
+{
+    hdrHistRecord(&appData->workTimeWin, (endTime - startTime));
+    hdrHistRecord(&appData->wakeupLateWin, ((startTime > wakeupDeadline) ? (startTime - wakeupDeadline) : 0));
+    if (wakeupTime != 0) {
+        hdrHistRecord(&appData->sleepTimeWin, (wakeupTime - sleepStart));
+        hdrHistRecord(&appData->sleepExitWin, ((wakeupTime > wakeupDeadline) ? (wakeupTime - wakeupDeadline) : 0));
+    }
+    appData->workLoopCount++;
+
+    if ((endTime - appData->statsWinStart) >= (CONFIG_MAIN_TASK_STATS_WINDOW * 1000000LL)) {
+        WorkLoopStats snap, total;
+
+        hdrHistSummarize(&appData->workTimeWin, &snap.workTime);
+        hdrHistSummarize(&appData->wakeupLateWin, &snap.wakeupLate);
+        hdrHistSummarize(&appData->sleepTimeWin, &snap.sleepTime);
+        hdrHistSummarize(&appData->sleepExitWin, &snap.sleepExit);
+        hdrHistMerge(&appData->workTime, &appData->workTimeWin);
+        hdrHistMerge(&appData->wakeupLate, &appData->wakeupLateWin);
+        hdrHistMerge(&appData->sleepTime, &appData->sleepTimeWin);
+        hdrHistMerge(&appData->sleepExit, &appData->sleepExitWin);
+        hdrHistReset(&appData->workTimeWin);
+        hdrHistReset(&appData->wakeupLateWin);
+        hdrHistReset(&appData->sleepTimeWin);
+        hdrHistReset(&appData->sleepExitWin);
+        appData->statsWinStart = endTime;
+
+        hdrHistSummarize(&appData->workTime, &total.workTime);
+        hdrHistSummarize(&appData->wakeupLate, &total.wakeupLate);
+        hdrHistSummarize(&appData->sleepTime, &total.sleepTime);
+        hdrHistSummarize(&appData->sleepExit, &total.sleepExit);
+        portENTER_CRITICAL(&statsLock);
+        appData->statsSnap = snap;
+        appData->totalSnap = total;
+        portEXIT_CRITICAL(&statsLock);
+
+        logHistSummary("Work Time", &snap.workTime);
+        logHistSummary("Wakeup Lateness", &snap.wakeupLate);
+        logHistSummary("Sleep Time", &snap.sleepTime);
+        logHistSummary("Sleep Exit", &snap.sleepExit);
+        appEvtLogStats();
+        appSchedLogStats();
+#ifdef CONFIG_APP_WORK_POOL
+        appWorkLogStats();
+#endif
+#ifdef CONFIG_MEM_POOL
+        memPoolLogStats();
+#endif
+    }
+}
+
+// Get the percentiles of the work loop timing stats,
+// either over the last stats window or since the device
+// started, as of the end of the last window. They are
+// copied under the lock, as the appMain task updates
+// them at the end of each window.
+int getWorkLoopStats(bool sinceBoot, WorkLoopStats *stats)
+{
+    if (statsAppData == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    portENTER_CRITICAL(&statsLock);
+    *stats = (sinceBoot) ? statsAppData->totalSnap : statsAppData->statsSnap;
+    portEXIT_CRITICAL(&statsLock);
+
     return 0;
 }
 
+static void initWorkLoopStats(AppData *appData)
+{
+    appData->statsWinStart = esp_timer_get_time();
+    statsAppData = appData;
+}
+#endif
+
 // This is the app's main task. It runs an infinite work
-// loop, trying its best to keep a constant wake up interval.
+// loop, running the periodic jobs at their deadlines, and
+// handles the other events as they show up in between.
 #if CONFIG_APP_MAIN_TASK_WAKEUP_METHOD_TASK_DELAY
+// Handle the events until the given deadline [in usec]
+static void runEventsUntil(int64_t deadline)
+{
+    const uint32_t tickPeriod = portTICK_PERIOD_MS * 1000;     // in usec
+    int64_t waitTime;
+    AppEvt evt;
+
+    while ((waitTime = deadline - esp_timer_get_time()) > 0) {
+        // Round the wait up to the next tick, so the
+        // jobs don't get to run early.
+        TickType_t waitTicks = (waitTime + tickPeriod - 1) / tickPeriod;
+        if (appEvtWait(&evt, waitTicks)) {
+            appEvtDispatch(&evt);
+        }
+    }
+}
+
 void appMainTask(void *parms)
 {
     AppData *appData = parms;
-    const TickType_t wakeupPeriodTicks = pdMS_TO_TICKS(CONFIG_MAIN_TASK_WAKEUP_PERIOD);
+    int64_t nextDeadline;
+    int64_t sleepStart = 0, wakeupTime = 0;
 
     appData->appMainTaskHandle = xTaskGetCurrentTaskHandle();
 
@@ -127,47 +392,72 @@ void appMainTask(void *parms)
     if (appCustInit(appData) != 0) {
         mlog(fatal, "Custom app initialization failed!");
     }
+#ifdef CONFIG_TASK_MONITOR
+    if (taskMonInit() != 0) {
+        mlog(error, "Failed to start the task monitor!");
+    }
+#endif
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+    initWorkLoopStats(appData);
+#endif
+    nextDeadline = esp_timer_get_time();
 
     while (true) {
-        TickType_t startTicks, elapsedTicks;
+        int64_t startTime = esp_timer_get_time();
+        int64_t wakeupDeadline = nextDeadline;
 
-        // Record the start of this new pass of our
-        // work loop.
-        startTicks = xTaskGetTickCount();
+#ifdef CONFIG_APP_POWER_SAVE
+        appPmAcquire(aplWorkLoop);
+#endif
 
-        // Custom app code goes here...
-        {
-            mlog(info, "TICK!");
-        }
+        // Run the jobs that are due...
+        nextDeadline = appSchedRun(appData);
+
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+        updateWorkLoopStats(appData, wakeupDeadline, sleepStart, wakeupTime, startTime, esp_timer_get_time());
+#endif
 
-        // Figure out how much time we spent so far
-        elapsedTicks = xTaskGetTickCount() - startTicks;
+#ifdef CONFIG_APP_POWER_SAVE
+        appPmRelease(aplWorkLoop);
+#endif
 
-        if (elapsedTicks < wakeupPeriodTicks) {
-            // Sleep until the next poll period...
-            TickType_t delayTicks = wakeupPeriodTicks - elapsedTicks;
-            vTaskDelay(delayTicks);
-        } else if (elapsedTicks > wakeupPeriodTicks) {
-            // Oops! We exceeded the required wake up period!
-            mlog(warning, "%u ms wakeup period exceeded by %lu ms !!!", CONFIG_MAIN_TASK_WAKEUP_PERIOD, pdTICKS_TO_MS(elapsedTicks - wakeupPeriodTicks));
+        // ... and handle the events until the next
+        // deadline.
+        wakeupTime = 0;
+        if (nextDeadline > esp_timer_get_time()) {
+            sleepStart = esp_timer_get_time();
+            runEventsUntil(nextDeadline);
+            wakeupTime = esp_timer_get_time();
         }
     }
 
     vTaskDelete(NULL);
 }
 #else
-// Wake up the appMainTask. This function runs
-// in the context of the ESP Timer task.
+// Set when the tick could not be posted because
+// the event queue was full.
+static volatile bool tickMissed;
+
+// Time the last wake up tick was posted [in usec]. The
+// postTime of the event only keeps its low 32 bits.
+static volatile int64_t tickTime;
+
+// Post the wake up tick to the appMainTask. This
+// function runs in the context of the ESP Timer task.
 static void wakeupTimerCb(void *arg)
 {
-    AppData *appData = arg;
-    xTaskNotifyGive(appData->appMainTaskHandle);
+    tickTime = esp_timer_get_time();
+    if (appEvtPost(aetTick, 0, 0, NULL) != 0) {
+        tickMissed = true;
+    }
 }
 
 void appMainTask(void *parms)
 {
     AppData *appData = parms;
-    const uint64_t wakeupPeriod = CONFIG_MAIN_TASK_WAKEUP_PERIOD * 1000;    // in usec
+    AppEvt evt = { .type = aetTick };
+    int64_t nextDeadline;
+    int64_t sleepStart = 0, wakeupTime = 0;
 
     appData->appMainTaskHandle = xTaskGetCurrentTaskHandle();
 
@@ -189,57 +479,87 @@ void appMainTask(void *parms)
     if (appCustInit(appData) != 0) {
         mlog(fatal, "Custom app initialization failed!");
     }
+#ifdef CONFIG_TASK_MONITOR
+    if (taskMonInit() != 0) {
+        mlog(error, "Failed to start the task monitor!");
+    }
+#endif
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+    initWorkLoopStats(appData);
+#endif
+    evt.postTime = esp_timer_get_time();
+    nextDeadline = evt.postTime;
 
     while (true) {
-        uint64_t startTime, elapsedTime;
+        int64_t startTime, wakeupDeadline;
 
         // Record the start of this new pass of our
         // work loop.
         startTime = esp_timer_get_time();
+        wakeupDeadline = nextDeadline;
 
-        // Custom app code goes here...
-        {
-            mlog(info, "TICK!");
-        }
-
-        // Figure out how much time we spent so far
-        elapsedTime = esp_timer_get_time() - startTime;
+#ifdef CONFIG_APP_POWER_SAVE
+        appPmAcquire(aplWorkLoop);
+#endif
 
-        if (elapsedTime < wakeupPeriod) {
-            // Set up the wake up alarm ...
-            uint64_t sleepTime = wakeupPeriod - elapsedTime;
-            if (esp_timer_start_once(appData->wakeupTimerHandle, sleepTime) != ESP_OK) {
-                mlog(fatal, "Failed to start wakeupTimer!");
-            }
+        // Account for the wake up tick...
+        appEvtDispatch(&evt);
 
-            // ... and go to sleep
-            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        } else if (elapsedTime > wakeupPeriod) {
-            // Oops! We exceeded the required wake up period!
-            uint32_t exceedTime = (elapsedTime - wakeupPeriod);
-            mlog(warning, "%u ms wakeup period exceeded by %lu.%03lu ms !!!", CONFIG_MAIN_TASK_WAKEUP_PERIOD, (exceedTime / 1000), (exceedTime % 1000));
-        }
+        // ... and run the jobs that are due
+        nextDeadline = appSchedRun(appData);
 
 #ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
-        // Update the work loop timing stats
-        {
-            uint64_t wakeupTime = esp_timer_get_time();
-            uint64_t workLoopTime = wakeupTime - startTime;
-            if (workLoopTime < appData->minWorkLoopTime) {
-                appData->minWorkLoopTime = workLoopTime;
-            } else if (workLoopTime > appData->maxWorkLoopTime) {
-                appData->maxWorkLoopTime = workLoopTime;
+        updateWorkLoopStats(appData, wakeupDeadline, sleepStart, wakeupTime, startTime, esp_timer_get_time());
+#endif
+
+#ifdef CONFIG_APP_POWER_SAVE
+        appPmRelease(aplWorkLoop);
+#endif
+
+        wakeupTime = 0;
+        if (nextDeadline > esp_timer_get_time()) {
+            // Set up the wake up alarm for the next
+            // deadline. The delay is worked out from the
+            // absolute deadline right before the timer
+            // is armed, so the errors don't add up...
+            if (nextDeadline != INT64_MAX) {
+                int64_t sleepTime = nextDeadline - esp_timer_get_time();
+                if (esp_timer_start_once(appData->wakeupTimerHandle, ((sleepTime > 0) ? sleepTime : 0)) != ESP_OK) {
+                    mlog(fatal, "Failed to start wakeupTimer!");
+                }
             }
-            appData->sumWorkLoopTime += workLoopTime;
-            appData->avgWorkLoopTime = appData->sumWorkLoopTime / ++appData->workLoopCount;
-            if ((appData->workLoopCount % (1000 / CONFIG_MAIN_TASK_WAKEUP_PERIOD)) == 0) {
-                mlog(trace, "Work Loop Time Stats: min=%llu avg=%llu max=%llu", appData->minWorkLoopTime, appData->avgWorkLoopTime, appData->maxWorkLoopTime);
+
+            // ... and handle the events until it
+            // goes off.
+            sleepStart = esp_timer_get_time();
+            while (!tickMissed && appEvtWait(&evt, portMAX_DELAY) && (evt.type != aetTick)) {
+                appEvtDispatch(&evt);
+            }
+            if (tickMissed) {
+                tickMissed = false;
+                evt.type = aetTick;
+                evt.postTime = esp_timer_get_time();
+            } else {
+                // The tick is posted by the timer callback
+                // as soon as the chip is back up.
+                wakeupTime = tickTime;
             }
+        } else {
+            // A job is already due again: the overruns
+            // are accounted for by the scheduler.
+            evt.postTime = esp_timer_get_time();
         }
-#endif
     }
 
     vTaskDelete(NULL);
 }
 #endif
 #endif  // CONFIG_APP_MAIN_TASK
+
+#ifndef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+int getWorkLoopStats(bool sinceBoot, WorkLoopStats *stats)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
@@ -5,6 +5,15 @@
 #include <stdint.h>
 
 #include "esp32.h"
+#include "hdrhist.h"
+
+// Percentiles of the work loop timing stats [in usec]
+typedef struct WorkLoopStats {
+    HdrHistSummary workTime;    // time spent running the jobs that were due
+    HdrHistSummary wakeupLate;  // how late the loop started running them
+    HdrHistSummary sleepTime;   // time spent waiting for the next deadline
+    HdrHistSummary sleepExit;   // how late the loop was woken up for it
+} WorkLoopStats;
 
 // App's persistent data
 typedef struct AppPersData {
@@ -40,10 +49,17 @@ typedef struct AppData {
 #endif
 #ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
     uint64_t workLoopCount;
-    uint64_t sumWorkLoopTime;
-    uint64_t minWorkLoopTime;
-    uint64_t maxWorkLoopTime;
-    uint64_t avgWorkLoopTime;
+    int64_t statsWinStart;          // start of the current stats window [in usec]
+    HdrHist workTime;               // work time of the loop [in usec]
+    HdrHist wakeupLate;             // wake up lateness of the loop [in usec]
+    HdrHist sleepTime;              // time spent waiting for the next deadline [in usec]
+    HdrHist sleepExit;              // how late the loop was woken up [in usec]
+    HdrHist workTimeWin;            // ... in the current stats window
+    HdrHist wakeupLateWin;
+    HdrHist sleepTimeWin;
+    HdrHist sleepExitWin;
+    WorkLoopStats statsSnap;        // ... in the last stats window
+    WorkLoopStats totalSnap;        // ... since boot, as of the end of the last window
 #endif
 #endif
 
@@ -51,9 +67,11 @@ typedef struct AppData {
 
 } AppData;
 
-// Path for the mlog.txt file
+// Base path of the log segment files
 extern const char *mlogFilePath;
 
+struct AppEvt;
+
 __BEGIN_DECLS
 
 extern void appMainTask(void *parms);
@@ -61,6 +79,10 @@ extern void getSerialNumber(AppData *appData);
 extern int restartDevice(void);
 extern int clearConfig(void);
 extern int dumpMlogFile(bool warn);
+extern int dumpMlogWindow(uint64_t from, uint64_t to);
+extern void dumpMlogWindowEvt(AppData *appData, const struct AppEvt *evt);
 extern int deleteMlogFile(bool warn);
+extern int saveCrashLog(void);
+extern int getWorkLoopStats(bool sinceBoot, WorkLoopStats *stats);
 
 __END_DECLS
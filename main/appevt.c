@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "appevt.h"
+#include "esp32.h"
+#include "mlog.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_APP_MAIN_TASK
+
+#define QUEUE_LEN   CONFIG_MAIN_TASK_EVT_QUEUE_LEN
+
+static const char *evtTypeName[aetMax] = {
+    [aetTick] = "tick",
+    [aetTimer] = "timer",
+    [aetGpio] = "gpio",
+    [aetWiFi] = "wifi",
+    [aetIp] = "ip",
+    [aetBleCmd] = "bleCmd",
+    [aetMsg] = "msg",
+    [aetMlogDump] = "mlogDump",
+};
+
+static AppData *appData;
+static QueueHandle_t evtQueue;
+static AppEvtHandler handlerTbl[aetMax];
+
+// Stats counters. The dispatch stats are only updated
+// by the appMain task, and the post stats by whoever
+// posts the events, from either core, hence atomically.
+static struct {
+    uint32_t count;
+    atomic_uint dropped;
+    uint64_t sumLatency;
+    uint32_t maxLatency;
+    uint32_t maxRunTime;
+} evtStats[aetMax];
+static atomic_uint highWater;
+
+static inline uint32_t usecNow(void)
+{
+    return (uint32_t) esp_timer_get_time();
+}
+
+static inline void updateHighWater(UBaseType_t numEvts)
+{
+    unsigned hwm = atomic_load_explicit(&highWater, memory_order_relaxed);
+    while ((numEvts > hwm) && !atomic_compare_exchange_weak_explicit(&highWater, &hwm, numEvts, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+// Post an event to the appMain task, without waiting
+// for room in the queue. Returns -1, with errno set to
+// ENOSPC, if the queue is full.
+int appEvtPost(AppEvtType type, uint16_t id, uint32_t arg, void *data)
+{
+    AppEvt evt = { .type = type, .id = id, .arg = arg, .data = data };
+
+    if ((type >= aetMax) || (evtQueue == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    evt.postTime = usecNow();
+    if (xQueueSend(evtQueue, &evt, 0) != pdPASS) {
+        atomic_fetch_add_explicit(&evtStats[type].dropped, 1, memory_order_relaxed);
+        errno = ENOSPC;
+        return -1;
+    }
+    updateHighWater(uxQueueMessagesWaiting(evtQueue));
+
+    return 0;
+}
+
+// Same as appEvtPost(), to be called from an ISR. The
+// 'data' field of the event is not set.
+int IRAM_ATTR appEvtPostFromISR(AppEvtType type, uint16_t id, uint32_t arg, BaseType_t *taskWoken)
+{
+    AppEvt evt = { .type = type, .id = id, .arg = arg };
+
+    if ((type >= aetMax) || (evtQueue == NULL)) {
+        return -1;
+    }
+
+    evt.postTime = usecNow();
+    if (xQueueSendFromISR(evtQueue, &evt, taskWoken) != pdPASS) {
+        atomic_fetch_add_explicit(&evtStats[type].dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    updateHighWater(uxQueueMessagesWaitingFromISR(evtQueue));
+
+    return 0;
+}
+
+int appEvtSetHandler(AppEvtType type, AppEvtHandler handler)
+{
+    if (type >= aetMax) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    handlerTbl[type] = handler;
+
+    return 0;
+}
+
+// Post the expiration of an app timer. This function
+// runs in the context of the ESP Timer task.
+static void timerCb(void *arg)
+{
+    appEvtPost(aetTimer, (uint16_t) (uintptr_t) arg, 0, NULL);
+}
+
+// Create an ESP Timer whose expirations are posted to
+// the appMain task as aetTimer events with the given ID.
+// The timer is then started and stopped using the usual
+// esp_timer API.
+int appEvtTimerCreate(uint16_t id, esp_timer_handle_t *timerHandle)
+{
+    esp_timer_create_args_t timerArgs = {0};
+
+    timerArgs.callback = timerCb;
+    timerArgs.arg = (void *) (uintptr_t) id;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "appEvtTmr";
+    if (esp_timer_create(&timerArgs, timerHandle) != ESP_OK) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Wait up to 'timeout' ticks for the next event.
+// Returns false if there was none.
+bool appEvtWait(AppEvt *evt, TickType_t timeout)
+{
+    return (xQueueReceive(evtQueue, evt, timeout) == pdPASS);
+}
+
+// Call the handler of the event, if any, and update
+// the stats of its type.
+void appEvtDispatch(const AppEvt *evt)
+{
+    uint32_t startTime = usecNow();
+    uint32_t latency = startTime - evt->postTime;
+    uint32_t runTime;
+
+    if (evt->type >= aetMax) {
+        return;
+    }
+
+    if (handlerTbl[evt->type] != NULL) {
+        handlerTbl[evt->type](appData, evt);
+    }
+    runTime = usecNow() - startTime;
+
+    evtStats[evt->type].count++;
+    evtStats[evt->type].sumLatency += latency;
+    if (latency > evtStats[evt->type].maxLatency) {
+        evtStats[evt->type].maxLatency = latency;
+    }
+    if (runTime > evtStats[evt->type].maxRunTime) {
+        evtStats[evt->type].maxRunTime = runTime;
+    }
+}
+
+void appEvtGetStats(AppEvtStats *stats)
+{
+    for (int i = 0; i < aetMax; i++) {
+        AppEvtTypeStats *ts = &stats->type[i];
+        ts->count = evtStats[i].count;
+        ts->dropped = atomic_load(&evtStats[i].dropped);
+        ts->avgLatency = (ts->count != 0) ? (evtStats[i].sumLatency / ts->count) : 0;
+        ts->maxLatency = evtStats[i].maxLatency;
+        ts->maxRunTime = evtStats[i].maxRunTime;
+    }
+    stats->queueLen = QUEUE_LEN;
+    stats->highWater = atomic_load(&highWater);
+}
+
+// Log the stats of the event types seen so far, as:
+// name=count/dropped/avgLatency/maxLatency/maxRunTime
+void appEvtLogStats(void)
+{
+    AppEvtStats stats;
+    char buf[160];
+    int n = 0;
+
+    appEvtGetStats(&stats);
+    for (int i = 0; (i < aetMax) && (n < (int) sizeof (buf)); i++) {
+        const AppEvtTypeStats *ts = &stats.type[i];
+        if ((ts->count != 0) || (ts->dropped != 0)) {
+            n += snprintf(&buf[n], (sizeof (buf) - n), " %s=%lu/%lu/%lu/%lu/%lu", evtTypeName[i],
+                          ts->count, ts->dropped, ts->avgLatency, ts->maxLatency, ts->maxRunTime);
+        }
+    }
+    buf[(n < (int) sizeof (buf)) ? n : (int) (sizeof (buf) - 1)] = '\0';
+
+    mlog(trace, "Event Stats: queue=%lu/%lu%s", stats.highWater, stats.queueLen, buf);
+}
+
+#ifdef CONFIG_WIFI_STATION
+// Pass the WiFi and IP events on to the appMain task,
+// if the app has registered a handler for them, so they
+// don't fill up the queue for nothing. This function
+// runs in the context of the default event loop task.
+static void netEvtHandler(void *arg, esp_event_base_t evtBase, int32_t evtId, void *evtData)
+{
+    AppEvtType type = (evtBase == IP_EVENT) ? aetIp : aetWiFi;
+
+    if (handlerTbl[type] != NULL) {
+        appEvtPost(type, evtId, 0, NULL);
+    }
+}
+#endif
+
+// Create the event queue. This is done early on, so
+// that the events that show up before the appMain task
+// is running are not lost.
+int appEvtInit(AppData *data)
+{
+    appData = data;
+
+    if ((evtQueue = xQueueCreate(QUEUE_LEN, sizeof (AppEvt))) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+#ifdef CONFIG_WIFI_STATION
+    if ((esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, netEvtHandler, NULL) != ESP_OK) ||
+        (esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, netEvtHandler, NULL) != ESP_OK)) {
+        errno = EIO;
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+#else
+
+int appEvtPost(AppEvtType type, uint16_t id, uint32_t arg, void *data)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+int appEvtPostFromISR(AppEvtType type, uint16_t id, uint32_t arg, BaseType_t *taskWoken)
+{
+    return -1;
+}
+
+#endif  // CONFIG_APP_MAIN_TASK
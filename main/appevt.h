@@ -0,0 +1,76 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app.h"
+
+// Event dispatcher of the appMain task. All the events
+// handled by the task go through a single queue: the
+// wake up tick, the expirations of the app timers, the
+// GPIO and other ISR events, the WiFi and IP events, the
+// BLE command requests, and the messages posted by the
+// app itself. The task waits on the queue and calls the
+// handler registered for the type of each event, so it
+// only wakes up when there is something to do.
+//
+// The time each event spends in the queue (latency), the
+// run time of the handlers, and the queue high water mark
+// are recorded, to help size the queue and spot the slow
+// handlers.
+
+// Event types
+typedef enum AppEvtType {
+    aetTick = 0,        // wake up tick of the work loop, at the next job deadline
+    aetTimer,           // app timer expired {id: timer ID}
+    aetGpio,            // GPIO or other ISR event {id: GPIO number}
+    aetWiFi,            // WiFi event {id: WIFI_EVENT ID}
+    aetIp,              // IP event {id: IP_EVENT ID}
+    aetBleCmd,          // BLE command request {id: opcode, arg: status}
+    aetMsg,             // app message {id, arg, data: app defined}
+    aetMlogDump,        // log window dump request {arg: from [in secs], data: to [in secs]}
+    aetMax
+} AppEvtType;
+
+// Event
+typedef struct AppEvt {
+    uint8_t type;       // AppEvtType
+    uint8_t unused;
+    uint16_t id;        // event ID, per type
+    uint32_t arg;       // event argument, per type
+    void *data;         // event data, per type
+    uint32_t postTime;  // when the event was posted [in usec]
+} AppEvt;
+
+// Event handler
+typedef void (*AppEvtHandler)(AppData *appData, const AppEvt *evt);
+
+// Stats of each event type
+typedef struct AppEvtTypeStats {
+    uint32_t count;         // number of events dispatched
+    uint32_t dropped;       // number of events dropped because the queue was full
+    uint32_t avgLatency;    // avg time in the queue [in usec]
+    uint32_t maxLatency;    // max time in the queue [in usec]
+    uint32_t maxRunTime;    // max run time of the handler [in usec]
+} AppEvtTypeStats;
+
+typedef struct AppEvtStats {
+    AppEvtTypeStats type[aetMax];
+    uint32_t queueLen;      // queue length
+    uint32_t highWater;     // max number of events in the queue
+} AppEvtStats;
+
+__BEGIN_DECLS
+
+extern int appEvtInit(AppData *appData);
+extern int appEvtSetHandler(AppEvtType type, AppEvtHandler handler);
+extern int appEvtPost(AppEvtType type, uint16_t id, uint32_t arg, void *data);
+extern int appEvtPostFromISR(AppEvtType type, uint16_t id, uint32_t arg, BaseType_t *taskWoken);
+extern int appEvtTimerCreate(uint16_t id, esp_timer_handle_t *timerHandle);
+extern bool appEvtWait(AppEvt *evt, TickType_t timeout);
+extern void appEvtDispatch(const AppEvt *evt);
+extern void appEvtGetStats(AppEvtStats *stats);
+extern void appEvtLogStats(void);
+
+__END_DECLS
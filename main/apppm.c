@@ -0,0 +1,84 @@
+#include <errno.h>
+
+#include "sdkconfig.h"
+
+#include "apppm.h"
+#include "esp32.h"
+#include "mlog.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_APP_POWER_SAVE
+
+#ifdef CONFIG_APP_POWER_SAVE_LIGHT_SLEEP
+#define LIGHT_SLEEP     true
+#else
+#define LIGHT_SLEEP     false
+#endif
+
+// The OTA download and the work loop body run at full CPU
+// speed, while a BLE connection only needs to keep the chip
+// out of light sleep, so the link timing is not thrown off
+// by the slow clock used during sleep.
+static const struct {
+    const char *name;
+    esp_pm_lock_type_t type;
+} lockTbl[aplMax] = {
+    [aplOta] = { "otaUpd", ESP_PM_CPU_FREQ_MAX },
+    [aplBle] = { "bleConn", ESP_PM_NO_LIGHT_SLEEP },
+    [aplWorkLoop] = { "workLoop", ESP_PM_CPU_FREQ_MAX },
+};
+
+static esp_pm_lock_handle_t lockHandle[aplMax];
+
+int appPmAcquire(AppPmLock lock)
+{
+    if ((lock >= aplMax) || (lockHandle[lock] == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return (esp_pm_lock_acquire(lockHandle[lock]) == ESP_OK) ? 0 : -1;
+}
+
+int appPmRelease(AppPmLock lock)
+{
+    if ((lock >= aplMax) || (lockHandle[lock] == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return (esp_pm_lock_release(lockHandle[lock]) == ESP_OK) ? 0 : -1;
+}
+
+// Enable the dynamic frequency scaling, and the automatic
+// light sleep if configured, and create the PM locks. This
+// should be done before the WiFi and BLE stacks are started.
+int appPmInit(void)
+{
+    esp_pm_config_t pmConfig = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_APP_POWER_SAVE_MIN_FREQ_MHZ,
+        .light_sleep_enable = LIGHT_SLEEP,
+    };
+    esp_err_t rc;
+
+    if ((rc = esp_pm_configure(&pmConfig)) != ESP_OK) {
+        mlog(error, "Can't configure power management: rc=0x%04x", rc);
+        return -1;
+    }
+
+    for (int i = 0; i < aplMax; i++) {
+        if ((rc = esp_pm_lock_create(lockTbl[i].type, 0, lockTbl[i].name, &lockHandle[i])) != ESP_OK) {
+            mlog(error, "Can't create \"%s\" PM lock: rc=0x%04x", lockTbl[i].name, rc);
+            return -1;
+        }
+    }
+
+    mlog(info, "Power save: cpuFreq=%u-%uMHz lightSleep=%s",
+         CONFIG_APP_POWER_SAVE_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, (LIGHT_SLEEP ? "on" : "off"));
+
+    return 0;
+}
+
+#endif  // CONFIG_APP_POWER_SAVE
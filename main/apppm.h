@@ -0,0 +1,28 @@
+#pragma once
+
+#include <sys/cdefs.h>
+
+#include "esp32.h"
+
+// Power management: when APP_POWER_SAVE is enabled, the
+// CPU clock is scaled down to APP_POWER_SAVE_MIN_FREQ_MHZ,
+// and the chip enters light sleep, whenever the system is
+// idle. The latency-critical sections hold a PM lock for
+// as long as they need the chip to stay awake and running
+// at full speed.
+
+// PM locks
+typedef enum AppPmLock {
+    aplOta = 0,         // OTA firmware download
+    aplBle,             // inbound BLE connection
+    aplWorkLoop,        // body of the appMain task's work loop
+    aplMax
+} AppPmLock;
+
+__BEGIN_DECLS
+
+extern int appPmInit(void);
+extern int appPmAcquire(AppPmLock lock);
+extern int appPmRelease(AppPmLock lock);
+
+__END_DECLS
@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "appsched.h"
+#include "esp32.h"
+#include "mlog.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_APP_MAIN_TASK
+
+#if CONFIG_MAIN_TASK_SCHED_POLICY_CATCH_UP
+#define APP_SCHED_DEF_POLICY    aspCatchUp
+#elif CONFIG_MAIN_TASK_SCHED_POLICY_SHIFT
+#define APP_SCHED_DEF_POLICY    aspShift
+#else
+#define APP_SCHED_DEF_POLICY    aspSkip
+#endif
+
+typedef struct SchedJob {
+    const char *name;
+    AppSchedFn fn;
+    AppSchedPolicy policy;
+    uint32_t period;        // [in usec]
+    int64_t deadline;       // next deadline [in usec]
+    int64_t lastMissed;     // last deadline counted as missed [in usec]
+    uint64_t sumRunTime;
+    AppSchedStats stats;
+} SchedJob;
+
+// Jobs, in the order they were added, and the order
+// they are run in, sorted by period.
+static SchedJob jobTbl[APP_SCHED_MAX_JOBS];
+static uint8_t runOrder[APP_SCHED_MAX_JOBS];
+static unsigned numJobs;
+
+// Time the phases of the jobs are relative to
+static int64_t schedEpoch;
+
+// Add a job, called every 'periodUs' usec, starting
+// 'phaseUs' usec after the first job was added, so the
+// relative phase of the jobs is kept. Must be called
+// by the appMain task. Returns the job number.
+int appSchedAdd(const char *name, uint32_t periodUs, uint32_t phaseUs, AppSchedFn fn)
+{
+    int64_t now = esp_timer_get_time();
+    SchedJob *job = &jobTbl[numJobs];
+    unsigned n;
+
+    if ((periodUs == 0) || (phaseUs >= periodUs) || (fn == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (numJobs == APP_SCHED_MAX_JOBS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (numJobs == 0) {
+        schedEpoch = now;
+    }
+
+    // Keep the run order sorted by period
+    for (n = numJobs; (n != 0) && (jobTbl[runOrder[n - 1]].period > periodUs); n--) {
+        runOrder[n] = runOrder[n - 1];
+    }
+    runOrder[n] = numJobs;
+
+    memset(job, 0, sizeof (*job));
+    job->name = name;
+    job->fn = fn;
+    job->policy = APP_SCHED_DEF_POLICY;
+    job->period = periodUs;
+    job->deadline = schedEpoch + phaseUs;
+    if (job->deadline < now) {
+        // Skip the deadlines already past
+        job->deadline += (((now - job->deadline) + periodUs - 1) / periodUs) * periodUs;
+    }
+    job->stats.name = name;
+    job->stats.period = periodUs;
+    job->stats.policy = job->policy;
+
+    return numJobs++;
+}
+
+// Set the overrun policy of a job
+int appSchedSetPolicy(unsigned job, AppSchedPolicy policy)
+{
+    if ((job >= numJobs) || (policy > aspShift)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    jobTbl[job].policy = policy;
+    jobTbl[job].stats.policy = policy;
+
+    return 0;
+}
+
+static void updateStats(SchedJob *job, uint32_t jitter, uint32_t runTime)
+{
+    AppSchedStats *stats = &job->stats;
+    unsigned bin = 0;
+
+    stats->runs++;
+    job->sumRunTime += runTime;
+    stats->avgRunTime = job->sumRunTime / stats->runs;
+    if (runTime > stats->maxRunTime) {
+        stats->maxRunTime = runTime;
+    }
+
+    if (jitter > stats->maxJitter) {
+        stats->maxJitter = jitter;
+    }
+    while ((bin < (APP_SCHED_JITTER_BINS - 1)) && (jitter >= (64U << bin))) {
+        bin++;
+    }
+    stats->jitterHist[bin]++;
+}
+
+// Run the jobs that are due. Returns the earliest
+// deadline of the jobs, i.e. when this function is
+// to be called again.
+int64_t appSchedRun(AppData *appData)
+{
+    int64_t nextDeadline = INT64_MAX;
+    int64_t now = esp_timer_get_time();
+
+    for (unsigned n = 0; n < numJobs; n++) {
+        SchedJob *job = &jobTbl[runOrder[n]];
+
+        if (job->deadline <= now) {
+            int64_t startTime = now;
+            uint32_t jitter = startTime - job->deadline;
+
+            job->fn(appData);
+            now = esp_timer_get_time();
+            updateStats(job, jitter, (now - startTime));
+
+            // The next deadline is a whole number of
+            // periods after the first one, unless the
+            // job is behind and shifts its timeline.
+            job->deadline += job->period;
+            if (job->deadline <= now) {
+                // Oops! The job exceeded its period
+                uint32_t overrun = now - job->deadline;
+                uint32_t behind = (overrun / job->period) + 1;
+                uint32_t missed = behind;
+                int64_t lastMissed = job->deadline + ((int64_t) (behind - 1) * job->period);
+                if (lastMissed > job->lastMissed) {
+                    // Don't count again the deadlines
+                    // already missed while catching up.
+                    if (job->deadline <= job->lastMissed) {
+                        missed = (lastMissed - job->lastMissed) / job->period;
+                    }
+                    job->lastMissed = lastMissed;
+                    job->stats.overruns++;
+                    job->stats.missed += missed;
+                    mlog(warning, "%s: %lu us period exceeded by %lu us !!!", job->name, job->period, overrun);
+                }
+                if (job->policy == aspShift) {
+                    // Restart the timeline from now
+                    job->deadline = now + job->period;
+                } else if ((job->policy == aspSkip) || (behind > APP_SCHED_MAX_CATCH_UP)) {
+                    // Skip the runs that were missed
+                    job->deadline += (int64_t) behind * job->period;
+                }
+                // ... else catch up: the next run is
+                // due right away.
+            }
+        }
+
+        if (job->deadline < nextDeadline) {
+            nextDeadline = job->deadline;
+        }
+    }
+
+    return nextDeadline;
+}
+
+int appSchedGetStats(unsigned job, AppSchedStats *stats)
+{
+    if (job >= numJobs) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *stats = jobTbl[job].stats;
+
+    return 0;
+}
+
+// Log the stats of each job, as: runs/overruns/missed
+// run=avg/max jitter=max hist=bin0/bin1/...
+void appSchedLogStats(void)
+{
+    static const char *policyName[] = {
+        [aspSkip] = "skip",
+        [aspCatchUp] = "catchUp",
+        [aspShift] = "shift",
+    };
+
+    for (unsigned n = 0; n < numJobs; n++) {
+        const AppSchedStats *stats = &jobTbl[n].stats;
+        char histBuf[APP_SCHED_JITTER_BINS * 11];
+        int len = 0;
+
+        for (int i = 0; i < APP_SCHED_JITTER_BINS; i++) {
+            len += snprintf(&histBuf[len], (sizeof (histBuf) - len), "%s%lu", ((i != 0) ? "/" : ""), stats->jitterHist[i]);
+        }
+
+        mlogDump(trace, "Job %s: period=%lu policy=%s runs=%lu/%lu/%lu run=%lu/%lu jitter=%lu hist=%s",
+             stats->name, stats->period, policyName[stats->policy], stats->runs, stats->overruns, stats->missed,
+             stats->avgRunTime, stats->maxRunTime, stats->maxJitter, histBuf);
+    }
+}
+
+#endif  // CONFIG_APP_MAIN_TASK
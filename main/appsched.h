@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#include "app.h"
+
+// Multi-rate job scheduler of the appMain task. Each job
+// is called periodically, with its own period and phase,
+// by the work loop of the task, which sleeps (handling the
+// events) until the earliest deadline across all the jobs.
+// The deadlines of a job are tracked on an absolute
+// timeline, a whole number of periods after its first
+// one, so the jobs never drift, whatever the wake up
+// method and however late the task wakes up. What happens
+// when a job overruns its period is set by its overrun
+// policy. The jobs are run from the shortest to the
+// longest period when several are due.
+
+// Max number of jobs
+#define APP_SCHED_MAX_JOBS      CONFIG_MAIN_TASK_SCHED_MAX_JOBS
+
+// Number of bins of the jitter histogram of each job.
+// Bin N counts the runs started less than (64 << N) usec
+// after their deadline, and the last one all the others.
+#define APP_SCHED_JITTER_BINS   8
+
+// Max number of periods a job using the aspCatchUp
+// policy can fall behind before the missed runs are
+// skipped.
+#define APP_SCHED_MAX_CATCH_UP  4
+
+// Overrun policy: what to do with the deadlines missed
+// when a job overruns its period.
+typedef enum AppSchedPolicy {
+    aspSkip = 0,        // skip the missed runs, keeping the phase
+    aspCatchUp,         // run the missed runs back to back, keeping the phase
+    aspShift,           // skip the missed runs, and restart the timeline from the end of the run
+} AppSchedPolicy;
+
+// Job function
+typedef void (*AppSchedFn)(AppData *appData);
+
+// Stats of each job
+typedef struct AppSchedStats {
+    const char *name;
+    uint32_t period;        // [in usec]
+    uint32_t runs;          // number of runs
+    uint32_t overruns;      // number of runs that went past the next deadline
+    uint32_t missed;        // number of deadlines missed because of the overruns
+    uint32_t avgRunTime;    // [in usec]
+    uint32_t maxRunTime;    // [in usec]
+    uint32_t maxJitter;     // max delay from the deadline to the start of a run [in usec]
+    uint8_t policy;         // AppSchedPolicy
+    uint32_t jitterHist[APP_SCHED_JITTER_BINS];
+} AppSchedStats;
+
+__BEGIN_DECLS
+
+extern int appSchedAdd(const char *name, uint32_t periodUs, uint32_t phaseUs, AppSchedFn fn);
+extern int appSchedSetPolicy(unsigned job, AppSchedPolicy policy);
+extern int64_t appSchedRun(AppData *appData);
+extern int appSchedGetStats(unsigned job, AppSchedStats *stats);
+extern void appSchedLogStats(void);
+
+__END_DECLS
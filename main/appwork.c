@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "appwork.h"
+#include "esp32.h"
+#include "mlog.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_APP_WORK_POOL
+
+#define NUM_JOBS    CONFIG_APP_WORK_POOL_JOBS
+#define DEQUE_LEN   CONFIG_APP_WORK_DEQUE_LEN
+
+_Static_assert(((DEQUE_LEN & (DEQUE_LEN - 1)) == 0), "APP_WORK_DEQUE_LEN must be a power of two");
+
+typedef struct WorkJob {
+    AppWorkFn fn;
+    void *arg;
+    uint32_t submitTime;    // [in usec]
+    struct WorkJob *next;   // next free job
+} WorkJob;
+
+// Job deque: the jobs are pushed at the tail, away from
+// the owner and the thieves, who both take them in order
+// from the head, so a stolen job is the one that has been
+// waiting the longest.
+typedef struct WorkDeque {
+    WorkJob *job[DEQUE_LEN];
+    uint32_t head;
+    uint32_t tail;
+} WorkDeque;
+
+typedef struct Worker {
+    TaskHandle_t taskHandle;
+    portMUX_TYPE lock;
+    WorkDeque deque[awpMax];
+    volatile bool idle;
+    uint32_t runs;
+    uint32_t stolen;
+    uint64_t sumLatency;
+    uint32_t maxLatency;
+    uint64_t busyTime;      // [in usec]
+} Worker;
+
+static Worker workerTbl[APP_WORK_NUM_WORKERS];
+static bool poolReady;
+
+// Job pool
+static WorkJob jobPool[NUM_JOBS];
+static WorkJob *freeJobs;
+static portMUX_TYPE poolLock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t poolMisses;
+
+static WorkJob *allocJob(void)
+{
+    WorkJob *job;
+
+    portENTER_CRITICAL(&poolLock);
+    if ((job = freeJobs) != NULL) {
+        freeJobs = job->next;
+    } else {
+        poolMisses++;
+    }
+    portEXIT_CRITICAL(&poolLock);
+
+    return job;
+}
+
+static void freeJob(WorkJob *job)
+{
+    portENTER_CRITICAL(&poolLock);
+    job->next = freeJobs;
+    freeJobs = job;
+    portEXIT_CRITICAL(&poolLock);
+}
+
+// Push a job at the tail of a deque. Must be called
+// with the worker's lock held.
+static inline bool pushJob(WorkDeque *dq, WorkJob *job)
+{
+    if ((dq->tail - dq->head) == DEQUE_LEN) {
+        return false;
+    }
+    dq->job[dq->tail++ % DEQUE_LEN] = job;
+    return true;
+}
+
+// Pop the oldest job of a worker, from the highest
+// priority deque that is not empty.
+static WorkJob *popJob(Worker *w)
+{
+    WorkJob *job = NULL;
+
+    portENTER_CRITICAL(&w->lock);
+    for (int prio = (awpMax - 1); (prio >= 0) && (job == NULL); prio--) {
+        WorkDeque *dq = &w->deque[prio];
+        if (dq->tail != dq->head) {
+            job = dq->job[dq->head++ % DEQUE_LEN];
+        }
+    }
+    portEXIT_CRITICAL(&w->lock);
+
+    return job;
+}
+
+// Steal the oldest job of another worker, starting
+// with the highest priority.
+static WorkJob *stealJob(unsigned self)
+{
+    for (int prio = (awpMax - 1); prio >= 0; prio--) {
+        for (unsigned n = 1; n < APP_WORK_NUM_WORKERS; n++) {
+            Worker *w = &workerTbl[(self + n) % APP_WORK_NUM_WORKERS];
+            WorkDeque *dq = &w->deque[prio];
+            WorkJob *job = NULL;
+
+            portENTER_CRITICAL(&w->lock);
+            if (dq->tail != dq->head) {
+                job = dq->job[dq->head++ % DEQUE_LEN];
+            }
+            portEXIT_CRITICAL(&w->lock);
+
+            if (job != NULL) {
+                return job;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Submit some work to the pool. The job is queued to
+// the worker of the caller's core, or to the next one
+// if that one's deque is full, and an idle worker is
+// woken up to steal it if needed. Returns -1, with errno
+// set to ENOSPC, if there is no free job or room in the
+// deques.
+int appWorkSubmit(AppWorkFn fn, void *arg, AppWorkPrio prio)
+{
+    unsigned core = esp_cpu_get_core_id();
+    WorkJob *job;
+
+    if ((fn == NULL) || (prio >= awpMax) || !poolReady) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((job = allocJob()) == NULL) {
+        errno = ENOSPC;
+        return -1;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->submitTime = esp_timer_get_time();
+
+    for (unsigned n = 0; n < APP_WORK_NUM_WORKERS; n++) {
+        unsigned self = (core + n) % APP_WORK_NUM_WORKERS;
+        Worker *w = &workerTbl[self];
+        bool queued;
+
+        portENTER_CRITICAL(&w->lock);
+        queued = pushJob(&w->deque[prio], job);
+        portEXIT_CRITICAL(&w->lock);
+
+        if (queued) {
+            xTaskNotifyGive(w->taskHandle);
+            if (!w->idle) {
+                // The worker is busy: let an idle one
+                // steal the job.
+                for (unsigned i = 1; i < APP_WORK_NUM_WORKERS; i++) {
+                    Worker *other = &workerTbl[(self + i) % APP_WORK_NUM_WORKERS];
+                    if (other->idle) {
+                        xTaskNotifyGive(other->taskHandle);
+                        break;
+                    }
+                }
+            }
+            return 0;
+        }
+    }
+
+    freeJob(job);
+    errno = ENOSPC;
+    return -1;
+}
+
+static void appWorkTask(void *parms)
+{
+    unsigned self = (unsigned) (uintptr_t) parms;
+    Worker *w = &workerTbl[self];
+
+    while (true) {
+        WorkJob *job;
+        bool stolen = false;
+        uint32_t startTime, latency;
+
+        if ((job = popJob(w)) == NULL) {
+            // Tell the submitters we are idle before the
+            // last attempt to steal a job, so a job queued
+            // to a busy worker after that attempt always
+            // gets us notified.
+            w->idle = true;
+            if ((job = stealJob(self)) == NULL) {
+                // Nothing to do: wait for more work
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                w->idle = false;
+                continue;
+            }
+            w->idle = false;
+            stolen = true;
+        }
+
+        startTime = esp_timer_get_time();
+        latency = startTime - job->submitTime;
+        job->fn(job->arg);
+        freeJob(job);
+
+        w->runs++;
+        w->stolen += stolen;
+        w->sumLatency += latency;
+        if (latency > w->maxLatency) {
+            w->maxLatency = latency;
+        }
+        w->busyTime += (uint32_t) esp_timer_get_time() - startTime;
+    }
+
+    vTaskDelete(NULL);
+}
+
+int appWorkGetStats(unsigned worker, AppWorkStats *stats)
+{
+    const Worker *w;
+
+    if (worker >= APP_WORK_NUM_WORKERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w = &workerTbl[worker];
+    stats->runs = w->runs;
+    stats->stolen = w->stolen;
+    stats->avgLatency = (w->runs != 0) ? (w->sumLatency / w->runs) : 0;
+    stats->maxLatency = w->maxLatency;
+    stats->busyTime = w->busyTime / 1000;
+
+    return 0;
+}
+
+// Log the stats of each worker, as: runs/stolen
+// latency=avg/max busy=msec
+void appWorkLogStats(void)
+{
+    AppWorkStats stats;
+
+    for (unsigned n = 0; appWorkGetStats(n, &stats) == 0; n++) {
+        mlogDump(trace, "Worker %u: runs=%lu/%lu latency=%lu/%lu busy=%lu", n,
+             stats.runs, stats.stolen, stats.avgLatency, stats.maxLatency, stats.busyTime);
+    }
+    if (poolMisses != 0) {
+        mlog(trace, "Worker pool: %lu jobs rejected", poolMisses);
+    }
+}
+
+// Spawn the workers, one per core
+int appWorkInit(void)
+{
+    for (unsigned i = 0; i < NUM_JOBS; i++) {
+        jobPool[i].next = freeJobs;
+        freeJobs = &jobPool[i];
+    }
+
+    for (unsigned n = 0; n < APP_WORK_NUM_WORKERS; n++) {
+        Worker *w = &workerTbl[n];
+        char taskName[configMAX_TASK_NAME_LEN];
+
+        portMUX_INITIALIZE(&w->lock);
+        snprintf(taskName, sizeof (taskName), "appWork%u", n);
+        if (xTaskCreatePinnedToCore(appWorkTask, taskName, CONFIG_APP_WORK_TASK_STACK, (void *) (uintptr_t) n,
+                                    CONFIG_APP_WORK_TASK_PRIO, &w->taskHandle, n) != pdPASS) {
+            mlog(error, "Can't spawn %s task!", taskName);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    poolReady = true;
+
+    return 0;
+}
+
+#else
+
+int appWorkSubmit(AppWorkFn fn, void *arg, AppWorkPrio prio)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif  // CONFIG_APP_WORK_POOL
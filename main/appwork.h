@@ -0,0 +1,49 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#include "esp32.h"
+
+// Worker pool: runs the work submitted by the app on one
+// worker task per CPU core, so the work that doesn't need
+// to be serialized by the appMain task can use all the
+// cores. Each worker has its own deques of jobs, one per
+// priority level: the jobs are pushed to the deques of the
+// worker of the submitter's core, the worker runs the jobs
+// of its own deques in order, and an idle worker steals the
+// oldest job from the deques of the others.
+// The jobs come from a fixed pool, so submitting work
+// never allocates memory. On single core chips, such as
+// the ESP32-C3, there is a single worker.
+
+// Number of workers
+#define APP_WORK_NUM_WORKERS    portNUM_PROCESSORS
+
+// Work priority
+typedef enum AppWorkPrio {
+    awpNormal = 0,
+    awpHigh,
+    awpMax
+} AppWorkPrio;
+
+// Work function
+typedef void (*AppWorkFn)(void *arg);
+
+// Stats of each worker
+typedef struct AppWorkStats {
+    uint32_t runs;          // number of jobs run
+    uint32_t stolen;        // number of jobs stolen from the other workers
+    uint32_t avgLatency;    // avg time from submission to start [in usec]
+    uint32_t maxLatency;    // max time from submission to start [in usec]
+    uint32_t busyTime;      // total time spent running the jobs [in msec]
+} AppWorkStats;
+
+__BEGIN_DECLS
+
+extern int appWorkInit(void);
+extern int appWorkSubmit(AppWorkFn fn, void *arg, AppWorkPrio prio);
+extern int appWorkGetStats(unsigned worker, AppWorkStats *stats);
+extern void appWorkLogStats(void);
+
+__END_DECLS
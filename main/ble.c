@@ -1,14 +1,19 @@
 #include "sdkconfig.h"
 
 #include "app.h"
+#include "appevt.h"
+#include "apppm.h"
 #include "ble.h"
 #include "esp32.h"
 #include "led.h"
 #include "mlog.h"
 #include "nvram.h"
 #include "ota.h"
+#include "taskmon.h"
 #include "wifi.h"
 
+#define MLOG_MODULE lmBle
+
 #if defined(CONFIG_BLE_PERIPHERAL) || defined(CONFIG_BLE_CENTRAL)
 
 // We need to make this pointer file-global because the
@@ -83,6 +88,10 @@ typedef struct InbConnInfo {
     uint16_t cmdReqHandle;
     bool cmdReqIndicate;
 #endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+    uint16_t mlogDlHandle;
+    bool mlogDlNotify;
+#endif
 } InbConnInfo;
 
 static InbConnInfo inbConnInfo;
@@ -189,6 +198,7 @@ static int setWiFiCredentials(struct ble_gatt_access_ctxt *ctxt)
 static int getDevOperStatus(struct ble_gatt_access_ctxt *ctxt)
 {
     DevOperStatus devOperStatus = {0};
+    WorkLoopStats stats;
 
     uint32_t sysUpTime = pdTICKS_TO_MS(xTaskGetTickCount() - appData->baseTicks) / 1000;
     blePutUINT32(devOperStatus.sysUpTime, sysUpTime);
@@ -212,6 +222,24 @@ static int getDevOperStatus(struct ble_gatt_access_ctxt *ctxt)
 #endif
     devOperStatus.msgLogLevel= msgLogGetLevel();
     devOperStatus.msgLogDest= msgLogGetDest();
+    if (getWorkLoopStats(false, &stats) == 0) {
+        blePutUINT32(devOperStatus.workTimeP50, stats.workTime.p50);
+        blePutUINT32(devOperStatus.workTimeP90, stats.workTime.p90);
+        blePutUINT32(devOperStatus.workTimeP99, stats.workTime.p99);
+        blePutUINT32(devOperStatus.workTimeP999, stats.workTime.p999);
+        blePutUINT32(devOperStatus.wakeupLateP50, stats.wakeupLate.p50);
+        blePutUINT32(devOperStatus.wakeupLateP90, stats.wakeupLate.p90);
+        blePutUINT32(devOperStatus.wakeupLateP99, stats.wakeupLate.p99);
+        blePutUINT32(devOperStatus.wakeupLateP999, stats.wakeupLate.p999);
+        blePutUINT32(devOperStatus.sleepTimeP50, stats.sleepTime.p50);
+        blePutUINT32(devOperStatus.sleepTimeP90, stats.sleepTime.p90);
+        blePutUINT32(devOperStatus.sleepTimeP99, stats.sleepTime.p99);
+        blePutUINT32(devOperStatus.sleepTimeP999, stats.sleepTime.p999);
+        blePutUINT32(devOperStatus.sleepExitP50, stats.sleepExit.p50);
+        blePutUINT32(devOperStatus.sleepExitP90, stats.sleepExit.p90);
+        blePutUINT32(devOperStatus.sleepExitP99, stats.sleepExit.p99);
+        blePutUINT32(devOperStatus.sleepExitP999, stats.sleepExit.p999);
+    }
 
     return (os_mbuf_append(ctxt->om, &devOperStatus, sizeof (devOperStatus)) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
@@ -282,6 +310,25 @@ static CmdStatusCode setLogLevelCmd(struct os_mbuf *om)
     return csSuccess;
 }
 
+static CmdStatusCode setLogModLevelCmd(struct os_mbuf *om)
+{
+    LogModule logModule;
+    LogLevel logLevel;
+
+    if (om->om_len != 3) {
+        return csInvParam;
+    }
+
+    logModule = om->om_data[1];
+    logLevel = om->om_data[2];
+    if ((logModule >= lmMax) || (logLevel > debug)) {
+        return csInvParam;
+    }
+    msgLogSetModLevel(logModule, logLevel);
+
+    return csSuccess;
+}
+
 static CmdStatusCode setLogDestCmd(struct os_mbuf *om)
 {
     LogDest logDest;
@@ -376,6 +423,34 @@ static CmdStatusCode dumpMlogFileCmd(struct os_mbuf *om)
     return (dumpMlogFile(true) == 0) ? csSuccess : csFailed;
 }
 
+static CmdStatusCode dumpMlogWindowCmd(struct os_mbuf *om)
+{
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    uint32_t from, to;
+
+    if (om->om_len != 9) {
+        return csInvParam;
+    }
+
+    // Same time base as the log timestamps: the uptime,
+    // or the seconds since the Epoch.
+    from = bleGetUINT32(&om->om_data[1]);
+    to = bleGetUINT32(&om->om_data[5]);
+    if (from > to) {
+        return csInvParam;
+    }
+
+#ifdef CONFIG_APP_MAIN_TASK
+    // The dump is done by the appMain task
+    return (appEvtPost(aetMlogDump, 0, from, (void *) (uintptr_t) to) == 0) ? csSuccess : csFailed;
+#else
+    return (dumpMlogWindow((from * 1000000ULL), ((to * 1000000ULL) + 999999)) == 0) ? csSuccess : csFailed;
+#endif
+#else
+    return csInvOpCode;
+#endif
+}
+
 static CmdStatusCode deleteMlogFileCmd(struct os_mbuf *om)
 {
     return (deleteMlogFile(true) == 0) ? csSuccess : csFailed;
@@ -443,6 +518,14 @@ static int runCmd(struct ble_gatt_access_ctxt *ctxt)
         csc = deleteMlogFileCmd(om);
         break;
 
+    case coSetLogModLevel:
+        csc = setLogModLevelCmd(om);
+        break;
+
+    case coDumpMlogWindow:
+        csc = dumpMlogWindowCmd(om);
+        break;
+
     default:
         csc = csInvOpCode;
         mlog(warning, "Unsupported opCode 0x%02X", cmdStatus.opCode);
@@ -451,6 +534,9 @@ static int runCmd(struct ble_gatt_access_ctxt *ctxt)
 
     cmdStatus.status = csc;
 
+    // Let the app know about the command
+    appEvtPost(aetBleCmd, cmdStatus.opCode, csc, NULL);
+
     if (inbConnInfo.cmdReqIndicate) {
         // Send the Command Status via a BLE indication
         struct os_mbuf *om = ble_hs_mbuf_from_flat(&cmdStatus, sizeof (cmdStatus));
@@ -462,6 +548,318 @@ static int runCmd(struct ble_gatt_access_ctxt *ctxt)
     return 0;
 }
 
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+// Offset of the next chunk of the crash log
+// to be read.
+static uint16_t crashLogOffset;
+
+static int getCrashLog(struct ble_gatt_access_ctxt *ctxt)
+{
+    const char *crashLog;
+    size_t len = msgLogGetCrashLog(&crashLog);
+
+    if (crashLogOffset >= len) {
+        return 0;
+    }
+    len -= crashLogOffset;
+    if (len > DCS_CRASH_LOG_CHUNK_LEN) {
+        len = DCS_CRASH_LOG_CHUNK_LEN;
+    }
+
+    return (os_mbuf_append(ctxt->om, &crashLog[crashLogOffset], len) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+static int setCrashLogOffset(struct ble_gatt_access_ctxt *ctxt)
+{
+    struct os_mbuf *om = ctxt->om;
+
+    if ((om == NULL) || (om->om_data == NULL) || (om->om_len != sizeof (uint16_t))) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    crashLogOffset = bleGetUINT16(om->om_data);
+
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_TASK_MONITOR
+// Number of the first task of the next records
+// to be read.
+static uint8_t taskStatsIndex;
+
+_Static_assert((DCS_TASK_STATS_MAX_RECS * sizeof (DcsTaskStats)) <= 512, "Too many DcsTaskStats records");
+
+static int getTaskStats(struct ble_gatt_access_ctxt *ctxt)
+{
+    TaskMonInfo info;
+
+    for (unsigned n = 0; (n < DCS_TASK_STATS_MAX_RECS) && (taskMonGetInfo((taskStatsIndex + n), &info) == 0); n++) {
+        DcsTaskStats rec = {0};
+
+        strncpy((char *) rec.name, info.name, (sizeof (rec.name) - 1));
+        rec.core = info.core;
+        rec.prio = info.prio;
+        blePutUINT16(rec.cpuLast, info.cpuLast);
+        blePutUINT16(rec.cpuAvg, info.cpuAvg);
+        blePutUINT16(rec.cpuMax, info.cpuMax);
+        blePutUINT32(rec.stackSize, info.stackSize);
+        blePutUINT32(rec.minFree, info.minFree);
+        blePutUINT32(rec.recStackSize, info.recStackSize);
+        if (os_mbuf_append(ctxt->om, &rec, sizeof (rec)) != 0) {
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+    }
+
+    return 0;
+}
+
+static int setTaskStatsIndex(struct ble_gatt_access_ctxt *ctxt)
+{
+    struct os_mbuf *om = ctxt->om;
+
+    if ((om == NULL) || (om->om_data == NULL) || (om->om_len != sizeof (uint8_t))) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    taskStatsIndex = om->om_data[0];
+
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+// Notification header: type (UINT8) and offset (UINT32)
+#define MLOG_DL_HDR_LEN         5
+
+// Max number of log bytes sent in a notification
+#define MLOG_DL_MAX_DATA        512
+
+// Abort the download if the central doesn't grant
+// any credit for this long [in msec].
+#define MLOG_DL_CREDIT_TIMEOUT  10000
+
+// Max number of outstanding credits
+#define MLOG_DL_MAX_CREDITS     255
+
+// MLOG download state
+typedef struct MlogDlState {
+    volatile bool active;
+    volatile bool abort;
+    uint16_t connHandle;
+    uint32_t offset;        // start offset
+    uint32_t length;        // # bytes requested (0=all)
+    MsgLogReader rdr;
+} MlogDlState;
+
+static MlogDlState mlogDl;
+
+// Each credit granted by the central allows the
+// download task to send one data notification.
+static SemaphoreHandle_t mlogDlCredits;
+static StaticSemaphore_t mlogDlCreditsSem;
+
+static int mlogDlNotify(const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om;
+    int n;
+
+    // The pool of mbufs may be exhausted for a
+    // little while when the link is busy.
+    for (n = 0; (om = ble_hs_mbuf_from_flat(data, len)) == NULL; n++) {
+        if (n == 100) {
+            return -1;
+        }
+        vTaskDelay(1);
+    }
+
+    return (ble_gatts_notify_custom(mlogDl.connHandle, inbConnInfo.mlogDlHandle, om) == 0) ? 0 : -1;
+}
+
+static void mlogDlTask(void *arg)
+{
+    static uint8_t notifBuf[MLOG_DL_HDR_LEN + MLOG_DL_MAX_DATA];
+    MsgLogReader *rdr = &mlogDl.rdr;
+    MlogDlStatusCode status = mdsSuccess;
+    int64_t startTime = esp_timer_get_time();
+    uint16_t mtu = ble_att_mtu(mlogDl.connHandle);
+    uint32_t startOffset, endOffset;
+    uint32_t elapsedMsec;
+
+    if (mtu < BLE_ATT_MTU_DFLT) {
+        mtu = BLE_ATT_MTU_DFLT;
+    }
+
+    msgLogReaderOpen(rdr, false);
+
+    startOffset = (mlogDl.offset < rdr->totalSize) ? mlogDl.offset : rdr->totalSize;
+    endOffset = ((mlogDl.length == 0) || (mlogDl.length > (rdr->totalSize - startOffset))) ? rdr->totalSize : (startOffset + mlogDl.length);
+    msgLogReaderSeek(rdr, startOffset);
+
+    // Let the central know how much there is to download,
+    // so it can report the progress. The timestamp of the
+    // first log line tells whether the oldest segment was
+    // rotated out since a previous partial download.
+    notifBuf[0] = mdnInfo;
+    blePutUINT32(&notifBuf[1], rdr->totalSize);
+    blePutUINT32(&notifBuf[5], startOffset);
+    blePutUINT64(&notifBuf[9], rdr->firstTs);
+    if (mlogDlNotify(notifBuf, 17) != 0) {
+        status = mdsFailed;
+    }
+
+    while ((status == mdsSuccess) && (rdr->offset < endOffset)) {
+        uint32_t offset = rdr->offset;
+        size_t len;
+        int n;
+
+        // Wait for a credit
+        if (xSemaphoreTake(mlogDlCredits, pdMS_TO_TICKS(MLOG_DL_CREDIT_TIMEOUT)) != pdTRUE) {
+            status = mdsTimedOut;
+            break;
+        }
+        if (mlogDl.abort) {
+            status = mdsAborted;
+            break;
+        }
+
+        // Fill up the notification, as allowed by the
+        // negotiated ATT MTU.
+        len = mtu - 3 - MLOG_DL_HDR_LEN;
+        if (len > MLOG_DL_MAX_DATA) {
+            len = MLOG_DL_MAX_DATA;
+        }
+        if (len > (endOffset - offset)) {
+            len = endOffset - offset;
+        }
+        if ((n = msgLogReaderRead(rdr, &notifBuf[MLOG_DL_HDR_LEN], len)) <= 0) {
+            // The segment may have been rotated out
+            // since the download started.
+            mlog(errNo, "Failed to read %s!", rdr->segPath[rdr->seg]);
+            status = mdsFailed;
+            break;
+        }
+
+        notifBuf[0] = mdnData;
+        blePutUINT32(&notifBuf[1], offset);
+        if (mlogDlNotify(notifBuf, (MLOG_DL_HDR_LEN + n)) != 0) {
+            status = mdsFailed;
+            break;
+        }
+    }
+
+    // The end offset can be used to resume
+    // an incomplete download.
+    notifBuf[0] = mdnEnd;
+    blePutUINT32(&notifBuf[1], rdr->offset);
+    notifBuf[5] = status;
+    mlogDlNotify(notifBuf, 6);
+
+    elapsedMsec = (esp_timer_get_time() - startTime) / 1000;
+    mlog(info, "MLOG download %s: %lu bytes in %lu ms (%lu B/s) mtu=%u",
+         (status == mdsSuccess) ? "done" : "failed", (unsigned long) (rdr->offset - startOffset), (unsigned long) elapsedMsec,
+         (unsigned long) ((elapsedMsec != 0) ? (((uint64_t) (rdr->offset - startOffset) * 1000) / elapsedMsec) : 0), mtu);
+
+    msgLogReaderClose(rdr);
+    mlogDl.active = false;
+
+    vTaskDelete(NULL);
+}
+
+static int mlogDlStart(struct os_mbuf *om)
+{
+    unsigned credits;
+
+    if (om->om_len != 10) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    if (!inbConnInfo.mlogDlNotify) {
+        return BLE_ATT_ERR_CCCD_IMPROPER_CONF;
+    }
+    if (mlogDl.active) {
+        // Download already in progress
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if ((mlogDlCredits == NULL) &&
+        ((mlogDlCredits = xSemaphoreCreateCountingStatic(MLOG_DL_MAX_CREDITS, 0, &mlogDlCreditsSem)) == NULL)) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    // Discard any credits left over by
+    // the previous download.
+    while (xSemaphoreTake(mlogDlCredits, 0) == pdTRUE)
+        ;
+
+    mlogDl.connHandle = inbConnInfo.connHandle;
+    mlogDl.offset = bleGetUINT32(&om->om_data[1]);
+    mlogDl.length = bleGetUINT32(&om->om_data[5]);
+    mlogDl.abort = false;
+    mlogDl.active = true;
+
+    // The log segments are read by a separate task,
+    // so the BLE Host task isn't stalled by the file
+    // system accesses.
+    if (xTaskCreatePinnedToCore(mlogDlTask, "mlogDl", CONFIG_DCS_MLOG_DOWNLOAD_TASK_STACK, NULL,
+                                CONFIG_DCS_MLOG_DOWNLOAD_TASK_PRIO, NULL, tskNO_AFFINITY) != pdPASS) {
+        mlog(error, "Failed to start mlogDlTask!");
+        mlogDl.active = false;
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    for (credits = om->om_data[9]; credits != 0; credits--) {
+        xSemaphoreGive(mlogDlCredits);
+    }
+
+    return 0;
+}
+
+static void mlogDlAbort(void)
+{
+    if (mlogDl.active) {
+        // Wake up the download task if it's
+        // waiting for a credit.
+        mlogDl.abort = true;
+        xSemaphoreGive(mlogDlCredits);
+    }
+}
+
+static int mlogDlControl(struct ble_gatt_access_ctxt *ctxt)
+{
+    struct os_mbuf *om = ctxt->om;
+    unsigned credits;
+
+    if ((om == NULL) || (om->om_data == NULL) || (om->om_len < 1)) {
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    switch (om->om_data[0]) {
+    case mdoStart:
+        return mlogDlStart(om);
+
+    case mdoCredit:
+        if (om->om_len != 2) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (mlogDl.active) {
+            for (credits = om->om_data[1]; credits != 0; credits--) {
+                xSemaphoreGive(mlogDlCredits);
+            }
+        }
+        break;
+
+    case mdoAbort:
+        mlogDlAbort();
+        break;
+
+    default:
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    return 0;
+}
+#endif
+
 #ifdef CONFIG_DCS_SERVICE_HELP
 static const char *cmdHelp = \
     "01: Restart\n"
@@ -472,8 +870,10 @@ static const char *cmdHelp = \
     "06: UTC Time {secs since Epoch}\n"
     "07: UTC Offset {hrs from UTC}\n"
     "08: WiFi State {0=Dis 1=Ena}\n"
-    "09: Dump MLOG.TXT\n"
-    "0A: Delete MLOG.TXT\n";
+    "09: Dump MLOG files\n"
+    "0A: Delete MLOG files\n"
+    "0B: MLOG Module Level {0=App 1=BLE 2=HTTPS 3=LED 4=MLOG 5=NVRAM 6=OTA 7=WiFi} {0=No 1=Inf 2=Trc 3=Dbg}\n"
+    "0C: Dump MLOG window {from secs} {to secs}\n";
 #endif
 
 static int deviceConfigCb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
@@ -497,6 +897,28 @@ static int deviceConfigCb(uint16_t conn_handle, uint16_t attr_handle, struct ble
 #ifdef CONFIG_DCS_SERVICE_HELP
     } else if (uuid == GATT_DCS_COMMAND_HELP_UUID) {
         return (os_mbuf_append(ctxt->om, cmdHelp, strlen(cmdHelp)) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+#endif
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+    } else if (uuid == GATT_DCS_CRASH_LOG_UUID) {
+        if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+            return getCrashLog(ctxt);
+        } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            return setCrashLogOffset(ctxt);
+        }
+#endif
+#ifdef CONFIG_TASK_MONITOR
+    } else if (uuid == GATT_DCS_TASK_STATS_UUID) {
+        if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+            return getTaskStats(ctxt);
+        } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            return setTaskStatsIndex(ctxt);
+        }
+#endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+    } else if (uuid == GATT_DCS_MLOG_DOWNLOAD_UUID) {
+        if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            return mlogDlControl(ctxt);
+        }
 #endif
     }
 
@@ -581,6 +1003,31 @@ static const struct ble_gatt_svc_def gattSvcs[] = {
                 .access_cb = deviceConfigCb,
                 .flags = BLE_GATT_CHR_F_READ,
             },
+#endif
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+            {
+                // Crash Log
+                .uuid = BLE_UUID16_DECLARE(GATT_DCS_CRASH_LOG_UUID),
+                .access_cb = deviceConfigCb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+#endif
+#ifdef CONFIG_TASK_MONITOR
+            {
+                // Task Stats
+                .uuid = BLE_UUID16_DECLARE(GATT_DCS_TASK_STATS_UUID),
+                .access_cb = deviceConfigCb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+#endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+            {
+                // MLOG Download
+                .uuid = BLE_UUID16_DECLARE(GATT_DCS_MLOG_DOWNLOAD_UUID),
+                .access_cb = deviceConfigCb,
+                .val_handle = &inbConnInfo.mlogDlHandle,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+            },
 #endif
             {
                 0,  // No more characteristics in this service
@@ -617,8 +1064,13 @@ static int procConnectEvent(const struct ble_gap_event *event)
         inbConnInfo.connEstablished = true;
         inbConnInfo.peerAddr = connDesc.peer_id_addr;
 
-        mlog(info, "Inbound BLE connection established: connHandle=%u peer=%s",
-                inbConnInfo.connHandle, fmtBleMac(inbConnInfo.peerAddr.val));
+        mlogKV(info, "bleConnected", KV_UINT("connHandle", inbConnInfo.connHandle), KV_BLE_ADDR("peer", inbConnInfo.peerAddr.val));
+
+#ifdef CONFIG_APP_POWER_SAVE
+        // Stay out of light sleep while connected, so
+        // the connection events are not missed.
+        appPmAcquire(aplBle);
+#endif
 
         // Let the user know...
         ledSet(on, yellow);
@@ -637,11 +1089,20 @@ static int procDisconnectEvent(const struct ble_gap_event *event)
         // Clean up connection state
         inbConnInfo.connTime = 0;
         inbConnInfo.connHandle = 0;
+#ifdef CONFIG_APP_POWER_SAVE
+        if (inbConnInfo.connEstablished) {
+            appPmRelease(aplBle);
+        }
+#endif
         inbConnInfo.connEstablished = false;
         memset(&inbConnInfo.peerAddr, 0, sizeof (inbConnInfo.peerAddr));
 #ifdef CONFIG_DEVICE_CONFIG_SERVICE
         inbConnInfo.cmdReqIndicate = false;
 #endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+        inbConnInfo.mlogDlNotify = false;
+        mlogDlAbort();
+#endif
 
         // Start advertising again
         nimbleAdvertise();
@@ -680,6 +1141,11 @@ static int procSubscribeEvent(const struct ble_gap_event *event)
     } else if (attrHandle == inbConnInfo.cmdReqHandle) {
         inbConnInfo.cmdReqIndicate = event->subscribe.cur_indicate;
         mlog(info, "Command Request indications %sabled!", (inbConnInfo.cmdReqIndicate) ? "en" : "dis");
+#endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+    } else if (attrHandle == inbConnInfo.mlogDlHandle) {
+        inbConnInfo.mlogDlNotify = event->subscribe.cur_notify;
+        mlog(info, "MLOG Download notifications %sabled!", (inbConnInfo.mlogDlNotify) ? "en" : "dis");
 #endif
     } else {
         mlog(warning, "Unsupported attribute handle: connHandle=%u attrHandle=%u", event->subscribe.conn_handle, attrHandle);
@@ -14,10 +14,42 @@
 #define GATT_DCS_OPERATING_STATUS_UUID          (CONFIG_DEVICE_CONFIG_SERVICE_UUID+2)   // READ
 #define GATT_DCS_COMMAND_REQUEST_UUID           (CONFIG_DEVICE_CONFIG_SERVICE_UUID+3)   // READ, WRITE, INDICATE
 #define GATT_DCS_COMMAND_HELP_UUID              (CONFIG_DEVICE_CONFIG_SERVICE_UUID+4)   // READ
+#define GATT_DCS_CRASH_LOG_UUID                 (CONFIG_DEVICE_CONFIG_SERVICE_UUID+5)   // READ, WRITE
+#define GATT_DCS_MLOG_DOWNLOAD_UUID             (CONFIG_DEVICE_CONFIG_SERVICE_UUID+6)   // WRITE, NOTIFY
+#define GATT_DCS_TASK_STATS_UUID                (CONFIG_DEVICE_CONFIG_SERVICE_UUID+7)   // READ, WRITE
+
+// The Crash Log characteristic returns the log lines saved
+// in the crash log before the last reset, if it was caused
+// by a crash. Reading it returns up to DCS_CRASH_LOG_CHUNK_LEN
+// bytes, starting at the offset last written to it as a
+// UINT16 value. An empty value marks the end of the log.
+#define DCS_CRASH_LOG_CHUNK_LEN     512
+
+// The Task Stats characteristic returns the stats kept
+// by the task monitor: reading it returns up to
+// DCS_TASK_STATS_MAX_RECS records, starting at the task
+// number last written to it as a UINT8 value. An empty
+// value marks the end of the list.
+#define DCS_TASK_STATS_MAX_RECS     14
+
+// Task Stats record
+typedef struct DcsTaskStats {
+    uint8_t name[16];           // +00  UINT8[16]: Task Name (NUL padded)
+    uint8_t core;               // +16  INT8: CPU Core (-1=No affinity)
+    uint8_t prio;               // +17  UINT8: Priority
+    uint8_t cpuLast[2];         // +18  UINT16: CPU Usage in the last period [in 0.01%]
+    uint8_t cpuAvg[2];          // +20  UINT16: Avg CPU Usage over the window [in 0.01%]
+    uint8_t cpuMax[2];          // +22  UINT16: Max CPU Usage over the window [in 0.01%]
+    uint8_t stackSize[4];       // +24  UINT32: Stack Size [in bytes] (0=Unknown)
+    uint8_t minFree[4];         // +28  UINT32: Min Free Stack Space [in bytes]
+    uint8_t recStackSize[4];    // +32  UINT32: Recommended Stack Size [in bytes] (0=Unknown)
+} DcsTaskStats;                 // +36
 
 // Device Operating Status: defines the format of the
 // data returned when reading the DCS_OPERATING_STATUS
-// characteristic.
+// characteristic. The work loop percentiles are those of
+// the last stats window, and are 0 when the work loop is
+// not timed.
 typedef struct DevOperStatus {
     uint8_t sysUpTime[4];       // +00  UINT32: System Up Time [in seconds]
     uint8_t utcOffset;          // +04  INT8: UTC Offset [in hours from GMT]
@@ -34,6 +66,22 @@ typedef struct DevOperStatus {
     uint8_t freeFatFsSpace[2];  // +38  UINT16: Free FAT FS Space [in kB]
     uint8_t msgLogLevel;        // +40  UINT8: Message Logging Level
     uint8_t msgLogDest;         // +41  UINT8: Message Logging Destination
+    uint8_t workTimeP50[4];     // +42  UINT32: Work Loop Time p50 [in usec]
+    uint8_t workTimeP90[4];     // +46  UINT32: Work Loop Time p90 [in usec]
+    uint8_t workTimeP99[4];     // +50  UINT32: Work Loop Time p99 [in usec]
+    uint8_t workTimeP999[4];    // +54  UINT32: Work Loop Time p99.9 [in usec]
+    uint8_t wakeupLateP50[4];   // +58  UINT32: Work Loop Wakeup Lateness p50 [in usec]
+    uint8_t wakeupLateP90[4];   // +62  UINT32: Work Loop Wakeup Lateness p90 [in usec]
+    uint8_t wakeupLateP99[4];   // +66  UINT32: Work Loop Wakeup Lateness p99 [in usec]
+    uint8_t wakeupLateP999[4];  // +70  UINT32: Work Loop Wakeup Lateness p99.9 [in usec]
+    uint8_t sleepTimeP50[4];    // +74  UINT32: Work Loop Sleep Time p50 [in usec]
+    uint8_t sleepTimeP90[4];    // +78  UINT32: Work Loop Sleep Time p90 [in usec]
+    uint8_t sleepTimeP99[4];    // +82  UINT32: Work Loop Sleep Time p99 [in usec]
+    uint8_t sleepTimeP999[4];   // +86  UINT32: Work Loop Sleep Time p99.9 [in usec]
+    uint8_t sleepExitP50[4];    // +90  UINT32: Work Loop Sleep Exit Latency p50 [in usec]
+    uint8_t sleepExitP90[4];    // +94  UINT32: Work Loop Sleep Exit Latency p90 [in usec]
+    uint8_t sleepExitP99[4];    // +98  UINT32: Work Loop Sleep Exit Latency p99 [in usec]
+    uint8_t sleepExitP999[4];   // +102 UINT32: Work Loop Sleep Exit Latency p99.9 [in usec]
 } DevOperStatus;
 
 // Command Op Code
@@ -49,6 +97,8 @@ typedef enum CmdOpCode {
     coSetWiFiState,     // {UINT8: 0=Disabled, 1=Enabled}
     coDumpMlogFile,
     coDeleteMlogFile,
+    coSetLogModLevel,   // {UINT8: 0=APP, 1=BLE, 2=HTTPS, 3=LED, 4=MLOG, 5=NVRAM, 6=OTA, 7=WIFI, UINT8: 0=NONE, 1=INFO, 2=TRACE, 3=DEBUG}
+    coDumpMlogWindow,   // {UINT32: from [in secs], UINT32: to [in secs]}
 } CmdOpCode;
 
 // Command Request
@@ -73,6 +123,35 @@ typedef struct CmdStatus {
     uint8_t opCode;
     uint8_t status;
 } CmdStatus;
+
+// MLOG Download: the log segments, from the oldest to the
+// newest one, are downloaded as a single stream of bytes,
+// sent in BLE notifications. Each data notification uses
+// up one credit, and the download pauses when the central
+// runs out of credits.
+
+// MLOG Download Control Op Code: written to the
+// DCS_MLOG_DOWNLOAD characteristic.
+typedef enum MlogDlOpCode {
+    mdoStart = 0x01,    // {UINT32: start offset, UINT32: # bytes (0=all), UINT8: # credits}
+    mdoCredit,          // {UINT8: # credits}
+    mdoAbort,
+} MlogDlOpCode;
+
+// MLOG Download Notification Type
+typedef enum MlogDlNotifType {
+    mdnInfo = 0x01,     // {UINT32: total # bytes, UINT32: start offset, UINT64: timestamp of the first line}
+    mdnData,            // {UINT32: offset, UINT8[]: data}
+    mdnEnd,             // {UINT32: end offset, UINT8: status}
+} MlogDlNotifType;
+
+// MLOG Download Status Code
+typedef enum MlogDlStatusCode {
+    mdsSuccess = 0x00,
+    mdsFailed,
+    mdsAborted,
+    mdsTimedOut,
+} MlogDlStatusCode;
 #endif  // CONFIG_DEVICE_CONFIG_SERVICE
 
 __BEGIN_DECLS
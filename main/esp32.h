@@ -22,6 +22,7 @@
 #include "esp_http_server.h"
 #include "esp_https_ota.h"
 #include "esp_timer.h"
+#include "esp_pm.h"
 #include "esp_vfs.h"
 #include "esp_vfs_dev.h"
 #include "esp_vfs_fat.h"
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "hdrhist.h"
+
+#define SUB_COUNT   (1U << HDR_HIST_SUB_BITS)
+
+_Static_assert((HDR_HIST_MAX_BITS > HDR_HIST_SUB_BITS) && (HDR_HIST_MAX_BITS <= 32), "Invalid HDR_HIST_MAX_BITS");
+
+// Get the index of the bucket of a value
+static inline unsigned bucketIndex(uint32_t value)
+{
+    unsigned msb;
+
+    if (value > HDR_HIST_MAX_VALUE) {
+        value = HDR_HIST_MAX_VALUE;
+    }
+    if (value < SUB_COUNT) {
+        return value;
+    }
+
+    msb = 31 - __builtin_clz(value);
+    return ((msb - HDR_HIST_SUB_BITS + 1) << HDR_HIST_SUB_BITS) + ((value >> (msb - HDR_HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+// Get the highest value that goes into a bucket
+static inline uint32_t bucketHighValue(unsigned index)
+{
+    unsigned group = index >> HDR_HIST_SUB_BITS;
+    unsigned sub = index & (SUB_COUNT - 1);
+
+    if (group == 0) {
+        return index;
+    }
+
+    return (((SUB_COUNT + sub + 1) << (group - 1)) - 1);
+}
+
+void hdrHistReset(HdrHist *hist)
+{
+    memset(hist, 0, sizeof (*hist));
+}
+
+void hdrHistRecord(HdrHist *hist, uint32_t value)
+{
+    if ((hist->count == 0) || (value < hist->min)) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->count++;
+    hist->sum += value;
+    hist->bucket[bucketIndex(value)]++;
+}
+
+// Add the values recorded in 'src' to 'dst'
+void hdrHistMerge(HdrHist *dst, const HdrHist *src)
+{
+    if (src->count == 0) {
+        return;
+    }
+
+    if ((dst->count == 0) || (src->min < dst->min)) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (unsigned i = 0; i < HDR_HIST_NUM_BUCKETS; i++) {
+        dst->bucket[i] += src->bucket[i];
+    }
+}
+
+// Get the value below which (or at which) 'pct100'
+// hundredths of a percent of the recorded values fall,
+// e.g. 9990 for p99.9. Returns 0 if the histogram is
+// empty.
+uint32_t hdrHistPercentile(const HdrHist *hist, uint32_t pct100)
+{
+    uint64_t target;
+    uint64_t total = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    if (pct100 >= 10000) {
+        return hist->max;
+    }
+
+    target = (((uint64_t) hist->count * pct100) + 9999) / 10000;
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (unsigned i = 0; i < HDR_HIST_NUM_BUCKETS; i++) {
+        total += hist->bucket[i];
+        if (total >= target) {
+            uint32_t value = bucketHighValue(i);
+            if (value > hist->max) {
+                value = hist->max;
+            }
+            if (value < hist->min) {
+                value = hist->min;
+            }
+            return value;
+        }
+    }
+
+    return hist->max;
+}
+
+void hdrHistSummarize(const HdrHist *hist, HdrHistSummary *summary)
+{
+    summary->count = hist->count;
+    summary->min = hist->min;
+    summary->avg = (hist->count != 0) ? (hist->sum / hist->count) : 0;
+    summary->p50 = hdrHistPercentile(hist, 5000);
+    summary->p90 = hdrHistPercentile(hist, 9000);
+    summary->p99 = hdrHistPercentile(hist, 9900);
+    summary->p999 = hdrHistPercentile(hist, 9990);
+    summary->max = hist->max;
+}
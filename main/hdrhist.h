@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+// Fixed-size log-linear (HDR style) histogram of uint32_t
+// values, such as latencies in usec. The values below
+// 2^HDR_HIST_SUB_BITS get a bucket each, and each power
+// of two above that is split into 2^HDR_HIST_SUB_BITS
+// linear sub-buckets, so the value reported for a bucket
+// is within 1/2^HDR_HIST_SUB_BITS (6.25%) of the actual
+// values. Recording a value is O(1) and never allocates
+// memory. The values above HDR_HIST_MAX_VALUE are counted
+// in the last bucket, but the max value is kept exact.
+
+#define HDR_HIST_SUB_BITS       4
+#define HDR_HIST_MAX_BITS       24      // ~16.7 secs when in usec
+#define HDR_HIST_MAX_VALUE      ((1UL << HDR_HIST_MAX_BITS) - 1)
+#define HDR_HIST_NUM_BUCKETS    ((HDR_HIST_MAX_BITS - HDR_HIST_SUB_BITS + 1) << HDR_HIST_SUB_BITS)
+
+typedef struct HdrHist {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[HDR_HIST_NUM_BUCKETS];
+} HdrHist;
+
+// Summary of a histogram: the percentiles most often
+// used to look at the tail of the distribution.
+typedef struct HdrHistSummary {
+    uint32_t count;
+    uint32_t min;
+    uint32_t avg;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t p999;
+    uint32_t max;
+} HdrHistSummary;
+
+__BEGIN_DECLS
+
+extern void hdrHistReset(HdrHist *hist);
+extern void hdrHistRecord(HdrHist *hist, uint32_t value);
+extern void hdrHistMerge(HdrHist *dst, const HdrHist *src);
+extern uint32_t hdrHistPercentile(const HdrHist *hist, uint32_t pct100);
+extern void hdrHistSummarize(const HdrHist *hist, HdrHistSummary *summary);
+
+__END_DECLS
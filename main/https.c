@@ -1,10 +1,18 @@
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "sdkconfig.h"
 
+#include "app.h"
 #include "esp32.h"
 #include "https.h"
+#include "mempool.h"
 #include "mlog.h"
+#include "taskmon.h"
+
+#define MLOG_MODULE lmHttps
 
 #ifdef CONFIG_WEB_SERVER
 // This string is the content of the web page served
@@ -17,11 +25,14 @@ static esp_err_t getData(httpd_req_t *req)
     size_t bufLen;
     bufLen = httpd_req_get_hdr_value_len(req, "Host") + 1;
     if (bufLen > 1) {
-        buf = malloc(bufLen);
+        if ((buf = memPoolAlloc(bufLen)) == NULL) {
+            mlog(error, "Can't alloc %zu bytes for Host header!", bufLen);
+            return httpd_resp_send_500(req);
+        }
         if (httpd_req_get_hdr_value_str(req, "Host", buf, bufLen) == ESP_OK) {
             //printf("Found header => Host: %s\n", buf);
         }
-        free(buf);
+        memPoolFree(buf);
     }
     const char *respText = (const char *) req->user_ctx;
     return httpd_resp_send(req, respText, HTTPD_RESP_USE_STRLEN);
@@ -34,6 +45,336 @@ static const httpd_uri_t helpURI = {
     .user_ctx  = helpText,
 };
 
+#ifdef CONFIG_WEB_SERVER_MLOG
+// Size of the blocks of log data sent in each chunk
+#define MLOG_BLOCK_SIZE     1024
+
+// How long to wait for new log lines in follow
+// mode before checking the connection [in msec].
+#define MLOG_FOLLOW_WAIT    5000
+
+#if defined(CONFIG_MSG_LOG_BINARY) || defined(CONFIG_MSG_LOG_COMPRESS)
+#define MLOG_CONTENT_TYPE   "application/octet-stream"
+#else
+#define MLOG_CONTENT_TYPE   "text/plain"
+#endif
+
+// State of a log stream
+typedef struct MlogStream {
+    MsgLogReader rdr;
+    char buf[MLOG_BLOCK_SIZE];
+} MlogStream;
+
+// The URI handlers run in the context of the server
+// task, while follow mode runs in a task of its own.
+static MlogStream mlogStream;
+#ifdef CONFIG_MSG_LOG_FOLLOW
+static MlogStream mlogFollowStream;
+static volatile bool mlogFollowActive;
+#endif
+
+// Parse the "Range: bytes=<first>-[<last>]" or the
+// "Range: bytes=-<suffix-len>" header. Sets 'end' to
+// one past the last byte of the range. Returns 1 if
+// the header was found, 0 if not, or -1 if it's
+// invalid.
+static int getRange(httpd_req_t *req, uint32_t totalSize, uint32_t *first, uint32_t *end)
+{
+    char hdrBuf[48];
+    char *p, *endp;
+    unsigned long val;
+
+    if (httpd_req_get_hdr_value_str(req, "Range", hdrBuf, sizeof (hdrBuf)) != ESP_OK) {
+        return 0;
+    }
+    if (strncmp(hdrBuf, "bytes=", 6) != 0) {
+        return -1;
+    }
+
+    p = &hdrBuf[6];
+    if (*p == '-') {
+        // The last N bytes
+        val = strtoul((p + 1), &endp, 10);
+        if ((endp == (p + 1)) || (*endp != '\0')) {
+            return -1;
+        }
+        *first = (val < totalSize) ? (totalSize - val) : 0;
+        *end = totalSize;
+    } else {
+        *first = strtoul(p, &endp, 10);
+        if ((endp == p) || (*endp != '-')) {
+            return -1;
+        }
+        p = endp + 1;
+        if (*p == '\0') {
+            *end = totalSize;
+        } else {
+            val = strtoul(p, &endp, 10);
+            if ((*endp != '\0') || (val < *first)) {
+                return -1;
+            }
+            *end = (val < totalSize) ? (val + 1) : totalSize;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+// Tells whether the client has closed the connection
+static bool connClosed(httpd_req_t *req)
+{
+    char c;
+    return (recv(httpd_req_to_sockfd(req), &c, 1, (MSG_PEEK | MSG_DONTWAIT)) == 0);
+}
+#endif
+
+// Send the log segments using chunked transfer encoding,
+// reading them from the FATFS one block at a time. In
+// follow mode the new log lines are sent as well, as
+// they are produced, until the client goes away.
+static esp_err_t sendMlog(httpd_req_t *req, MlogStream *stream, bool follow)
+{
+    MsgLogReader *rdr = &stream->rdr;
+    char hdrBuf[48];
+    uint32_t first = 0, end;
+    esp_err_t err = ESP_OK;
+    int range;
+    int n;
+
+    if (msgLogReaderOpen(rdr, follow) != 0) {
+        mlog(errNo, "Failed to open the log reader!");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Log not available");
+    }
+
+    end = rdr->totalSize;
+#if defined(CONFIG_MSG_LOG_BINARY) || defined(CONFIG_MSG_LOG_COMPRESS)
+    if (follow) {
+        // The new log lines are sent as text, so skip
+        // the binary or compressed log segments.
+        first = rdr->totalSize;
+    } else
+#endif
+    if ((range = getRange(req, rdr->totalSize, &first, &end)) != 0) {
+        // In follow mode a range that starts at the end
+        // of the log just means "only the new lines".
+        if ((range < 0) || (first > rdr->totalSize) || ((first == rdr->totalSize) && !follow)) {
+            snprintf(hdrBuf, sizeof (hdrBuf), "bytes */%lu", (unsigned long) rdr->totalSize);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", hdrBuf);
+            err = httpd_resp_send(req, NULL, 0);
+            msgLogReaderClose(rdr);
+            return err;
+        }
+        if (first < end) {
+            snprintf(hdrBuf, sizeof (hdrBuf), "bytes %lu-%lu/%lu", (unsigned long) first, (unsigned long) (end - 1), (unsigned long) rdr->totalSize);
+            httpd_resp_set_status(req, "206 Partial Content");
+            httpd_resp_set_hdr(req, "Content-Range", hdrBuf);
+        }
+    }
+
+    httpd_resp_set_type(req, (follow) ? "text/plain" : MLOG_CONTENT_TYPE);
+
+    msgLogReaderSeek(rdr, first);
+    while ((err == ESP_OK) && (rdr->offset < end)) {
+        size_t len = end - rdr->offset;
+        if (len > sizeof (stream->buf)) {
+            len = sizeof (stream->buf);
+        }
+        if ((n = msgLogReaderRead(rdr, stream->buf, len)) <= 0) {
+            // The segment may have been deleted by a log
+            // rotation: too late to report an error, so
+            // abort the connection rather than finish the
+            // response short of its Content-Range.
+            mlog(errNo, "Failed to read %s!", rdr->segPath[rdr->seg]);
+            err = ESP_FAIL;
+            break;
+        }
+        err = httpd_resp_send_chunk(req, stream->buf, n);
+    }
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+    while (follow && (err == ESP_OK)) {
+        if ((n = msgLogFollowRead(stream->buf, sizeof (stream->buf), MLOG_FOLLOW_WAIT)) != 0) {
+            err = httpd_resp_send_chunk(req, stream->buf, n);
+        } else if (connClosed(req)) {
+            err = ESP_FAIL;
+        }
+    }
+#endif
+
+    if (err == ESP_OK) {
+        // Terminate the chunked response
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    msgLogReaderClose(rdr);
+
+    return err;
+}
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+static void mlogFollowTask(void *arg)
+{
+    httpd_req_t *req = arg;
+
+    sendMlog(req, &mlogFollowStream, true);
+    httpd_req_async_handler_complete(req);
+    mlogFollowActive = false;
+
+    vTaskDelete(NULL);
+}
+#endif
+
+// This function handles the URL "http://<addr>:<port>/mlog[?follow=1]"
+static esp_err_t getMlog(httpd_req_t *req)
+{
+    char query[32];
+    char value[8];
+    bool follow = false;
+
+    if ((httpd_req_get_url_query_str(req, query, sizeof (query)) == ESP_OK) &&
+        (httpd_query_key_value(query, "follow", value, sizeof (value)) == ESP_OK)) {
+        follow = (strcmp(value, "0") != 0);
+    }
+
+    if (!follow) {
+        return sendMlog(req, &mlogStream, false);
+    }
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+    {
+        httpd_req_t *asyncReq;
+
+        if (mlogFollowActive) {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            return httpd_resp_send(req, "Log already followed\n", HTTPD_RESP_USE_STRLEN);
+        }
+
+        // Follow mode doesn't end until the client goes
+        // away, so it's handed off to a task of its own,
+        // keeping the server task free to handle other
+        // requests.
+        if (httpd_req_async_handler_begin(req, &asyncReq) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        }
+        mlogFollowActive = true;
+        if (xTaskCreatePinnedToCore(mlogFollowTask, "mlogFollow", CONFIG_WEB_SERVER_TASK_STACK, asyncReq,
+                                    CONFIG_WEB_SERVER_MLOG_TASK_PRIO, NULL, CONFIG_WEB_SERVER_TASK_CPU) != pdPASS) {
+            mlog(error, "Failed to start mlogFollowTask!");
+            mlogFollowActive = false;
+            httpd_req_async_handler_complete(asyncReq);
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+#else
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Follow mode not supported");
+#endif
+}
+
+static const httpd_uri_t mlogURI = {
+    .uri       = "/mlog",
+    .method    = HTTP_GET,
+    .handler   = getMlog,
+    .user_ctx  = NULL,
+};
+#endif  // CONFIG_WEB_SERVER_MLOG
+
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+static int fmtHistSummary(char *buf, size_t len, const char *name, const HdrHistSummary *hs)
+{
+    return snprintf(buf, len, "%s: n=%lu min=%lu avg=%lu p50=%lu p90=%lu p99=%lu p99.9=%lu max=%lu [us]\n",
+                    name, hs->count, hs->min, hs->avg, hs->p50, hs->p90, hs->p99, hs->p999, hs->max);
+}
+
+// Send the percentiles of the work loop timing stats,
+// over the last stats window and since boot, one line per
+// histogram, when the client requests the URL
+// "http://<addr>:<port>/stats"
+static esp_err_t getStats(httpd_req_t *req)
+{
+    WorkLoopStats stats;
+    char buf[160];
+    esp_err_t err;
+
+    httpd_resp_set_type(req, "text/plain");
+
+    for (int sinceBoot = 0; sinceBoot <= 1; sinceBoot++) {
+        const struct {
+            const char *name;
+            const HdrHistSummary *hs;
+        } histTbl[] = {
+            { "workTime", &stats.workTime },
+            { "wakeupLate", &stats.wakeupLate },
+            { "sleepTime", &stats.sleepTime },
+            { "sleepExit", &stats.sleepExit },
+        };
+
+        if (getWorkLoopStats(sinceBoot, &stats) != 0) {
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stats not available");
+        }
+        snprintf(buf, sizeof (buf), "%s\n", (sinceBoot ? "Since boot" : "Last window"));
+        if ((err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN)) != ESP_OK) {
+            return err;
+        }
+        for (int i = 0; i < (sizeof (histTbl) / sizeof (histTbl[0])); i++) {
+            fmtHistSummary(buf, sizeof (buf), histTbl[i].name, histTbl[i].hs);
+            if ((err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN)) != ESP_OK) {
+                return err;
+            }
+        }
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const httpd_uri_t statsURI = {
+    .uri       = "/stats",
+    .method    = HTTP_GET,
+    .handler   = getStats,
+    .user_ctx  = NULL,
+};
+#endif  // CONFIG_MAIN_TASK_TIME_WORK_LOOP
+
+#ifdef CONFIG_TASK_MONITOR
+// Send the stats of the task monitor, one line per task,
+// when the client requests the URL "http://<addr>:<port>/tasks"
+static esp_err_t getTasks(httpd_req_t *req)
+{
+    TaskMonInfo info;
+    char buf[128];
+    esp_err_t err;
+
+    httpd_resp_set_type(req, "text/plain");
+    snprintf(buf, sizeof (buf), "%-16s %4s %4s %7s %7s %7s %6s %6s %6s\n",
+             "name", "core", "prio", "cpu%", "avg%", "max%", "stack", "free", "rec");
+    if ((err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN)) != ESP_OK) {
+        return err;
+    }
+
+    for (unsigned n = 0; taskMonGetInfo(n, &info) == 0; n++) {
+        snprintf(buf, sizeof (buf), "%-16s %4d %4u %4u.%02u %4u.%02u %4u.%02u %6lu %6lu %6lu\n",
+                 info.name, info.core, info.prio,
+                 (info.cpuLast / 100), (info.cpuLast % 100), (info.cpuAvg / 100), (info.cpuAvg % 100),
+                 (info.cpuMax / 100), (info.cpuMax % 100), info.stackSize, info.minFree, info.recStackSize);
+        if ((err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN)) != ESP_OK) {
+            return err;
+        }
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const httpd_uri_t tasksURI = {
+    .uri       = "/tasks",
+    .method    = HTTP_GET,
+    .handler   = getTasks,
+    .user_ctx  = NULL,
+};
+#endif  // CONFIG_TASK_MONITOR
+
 int httpsInit(void)
 {
     httpd_handle_t server = NULL;
@@ -58,6 +399,27 @@ int httpsInit(void)
         return -1;
     }
 
+#ifdef CONFIG_WEB_SERVER_MLOG
+    if ((err = httpd_register_uri_handler(server, &mlogURI)) != ESP_OK) {
+        mlog(error, "Failed to register mlogURI: err=%04X", err);
+        return -1;
+    }
+#endif
+
+#ifdef CONFIG_MAIN_TASK_TIME_WORK_LOOP
+    if ((err = httpd_register_uri_handler(server, &statsURI)) != ESP_OK) {
+        mlog(error, "Failed to register statsURI: err=%04X", err);
+        return -1;
+    }
+#endif
+
+#ifdef CONFIG_TASK_MONITOR
+    if ((err = httpd_register_uri_handler(server, &tasksURI)) != ESP_OK) {
+        mlog(error, "Failed to register tasksURI: err=%04X", err);
+        return -1;
+    }
+#endif
+
     return 0;
 }
 #endif  // CONFIG_WEB_SERVER
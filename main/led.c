@@ -6,6 +6,8 @@
 #include "led.h"
 #include "mlog.h"
 
+#define MLOG_MODULE lmLed
+
 #ifdef CONFIG_RGB_LED
 
 typedef struct LedMsg {
@@ -163,7 +165,7 @@ int ledInit(void)
     led_strip_clear(ledStripHandle);
 
     // Spawn the ledTask that will manage the LED
-    xTaskCreatePinnedToCore(ledTask, "ledMgr", 3072, NULL, CONFIG_RGB_LED_TASK_PRIO, &ledTaskHandle, tskNO_AFFINITY);
+    xTaskCreatePinnedToCore(ledTask, "ledMgr", CONFIG_RGB_LED_TASK_STACK, NULL, CONFIG_RGB_LED_TASK_PRIO, &ledTaskHandle, tskNO_AFFINITY);
 
 #if 0
     {
@@ -5,6 +5,9 @@
 #include "sdkconfig.h"
 
 #include "app.h"
+#include "appevt.h"
+#include "apppm.h"
+#include "appwork.h"
 #include "ble.h"
 #include "esp32.h"
 #include "fgc.h"
@@ -15,11 +18,16 @@
 #include "timeval.h"
 #include "wifi.h"
 
+#define MLOG_MODULE lmApp
+
 // Check the consistency of some critical SkelApp
 // sdkconfig settings.
 #ifdef CONFIG_RGB_LED
 _Static_assert((CONFIG_RGB_LED_TASK_PRIO <= (configMAX_PRIORITIES - 1)), "RGB_LED_TASK_PRIO is inconsistent with configMAX_PRIORITIES !");
 #endif
+#ifdef CONFIG_MSG_LOG_ASYNC
+_Static_assert((CONFIG_MSG_LOG_TASK_PRIO <= (configMAX_PRIORITIES - 1)), "MSG_LOG_TASK_PRIO is inconsistent with configMAX_PRIORITIES !");
+#endif
 #ifdef CONFIG_BLE_PERIPHERAL
 _Static_assert((CONFIG_BLE_HOST_TASK_PRIO <= (configMAX_PRIORITIES - 1)), "BLE_HOST_TASK_PRIO is inconsistent with configMAX_PRIORITIES !");
 #endif
@@ -136,10 +144,15 @@ static int fatFsInit(void)
     }
 
 #ifdef CONFIG_MSG_LOG_DUMP
-    // Dump the contents of the MLOG.TXT file
+    // Dump the contents of the MLOG.NNN files
     dumpMlogFile(false);
 #endif
 
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+    // Save the log lines recovered after a crash
+    saveCrashLog();
+#endif
+
     // Now that the FAT FS is mounted, see if we need to
     // re-set the log destination...
     if ((CONFIG_MSG_LOG_DEST == both) || (CONFIG_MSG_LOG_DEST == file)) {
@@ -225,12 +238,31 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(err);
 
+#ifdef CONFIG_APP_POWER_SAVE
+    // Enable the power management before the WiFi
+    // and BLE stacks get started.
+    if (appPmInit() != 0) {
+        mlog(error, "Failed to enable power management!");
+    }
+#endif
+
     // Initialize the TCP/IP network stack
     ESP_ERROR_CHECK(esp_netif_init());
 
     // Create the default event loop handler
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
+#ifdef CONFIG_APP_MAIN_TASK
+    // Create the appMain task's event queue, so it
+    // can get the events posted during start up.
+    if (appEvtInit(&appData) != 0) {
+        mlog(fatal, "appEvtInit!");
+    }
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    appEvtSetHandler(aetMlogDump, dumpMlogWindowEvt);
+#endif
+#endif
+
     // Init NVRAM API
     if (nvramOpen() != 0) {
         mlog(fatal, "nvramOpen!");
@@ -298,6 +330,13 @@ void app_main(void)
     }
 #endif
 
+#ifdef CONFIG_APP_WORK_POOL
+    // Spawn the workers
+    if (appWorkInit() != 0) {
+        mlog(fatal, "Failed to init the worker pool!");
+    }
+#endif
+
 #ifdef CONFIG_APP_MAIN_TASK
     // Spawn the appMain task that will do all the work
     if (xTaskCreatePinnedToCore(appMainTask, "appMain", CONFIG_MAIN_TASK_STACK, &appData, CONFIG_MAIN_TASK_PRIO, NULL, CONFIG_MAIN_TASK_CPU) != pdPASS) {
@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+
+#include "esp32.h"
+#include "mempool.h"
+#include "mlog.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_MEM_POOL
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+#define CACHE_LEN   CONFIG_MEM_POOL_CORE_CACHE_LEN
+#endif
+
+typedef struct FreeBlk {
+    struct FreeBlk *next;
+} FreeBlk;
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+// Free blocks cached by a core. It's used by the tasks
+// running on the core, so its lock is hardly contended:
+// the other cores only take blocks from it when the
+// pool has run out of free blocks.
+typedef struct CoreCache {
+    portMUX_TYPE lock;
+    unsigned count;
+    FreeBlk *blk[CACHE_LEN];
+} CoreCache;
+#endif
+
+typedef struct Pool {
+    uint8_t *arena;
+    uint8_t *arenaEnd;
+    uint32_t blockSize;
+    uint32_t numBlocks;
+    portMUX_TYPE lock;
+    FreeBlk *freeList;
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+    uint32_t cacheLen;  // max number of blocks cached by each core
+    CoreCache cache[portNUM_PROCESSORS];
+#endif
+    uint32_t inUse;
+    uint32_t peak;
+    uint32_t failures;
+} Pool;
+
+#define SMALL_BLOCKS    CONFIG_MEM_POOL_SMALL_BLOCKS
+#define MEDIUM_BLOCKS   CONFIG_MEM_POOL_MEDIUM_BLOCKS
+#define LARGE_BLOCKS    CONFIG_MEM_POOL_LARGE_BLOCKS
+
+static uint8_t smallArena[SMALL_BLOCKS * MEM_POOL_SMALL_SIZE] __attribute__((aligned(8)));
+static uint8_t mediumArena[MEDIUM_BLOCKS * MEM_POOL_MEDIUM_SIZE] __attribute__((aligned(8)));
+static uint8_t largeArena[LARGE_BLOCKS * MEM_POOL_LARGE_SIZE] __attribute__((aligned(8)));
+
+static Pool poolTbl[mpcMax] = {
+    [mpcSmall] = { smallArena, &smallArena[sizeof (smallArena)], MEM_POOL_SMALL_SIZE, SMALL_BLOCKS, portMUX_INITIALIZER_UNLOCKED },
+    [mpcMedium] = { mediumArena, &mediumArena[sizeof (mediumArena)], MEM_POOL_MEDIUM_SIZE, MEDIUM_BLOCKS, portMUX_INITIALIZER_UNLOCKED },
+    [mpcLarge] = { largeArena, &largeArena[sizeof (largeArena)], MEM_POOL_LARGE_SIZE, LARGE_BLOCKS, portMUX_INITIALIZER_UNLOCKED },
+};
+
+static bool poolInited;
+static portMUX_TYPE initLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Build the free lists of the pools on first use, so
+// the pools can be used before app_main() runs.
+static void initPools(void)
+{
+    portENTER_CRITICAL(&initLock);
+    if (!poolInited) {
+        for (int i = 0; i < mpcMax; i++) {
+            Pool *p = &poolTbl[i];
+            for (uint32_t n = p->numBlocks; n != 0; n--) {
+                FreeBlk *blk = (FreeBlk *) &p->arena[(n - 1) * p->blockSize];
+                blk->next = p->freeList;
+                p->freeList = blk;
+            }
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+            // A core can't cache more than its share
+            // of the blocks.
+            p->cacheLen = p->numBlocks / portNUM_PROCESSORS;
+            if (p->cacheLen > CACHE_LEN) {
+                p->cacheLen = CACHE_LEN;
+            }
+            for (int core = 0; core < portNUM_PROCESSORS; core++) {
+                portMUX_INITIALIZE(&p->cache[core].lock);
+            }
+#endif
+        }
+        poolInited = true;
+    }
+    portEXIT_CRITICAL(&initLock);
+}
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+// Take a block from the cache of a core
+static FreeBlk *cacheGet(CoreCache *cc)
+{
+    FreeBlk *blk = NULL;
+
+    portENTER_CRITICAL(&cc->lock);
+    if (cc->count != 0) {
+        blk = cc->blk[--cc->count];
+    }
+    portEXIT_CRITICAL(&cc->lock);
+
+    return blk;
+}
+#endif
+
+static void *poolGet(Pool *p)
+{
+    FreeBlk *blk = NULL;
+    uint32_t inUse, peak;
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+    int coreId = esp_cpu_get_core_id();
+    blk = cacheGet(&p->cache[coreId]);
+#endif
+
+    if (blk == NULL) {
+        portENTER_CRITICAL(&p->lock);
+        if ((blk = p->freeList) != NULL) {
+            p->freeList = blk->next;
+        }
+        portEXIT_CRITICAL(&p->lock);
+    }
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+    // The last free blocks may be cached by
+    // the other cores.
+    for (int core = 0; (blk == NULL) && (core < portNUM_PROCESSORS); core++) {
+        if (core != coreId) {
+            blk = cacheGet(&p->cache[core]);
+        }
+    }
+#endif
+
+    if (blk == NULL) {
+        return NULL;
+    }
+
+    inUse = __atomic_add_fetch(&p->inUse, 1, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    while ((inUse > peak) &&
+           !__atomic_compare_exchange_n(&p->peak, &peak, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    return blk;
+}
+
+static void poolPut(Pool *p, void *ptr)
+{
+    FreeBlk *blk = ptr;
+
+    __atomic_sub_fetch(&p->inUse, 1, __ATOMIC_RELAXED);
+
+#ifdef CONFIG_MEM_POOL_CORE_CACHE
+    CoreCache *cc = &p->cache[esp_cpu_get_core_id()];
+    bool cached = false;
+    portENTER_CRITICAL(&cc->lock);
+    if (cc->count < p->cacheLen) {
+        cc->blk[cc->count++] = blk;
+        cached = true;
+    }
+    portEXIT_CRITICAL(&cc->lock);
+    if (cached) {
+        return;
+    }
+#endif
+
+    portENTER_CRITICAL(&p->lock);
+    blk->next = p->freeList;
+    p->freeList = blk;
+    portEXIT_CRITICAL(&p->lock);
+}
+
+// Allocate a block of at least 'size' bytes, from the
+// smallest pool that fits and is not exhausted. Returns
+// NULL, with errno set to ENOMEM, if there is none.
+void *memPoolAlloc(size_t size)
+{
+    bool failed = false;
+
+    if (!poolInited) {
+        initPools();
+    }
+
+    for (int i = 0; i < mpcMax; i++) {
+        Pool *p = &poolTbl[i];
+        if (size <= p->blockSize) {
+            void *ptr = poolGet(p);
+            if (ptr != NULL) {
+                return ptr;
+            }
+            if (!failed) {
+                // Only count the failure against the
+                // pool that was the best fit.
+                __atomic_add_fetch(&p->failures, 1, __ATOMIC_RELAXED);
+                failed = true;
+            }
+        }
+    }
+
+    errno = ENOMEM;
+    return NULL;
+}
+
+void memPoolFree(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < mpcMax; i++) {
+        Pool *p = &poolTbl[i];
+        if (((uint8_t *) ptr >= p->arena) && ((uint8_t *) ptr < p->arenaEnd)) {
+            poolPut(p, ptr);
+            return;
+        }
+    }
+
+    mlog(error, "%p not allocated by memPoolAlloc()!", ptr);
+}
+
+int memPoolGetStats(MemPoolClass pool, MemPoolStats *stats)
+{
+    const Pool *p;
+
+    if (pool >= mpcMax) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    p = &poolTbl[pool];
+    stats->blockSize = p->blockSize;
+    stats->numBlocks = p->numBlocks;
+    stats->inUse = p->inUse;
+    stats->peak = p->peak;
+    stats->failures = p->failures;
+
+    return 0;
+}
+
+// Log the stats of each pool, as: size=inUse/peak/
+// numBlocks/failures
+void memPoolLogStats(void)
+{
+    MemPoolStats ss, ms, ls;
+
+    memPoolGetStats(mpcSmall, &ss);
+    memPoolGetStats(mpcMedium, &ms);
+    memPoolGetStats(mpcLarge, &ls);
+    mlog(trace, "Mem Pool Stats: %lu=%lu/%lu/%lu/%lu %lu=%lu/%lu/%lu/%lu %lu=%lu/%lu/%lu/%lu",
+         ss.blockSize, ss.inUse, ss.peak, ss.numBlocks, ss.failures,
+         ms.blockSize, ms.inUse, ms.peak, ms.numBlocks, ms.failures,
+         ls.blockSize, ls.inUse, ls.peak, ls.numBlocks, ls.failures);
+}
+
+#else
+
+// Without the pools, the blocks come from the heap
+
+void *memPoolAlloc(size_t size)
+{
+    return malloc(size);
+}
+
+void memPoolFree(void *ptr)
+{
+    free(ptr);
+}
+
+#endif  // CONFIG_MEM_POOL
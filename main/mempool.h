@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size block pool allocator. The memory is split,
+// at build time, into pools of blocks of a few size
+// classes. An allocation gets a block of the smallest
+// class that fits, or of the next larger one if that class
+// is exhausted, and both memPoolAlloc() and memPoolFree()
+// run in constant time, without ever fragmenting the
+// general heap. Optionally, each CPU core keeps a small
+// cache of free blocks of each class, so the cores don't
+// contend for the same pool lock.
+
+// Size classes
+typedef enum MemPoolClass {
+    mpcSmall = 0,
+    mpcMedium,
+    mpcLarge,
+    mpcMax
+} MemPoolClass;
+
+#define MEM_POOL_SMALL_SIZE     64
+#define MEM_POOL_MEDIUM_SIZE    256
+#define MEM_POOL_LARGE_SIZE     1024
+
+// Stats of each pool
+typedef struct MemPoolStats {
+    uint32_t blockSize;     // [in bytes]
+    uint32_t numBlocks;
+    uint32_t inUse;         // number of blocks in use
+    uint32_t peak;          // max number of blocks in use
+    uint32_t failures;      // number of allocations that found the pool exhausted
+} MemPoolStats;
+
+__BEGIN_DECLS
+
+extern void *memPoolAlloc(size_t size);
+extern void memPoolFree(void *ptr);
+extern int memPoolGetStats(MemPoolClass pool, MemPoolStats *stats);
+extern void memPoolLogStats(void);
+
+__END_DECLS
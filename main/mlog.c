@@ -1,17 +1,30 @@
 #include <assert.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "app.h"
 #include "esp32.h"
+#include "esp_memory_utils.h"
 #include "fgc.h"
 #include "led.h"
 #include "mlog.h"
+#include "mlogcrash.h"
+#include "mlogfile.h"
+#include "mlogkv.h"
+#include "mlogrec.h"
+#include "mlogudp.h"
+#include "mlogz.h"
 #include "timeval.h"
 
+#define MLOG_MODULE lmMlog
+
 #ifdef CONFIG_MSG_LOG
 
 static const char *logLevelName[] = {
@@ -25,244 +38,2315 @@ static const char *logLevelName[] = {
     [fatal] = RED_FGC "FATAL" RESET_FGC,
 };
 
+static const char *plainLevelName[] = {
+    [none] = "NONE",
+    [info] = "INFO",
+    [trace] = "TRACE",
+    [debug] = "DEBUG",
+    [warning] = "WARNING",
+    [error] = "ERROR",
+    [errNo] = "ERROR",
+    [fatal] = "FATAL",
+};
+
 static const char *logDestName[] = {
     [console] = "CONSOLE",
     [file] = "FILE",
     [both] = "BOTH",
 };
 
+static const char *logModName[] = {
+    [lmApp] = "APP",
+    [lmBle] = "BLE",
+    [lmHttps] = "HTTPS",
+    [lmLed] = "LED",
+    [lmMlog] = "MLOG",
+    [lmNvram] = "NVRAM",
+    [lmOta] = "OTA",
+    [lmWifi] = "WIFI",
+};
+
 static AppData *appData;
 static LogDest msgLogDest = console;
 static LogLevel msgLogLevel = trace;
+
+// Registered log sinks
+static LogSink *sinkTbl[MSG_LOG_MAX_SINKS];
+static unsigned numSinks;
+
+static void msgLogDrain(void);
+
+// Runtime log level of each module, checked by
+// the mlog() macro.
+uint8_t msgLogModLevel[lmMax] = { [0 ... (lmMax - 1)] = CONFIG_MSG_LOG_LEVEL };
 static SemaphoreHandle_t mutexHandle;
 static StaticSemaphore_t mutexSem;
 
+#ifdef CONFIG_MSG_LOG_BINARY
+// Log message entry. The caller of msgLog() only stores
+// the address of the format string and the raw values
+// of its arguments; the text is formatted when the
+// entry is written out to the console, or when the log
+// file is dumped.
+typedef struct MsgLogEntry {
+    uint8_t rec[MLOG_REC_MAX_LEN];
+} MsgLogEntry;
+#else
+// Log message entry. The message text is formatted by the
+// caller of msgLog(), while the line prefix (timestamp,
+// level, task name, etc.) is rendered when the entry is
+// written out to the log destination.
+typedef struct MsgLogEntry {
+    struct timeval timeStamp;
+    const char *funcName;
+    int lineNum;
+    int errorNum;
+    LogLevel logLevel;
+    uint8_t coreId;
+    char taskName[configMAX_TASK_NAME_LEN];
+    char text[CONFIG_MSG_LOG_MAX_LEN];
+} MsgLogEntry;
+#endif
+
+// Timestamp cache. The whole-seconds part of the timestamp
+// ("DD HH:MM:SS" or "YYYY-MM-DD HH:MM:SS") is only rendered
+// again when it changes, and when just the seconds changed
+// only their two digits are patched. Normally only the
+// sub-second digits have to be rendered. The cache is keyed
+// on the seconds value being displayed, i.e. after the
+// baseTime and UTC offset adjustments, so it stays correct
+// when any of them changes, or when the time is stepped by
+// SNTP or by the coSetUtcTime command.
 typedef struct TsBuf {
-    char buf[32]; // big enough for: "YYYY-MM-DD HH:MM:SS.xxxxxx"
+    char buf[32];       // big enough for: "YYYY-MM-DD HH:MM:SS.xxxxxx"
+    time_t secs;        // seconds value rendered in the buffer
+    uint8_t secsLen;    // length of the whole-seconds part
+    bool valid;
 } TsBuf;
 
-#if CONFIG_MSG_LOG_TS_UPTIME_USEC
-static const char *fmtTimestamp(TsBuf *tsBuf)
+// Check whether the cached timestamp can be used for
+// the given seconds value. Patches the seconds digits
+// if that's the only change.
+static bool tsCacheHit(TsBuf *tsBuf, time_t secs)
 {
-    struct timeval now, deltaT;
-    unsigned dd, hh, mm, ss, us;
-    size_t bufLen = sizeof (TsBuf);
+    if (!tsBuf->valid || (secs < 0) || ((secs / 60) != (tsBuf->secs / 60))) {
+        return false;
+    }
 
-    gettimeofday(&now, NULL);
-    tvSub(&deltaT, &now, &appData->baseTime);
-    ss = deltaT.tv_sec;
+    if (secs != tsBuf->secs) {
+        unsigned ss = secs % 60;
+        tsBuf->buf[tsBuf->secsLen - 2] = '0' + (ss / 10);
+        tsBuf->buf[tsBuf->secsLen - 1] = '0' + (ss % 10);
+        tsBuf->secs = secs;
+    }
+
+    return true;
+}
+
+// Render the sub-second digits right after the
+// whole-seconds part.
+static const char *tsPutFrac(TsBuf *tsBuf, unsigned frac, int numDigits)
+{
+    char *p = &tsBuf->buf[tsBuf->secsLen];
+
+    *p++ = '.';
+    p[numDigits] = '\0';
+    while (numDigits-- > 0) {
+        p[numDigits] = '0' + (frac % 10);
+        frac /= 10;
+    }
+
+    return tsBuf->buf;
+}
+
+#if CONFIG_MSG_LOG_TS_UPTIME_USEC || CONFIG_MSG_LOG_TS_UPTIME_MSEC
+// Render the "DD HH:MM:SS" part of the timestamp
+static void tsPutUptime(TsBuf *tsBuf, time_t secs)
+{
+    unsigned dd, hh, mm, ss;
+
+    ss = secs;
     dd = ss / 86400;
     ss -= dd * 86400;
     hh = ss / 3600;
     ss -= hh * 3600;
     mm = ss / 60;
     ss -= mm * 60;
-    us = deltaT.tv_usec;
-    snprintf(tsBuf->buf, bufLen, "%02u %02u:%02u:%02u.%06u", dd, hh, mm, ss, us);
+    tsBuf->secsLen = snprintf(tsBuf->buf, sizeof (tsBuf->buf), "%02u %02u:%02u:%02u", dd, hh, mm, ss);
+    tsBuf->secs = secs;
+    tsBuf->valid = true;
+}
+#endif
 
-    return tsBuf->buf;
+#if CONFIG_MSG_LOG_TS_UPTIME_USEC
+static void getTimestamp(struct timeval *ts)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    tvSub(ts, &now, &appData->baseTime);
+}
+
+static const char *fmtTimestamp(TsBuf *tsBuf, const struct timeval *ts)
+{
+    if (!tsCacheHit(tsBuf, ts->tv_sec)) {
+        tsPutUptime(tsBuf, ts->tv_sec);
+    }
+
+    return tsPutFrac(tsBuf, ts->tv_usec, 6);
 }
 #elif CONFIG_MSG_LOG_TS_UPTIME_MSEC
-static const char *fmtTimestamp(TsBuf *tsBuf)
+static void getTimestamp(struct timeval *ts)
 {
     TickType_t now = xTaskGetTickCount();
-    unsigned ticks = now - appData->baseTicks;
-    unsigned dd, hh, mm, ss, ms;
-    size_t bufLen = sizeof (TsBuf);
+    unsigned ms = pdTICKS_TO_MS(now - appData->baseTicks);
 
-    ss = pdTICKS_TO_MS(ticks) / 1000;
-    dd = ss / 86400;
-    ss -= dd * 86400;
-    hh = ss / 3600;
-    ss -= hh * 3600;
-    mm = ss / 60;
-    ss -= mm * 60;
-    ms = pdTICKS_TO_MS(ticks) % 1000;
-    snprintf(tsBuf->buf, bufLen, "%02u %02u:%02u:%02u.%03u", dd, hh, mm, ss, ms);
+    ts->tv_sec = ms / 1000;
+    ts->tv_usec = (ms % 1000) * 1000;
+}
 
-    return tsBuf->buf;
+static const char *fmtTimestamp(TsBuf *tsBuf, const struct timeval *ts)
+{
+    if (!tsCacheHit(tsBuf, ts->tv_sec)) {
+        tsPutUptime(tsBuf, ts->tv_sec);
+    }
+
+    return tsPutFrac(tsBuf, (ts->tv_usec / 1000), 3);
 }
 #else
-static const char *fmtTimestamp(TsBuf *tsBuf)
+static void getTimestamp(struct timeval *ts)
+{
+    gettimeofday(ts, NULL);
+}
+
+static const char *fmtTimestamp(TsBuf *tsBuf, const struct timeval *ts)
 {
     const time_t secs2025Jan01 = 1735689600; // seconds since the Epoch by 2025-Jan-01 00:00:00
-    struct timeval now;
-    struct tm brkDwnTime;
-    size_t bufLen = sizeof (TsBuf);
-    int n;
+    time_t secs = ts->tv_sec;
 
-    gettimeofday(&now, NULL);
-    if (now.tv_sec >= secs2025Jan01) {
-        now.tv_sec += appData->persData.utcOffset * 3600;   // adjust time based on UTC offset
+    if (secs >= secs2025Jan01) {
+        secs += appData->persData.utcOffset * 3600;   // adjust time based on UTC offset
+    }
+
+    if (!tsCacheHit(tsBuf, secs)) {
+        struct tm brkDwnTime;
+        tsBuf->secsLen = strftime(tsBuf->buf, sizeof (tsBuf->buf), "%Y-%m-%d %H:%M:%S", gmtime_r(&secs, &brkDwnTime));    // %H means 24-hour time
+        tsBuf->secs = secs;
+        tsBuf->valid = true;
     }
-    n = strftime(tsBuf->buf, bufLen, "%Y-%m-%d %H:%M:%S", gmtime_r(&now.tv_sec, &brkDwnTime));    // %H means 24-hour time
+
 #if CONFIG_MSG_LOG_TS_TOD_USEC
-    snprintf((tsBuf->buf + n), (bufLen - n), ".%06u", (unsigned) now.tv_usec);
+    return tsPutFrac(tsBuf, ts->tv_usec, 6);
 #else
-   unsigned int ms = now.tv_usec / 1000;
-   if (ms >= 1000) {
-       now.tv_sec += 1;
-       ms -= 1000;
+    return tsPutFrac(tsBuf, (ts->tv_usec / 1000), 3);
+#endif
+}
+#endif
+
+// Buffers used to render the complete log line, plus
+// the terminating newline character, one for each of
+// the text formats.
+static char msgLogBuf[lfBinary][CONFIG_MSG_LOG_MAX_LEN + 1];
+
+// Timestamp cache used when writing out the log lines
+static TsBuf msgLogTsBuf;
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Buffer used to format the message text of a
+// binary log record.
+static char msgTextBuf[CONFIG_MSG_LOG_MAX_LEN];
+#endif
+
+// Log entry used by the synchronous path
+static MsgLogEntry msgLogEntry;
+
+// Caller-side stats counters, one set for each CPU core,
+// so the tasks running on different cores never update
+// the same counters. They are summed up when read.
+typedef struct CallStats {
+    uint32_t msgCount;
+    uint32_t dropCount;
+    uint32_t maxCallCycles;
+    uint64_t sumCallCycles;
+} CallStats;
+
+static CallStats callStats[portNUM_PROCESSORS];
+
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+#define RL_INTERVAL (1000 / CONFIG_MSG_LOG_RATE_LIMIT_RATE)         // emission interval [in msec]
+#define RL_WINDOW   (CONFIG_MSG_LOG_RATE_LIMIT_BURST * RL_INTERVAL) // [in msec]
+
+static atomic_uint rateLimitCount;
+#endif
+
+#ifdef CONFIG_MSG_LOG_COALESCE
+// A copy of the last message written out is kept, and
+// compared to the new ones over the whole message except
+// its timestamp and CPU core.
+static bool lastValid;
+static MsgLogEntry lastEntry;
+static LogLevel lastLevel;
+static const char *lastFuncName;
+static int lastLineNum;
+static unsigned repeatCount;    // repeats of the last message not reported yet
+static uint32_t repeatTotal;    // number of repeated messages coalesced
+static MsgLogEntry repeatEntry;
+
+static void writeRepeats(void);
+#endif
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+#define FOLLOW_BUF_SIZE CONFIG_MSG_LOG_FOLLOW_BUF_SIZE
+
+_Static_assert(((FOLLOW_BUF_SIZE & (FOLLOW_BUF_SIZE - 1)) == 0), "MSG_LOG_FOLLOW_BUF_SIZE must be a power of 2 !");
+
+// Ring buffer that holds the last log lines, used
+// to pass the new lines to the log follower. The
+// positions are free running byte counters.
+static char followBuf[FOLLOW_BUF_SIZE];
+static uint32_t followHead; // next byte to be written
+static uint32_t followPos;  // next byte to be read by the follower
+static TaskHandle_t followTask;
+
+// Pass the log line to the follower. This sink is
+// only enabled while there is a follower.
+static void followWrite(LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
+{
+    const char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        followBuf[(followHead + i) % FOLLOW_BUF_SIZE] = p[i];
     }
-    snprintf((tsBuf->buf + n), (bufLen - n), ".%03u", ms);
+    followHead += len;
+    xTaskNotifyGive(followTask);
+}
+
+static LogSink followSink = {
+    .name = "follow",
+    .format = lfPlainText,
+    .level = debug,
+    .write = followWrite,
+};
 #endif
 
-    return tsBuf->buf;
+// The console gets the colored text
+static void consoleWrite(LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
+{
+    fwrite(data, 1, len, stdout);
+}
+
+static LogSink consoleSink = {
+    .name = "console",
+    .format = lfColorText,
+    .level = debug,
+    .write = consoleWrite,
+};
+
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+static void crashWrite(LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
+{
+    mlogCrashWrite(data, len);
 }
+
+static LogSink crashSink = {
+    .name = "crash",
+    .format = lfPlainText,
+    .level = debug,
+    .enabled = true,
+    .write = crashWrite,
+};
 #endif
 
-static char msgLogBuf[CONFIG_MSG_LOG_MAX_LEN];
+#ifdef CONFIG_MSG_LOG_SYSLOG
+// The syslog collector gets the plain text, which is
+// queued in the syslog backlog.
+static void syslogWrite(LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
+{
+    mlogUdpWrite(data, len, timeStamp, logLevel);
+}
 
-void msgLog(LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, ...)
+static int syslogFlush(LogSink *sink)
 {
-    if (msgLogLevel == none) {
-        // Nothing to do!
-        return;
-    }
+    return mlogUdpFlush();
+}
 
-    // Everything at or above "warning" is
-    // always printed...
-    if ((logLevel <= msgLogLevel) || (logLevel >= warning)) {
-        TsBuf tsBuf;
-        char *p = msgLogBuf;
-        int len = sizeof (msgLogBuf);
-        int n = 0;
-        va_list ap;
+static LogSink syslogSink = {
+    .name = "syslog",
+    .format = lfPlainText,
+    .level = debug,
+    .enabled = true,
+    .write = syslogWrite,
+    .flush = syslogFlush,
+};
+#endif
 
-        xSemaphoreTake(mutexHandle, portMAX_DELAY);
+#ifdef CONFIG_FAT_FS
+static LogSink fileSink;
+static int fileSync(void);
+#endif
 
-        n += snprintf((p + n), (len - n), "%s %s ", fmtTimestamp(&tsBuf), logLevelName[logLevel]);
+// Set the log destination, by enabling or disabling
+// the console and file sinks.
+static void setDest(LogDest logDest)
+{
+    msgLogDest = logDest;
+    consoleSink.enabled = ((logDest == both) || (logDest == console));
+#ifdef CONFIG_FAT_FS
+    fileSink.enabled = ((logDest == both) || (logDest == file));
+#endif
+}
 
-        if (logLevel >= trace) {
-            n += snprintf((p + n), (len - n), "%s@%u:%s:%d ", pcTaskGetName(NULL), esp_cpu_get_core_id(), funcName, lineNum);
-        }
-        va_start(ap, fmt);
-        n += vsnprintf((p + n), (len - n), fmt, ap);
-        va_end(ap);
-        if (((logLevel == errNo) || (logLevel == fatal)) && (errorNum != 0)) {
-            n += snprintf((p + n), (len - n), " errno=%d (%s)", errorNum, strerror(errorNum));
-        }
+// Flush the buffers of the enabled sinks. Must be
+// called with the mutex held. The periodic flush lets
+// the file sink keep a partly filled compressed block
+// in RAM (see mlogFileSync()).
+static int flushSinks(bool periodic)
+{
+    int err = 0;
 
-        if ((msgLogDest == both) || (msgLogDest == console)) {
-            fprintf(stdout, "%s\n", msgLogBuf);
+    for (unsigned i = 0; i < numSinks; i++) {
+        LogSink *sink = sinkTbl[i];
+        if (!sink->enabled || (sink->flush == NULL)) {
+            continue;
         }
 #ifdef CONFIG_FAT_FS
-        if ((msgLogDest == both) || (msgLogDest == file)) {
-            FILE *fp;
-            if ((fp = fopen(mlogFilePath, "a")) == NULL) {
-                fprintf(stderr, "SPONG! Failed to open log file! %s", strerror(errno));
-                assert(0);
+        if (periodic && (sink == &fileSink)) {
+            if (fileSync() != 0) {
+                err = -1;
             }
-            if (fprintf(fp, "%s\n", msgLogBuf) < 0) {
-                if (errno == ENOSPC) {
-                    // Running out of space on the FATFS is not fatal,
-                    // but we need to switch the log message destination
-                    // to the console, so as to avoid hitting our head
-                    // against the wall over and over...
-                    msgLogDest = console;
-                } else {
-                    fprintf(stderr, "SPONG! Failed to write to log file! %s", strerror(errno));
-                    assert(0);
-                }
-            }
-            fclose(fp);
+            continue;
         }
 #endif
-
-        if (logLevel == fatal) {
-            ledSet(on, red);
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            assert(false);
+        if (sink->flush(sink) != 0) {
+            err = -1;
         }
+    }
 
-        xSemaphoreGive(mutexHandle);
+    return err;
+}
+
+#ifdef CONFIG_FAT_FS
+// Handle a failed write to the log file. Must be called
+// with the mutex held.
+static void fileError(void)
+{
+    if (errno == ENOSPC) {
+        // Running out of space on the FATFS is not fatal,
+        // but we need to switch the log message destination
+        // to the console, so as to avoid hitting our head
+        // against the wall over and over...
+        mlogFileClose();
+        setDest(console);
+    } else {
+        fprintf(stderr, "SPONG! Failed to write to log file! %s", strerror(errno));
+        assert(0);
     }
 }
 
-int msgLogInit(AppData *appDataArg, LogLevel defLogLevel, LogDest defLogDest)
+// The log file gets the plain text, or the raw binary
+// records, which are buffered in RAM by mlogFile.
+static void fileWrite(LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
 {
-    appData = appDataArg;
-    msgLogLevel = defLogLevel;
-    msgLogDest = defLogDest;
+#ifdef CONFIG_MSG_LOG_BINARY
+    if (mlogFileWriteRec(data, appData->persData.utcOffset) != 0) {
+        fileError();
+    }
+#else
+    if (mlogFileWrite(data, len, timeStamp) != 0) {
+        fileError();
+    }
+#endif
+}
 
-    // Semaphore used to serialize the calls to mlog()
-    if ((mutexHandle = xSemaphoreCreateMutexStatic(&mutexSem)) == NULL) {
-        // Hu?
+static int fileFlush(LogSink *sink)
+{
+    if (mlogFileFlush() != 0) {
+        fileError();
         return -1;
     }
+    return 0;
+}
 
-    mlog(info, "Message logging enabled: level=%s", logLevelName[defLogLevel]);
-
+static int fileSync(void)
+{
+    if (mlogFileSync() != 0) {
+        fileError();
+        return -1;
+    }
     return 0;
 }
 
-LogDest msgLogSetDest(LogDest logDest)
+static LogSink fileSink = {
+    .name = "file",
+#ifdef CONFIG_MSG_LOG_BINARY
+    .format = lfBinary,
+#else
+    .format = lfPlainText,
+#endif
+    .level = debug,
+    .write = fileWrite,
+    .flush = fileFlush,
+};
+
+#ifndef CONFIG_MSG_LOG_ASYNC
+// Timer used to periodically flush the log file buffer
+static esp_timer_handle_t flushTimerHandle;
+
+// This function runs in the context of the ESP Timer
+// task.
+static void flushTimerCb(void *arg)
 {
-    LogDest prevLogDest = msgLogDest;
-    if ((msgLogDest = logDest) != prevLogDest) {
-#ifdef CONFIG_FAT_FS
-        if (prevLogDest == console) {
-            // Create the log file on the FATFS
-            FILE *fp;
-            if ((fp = fopen(mlogFilePath, "w+")) != NULL) {
-                // MLOG.TXT file created/truncated. Now close
-                // it, as we'll open/write/close to it within
-                // msgLog() ...
-                fclose(fp);
-            } else {
-                // Oops!
-                msgLogDest = prevLogDest;
-                mlog(errNo, "Failed to open log file: %s", mlogFilePath);
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    msgLogDrain();
+#ifdef CONFIG_MSG_LOG_COALESCE
+    writeRepeats();
+#endif
+    flushSinks(true);
+    xSemaphoreGive(mutexHandle);
+}
+#endif
+#endif  // CONFIG_FAT_FS
+
+// Fill in a log entry. This is done in the context of
+// the task that called msgLog().
+#ifdef CONFIG_MSG_LOG_BINARY
+static void fillEntry(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, va_list ap)
+{
+    struct timeval ts;
+    getTimestamp(&ts);
+    mlogRecEncode(entry->rec, (((uint64_t) ts.tv_sec * 1000000) + ts.tv_usec), logLevel, funcName, lineNum, errorNum, fmt, ap);
+}
+
+static void fillEntryKV(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    struct timeval ts;
+    getTimestamp(&ts);
+    mlogRecEncodeKV(entry->rec, (((uint64_t) ts.tv_sec * 1000000) + ts.tv_usec), logLevel, funcName, lineNum, errorNum, event, kv, numKV);
+}
+#else
+static void fillEntryHdr(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum)
+{
+    getTimestamp(&entry->timeStamp);
+    entry->funcName = funcName;
+    entry->lineNum = lineNum;
+    entry->errorNum = errorNum;
+    entry->logLevel = logLevel;
+    entry->coreId = esp_cpu_get_core_id();
+    if (logLevel >= trace) {
+        strncpy(entry->taskName, pcTaskGetName(NULL), sizeof (entry->taskName) - 1);
+        entry->taskName[sizeof (entry->taskName) - 1] = '\0';
+    }
+}
+
+static void fillEntry(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, va_list ap)
+{
+    fillEntryHdr(entry, logLevel, funcName, lineNum, errorNum);
+    vsnprintf(entry->text, sizeof (entry->text), fmt, ap);
+}
+
+// The key/value fields are encoded as JSON text
+static void fillEntryKV(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    fillEntryHdr(entry, logLevel, funcName, lineNum, errorNum);
+    mlogKVToJson(entry->text, sizeof (entry->text), event, kv, numKV);
+}
+#endif
+
+#if defined(CONFIG_MSG_LOG_ASYNC) || defined(CONFIG_MSG_LOG_COALESCE) || defined(CONFIG_MSG_LOG_ISR)
+static void fillEntryFmt(MsgLogEntry *entry, LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fillEntry(entry, logLevel, funcName, lineNum, errorNum, fmt, ap);
+    va_end(ap);
+}
+#endif
+
+// Render the complete log line, including the
+// terminating newline character, into the specified
+// buffer of CONFIG_MSG_LOG_MAX_LEN + 1 bytes. Returns
+// the length of the line.
+static int fmtLine(char *p, LogFormat format, TsBuf *tsBuf, const struct timeval *timeStamp, LogLevel logLevel, const char *taskName, unsigned coreId,
+                   const char *funcName, int lineNum, const char *text, int errorNum)
+{
+    const char **levelName = (format == lfColorText) ? logLevelName : plainLevelName;
+    int len = CONFIG_MSG_LOG_MAX_LEN;
+    int n = 0;
+
+    n += snprintf((p + n), (len - n), "%s %s ", fmtTimestamp(tsBuf, timeStamp), levelName[logLevel]);
+
+    if ((logLevel >= trace) && (n < len)) {
+        n += snprintf((p + n), (len - n), "%s@%u:%s:%d ", taskName, coreId, funcName, lineNum);
+    }
+    if (n < len) {
+        n += snprintf((p + n), (len - n), "%s", text);
+    }
+    if (((logLevel == errNo) || (logLevel == fatal)) && (errorNum != 0) && (n < len)) {
+        n += snprintf((p + n), (len - n), " errno=%d (%s)", errorNum, strerror(errorNum));
+    }
+
+    // Append the newline character
+    if (n >= len) {
+        n = len - 1;
+    }
+    p[n++] = '\n';
+    p[n] = '\0';
+
+    return n;
+}
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Render the log line of a binary log record, whose
+// message text has already been formatted.
+static int fmtRecLine(char *p, LogFormat format, TsBuf *tsBuf, const uint8_t *rec, const char *taskName, const char *textBuf)
+{
+    const MlogRecHdr *hdr = (const MlogRecHdr *) rec;
+    const char *funcName = (const char *) (uintptr_t) hdr->funcId;
+    struct timeval ts;
+
+    if (!esp_ptr_in_drom(funcName)) {
+        // Torn or corrupted record read back from flash
+        funcName = "<?>";
+    }
+    ts.tv_sec = hdr->timeStamp / 1000000;
+    ts.tv_usec = hdr->timeStamp % 1000000;
+
+    return fmtLine(p, format, tsBuf, &ts, (hdr->logLevel & MLOG_REC_LEVEL_MASK), taskName, ((hdr->logLevel & MLOG_REC_CORE_BIT) ? 1 : 0),
+                   funcName, hdr->lineNum, textBuf, hdr->errorNum);
+}
+#endif
+
+// Tells whether a message at the given level is to be
+// sent to the sink. Warnings and errors always are.
+static inline bool sinkLevelOn(const LogSink *sink, LogLevel logLevel)
+{
+    return ((logLevel >= warning) || (logLevel <= sink->level));
+}
+
+// Send the log entry to the sinks. The entry is rendered
+// at most once in each format, no matter how many sinks
+// use it, and only if any of the sinks that get the entry
+// uses it. Must be called with the mutex held.
+static void outputEntry(const MsgLogEntry *entry)
+{
+    int lineLen[lfBinary] = { 0 };
+#ifdef CONFIG_MSG_LOG_BINARY
+    const MlogRecHdr *hdr = (const MlogRecHdr *) entry->rec;
+    LogLevel logLevel = hdr->logLevel & MLOG_REC_LEVEL_MASK;
+    uint64_t timeStamp = hdr->timeStamp;
+    bool textDone = false;
+#else
+    LogLevel logLevel = entry->logLevel;
+    uint64_t timeStamp = ((uint64_t) entry->timeStamp.tv_sec * 1000000) + entry->timeStamp.tv_usec;
+#endif
+
+    for (unsigned i = 0; i < numSinks; i++) {
+        LogSink *sink = sinkTbl[i];
+        LogFormat format = sink->format;
+
+        if (!sink->enabled || !sinkLevelOn(sink, logLevel)) {
+            continue;
+        }
+
+#ifdef CONFIG_MSG_LOG_BINARY
+        if (format == lfBinary) {
+            sink->write(sink, entry->rec, hdr->len, timeStamp, logLevel);
+            continue;
+        }
+        if (lineLen[format] == 0) {
+            if (!textDone) {
+                mlogRecFmtText(entry->rec, msgTextBuf, sizeof (msgTextBuf));
+                textDone = true;
             }
+            lineLen[format] = fmtRecLine(msgLogBuf[format], format, &msgLogTsBuf, entry->rec, mlogRecTaskName(hdr->taskId), msgTextBuf);
+        }
+#else
+        if (lineLen[format] == 0) {
+            lineLen[format] = fmtLine(msgLogBuf[format], format, &msgLogTsBuf, &entry->timeStamp, entry->logLevel, entry->taskName, entry->coreId,
+                                      entry->funcName, entry->lineNum, entry->text, entry->errorNum);
         }
 #endif
-        mlog(info, "New message logging destination is %s", logDestName[msgLogDest]);
+        sink->write(sink, msgLogBuf[format], lineLen[format], timeStamp, logLevel);
     }
-    return prevLogDest;
 }
 
-LogLevel msgLogSetLevel(LogLevel logLevel)
+#ifdef CONFIG_MSG_LOG_COALESCE
+#ifdef CONFIG_MSG_LOG_BINARY
+static void entrySite(const MsgLogEntry *entry, LogLevel *logLevel, const char **funcName, int *lineNum)
 {
-    LogLevel prevLogLevel = msgLogLevel;
-    if (logLevel != prevLogLevel) {
-        msgLogLevel = logLevel;
-        mlog(info, "New message logging level is %s", logLevelName[msgLogLevel]);
-    }
-    return prevLogLevel;
+    const MlogRecHdr *hdr = (const MlogRecHdr *) entry->rec;
+
+    *logLevel = hdr->logLevel & MLOG_REC_LEVEL_MASK;
+    *funcName = (const char *) (uintptr_t) hdr->funcId;
+    *lineNum = hdr->lineNum;
 }
 
-LogDest msgLogGetDest(void)
+static bool sameEntry(const MsgLogEntry *entry, const MsgLogEntry *last)
 {
-    return msgLogDest;
+    MlogRecHdr hdr = *(const MlogRecHdr *) entry->rec;
+    MlogRecHdr lastHdr = *(const MlogRecHdr *) last->rec;
+
+    // Skip the timestamp and the CPU core
+    hdr.logLevel &= MLOG_REC_LEVEL_MASK;
+    hdr.timeStamp = 0;
+    lastHdr.logLevel &= MLOG_REC_LEVEL_MASK;
+    lastHdr.timeStamp = 0;
+    return (memcmp(&hdr, &lastHdr, sizeof (hdr)) == 0) &&
+           (memcmp(&entry->rec[sizeof (hdr)], &last->rec[sizeof (hdr)], (hdr.len - sizeof (hdr))) == 0);
 }
 
-LogLevel msgLogGetLevel(void)
+static void saveEntry(const MsgLogEntry *entry)
 {
-    return msgLogLevel;
+    memcpy(lastEntry.rec, entry->rec, entry->rec[0]);
 }
 #else
-int msgLogInit(AppData *appData, LogLevel defLogLevel, LogDest defLogDest)
+static void entrySite(const MsgLogEntry *entry, LogLevel *logLevel, const char **funcName, int *lineNum)
 {
-    return 0;
+    *logLevel = entry->logLevel;
+    *funcName = entry->funcName;
+    *lineNum = entry->lineNum;
 }
 
-LogDest msgLogSetDest(LogDest logDest)
+static bool sameEntry(const MsgLogEntry *entry, const MsgLogEntry *last)
 {
-    return logDest;
+    return (entry->funcName == last->funcName) &&
+           (entry->lineNum == last->lineNum) &&
+           (entry->errorNum == last->errorNum) &&
+           (entry->logLevel == last->logLevel) &&
+           (strcmp(entry->text, last->text) == 0);
 }
 
-LogLevel msgLogSetLevel(LogLevel logLevel)
+static void saveEntry(const MsgLogEntry *entry)
 {
-    return none;
+    lastEntry.funcName = entry->funcName;
+    lastEntry.lineNum = entry->lineNum;
+    lastEntry.errorNum = entry->errorNum;
+    lastEntry.logLevel = entry->logLevel;
+    strcpy(lastEntry.text, entry->text);
 }
+#endif
 
-LogDest msgLogGetDest(void)
+// Report the number of times the last message
+// was repeated, if any. Must be called with the
+// mutex held.
+static void writeRepeats(void)
 {
-    return msgLogDest;
+    if (repeatCount != 0) {
+        fillEntryFmt(&repeatEntry, lastLevel, lastFuncName, lastLineNum, 0, "last message repeated %u times", repeatCount);
+        repeatCount = 0;
+        outputEntry(&repeatEntry);
+    }
 }
+#endif
 
-LogLevel msgLogGetLevel(void)
+// Send the log entry to the current log destination,
+// unless it's a repeat of the last one. Must be called
+// with the mutex held.
+static void writeEntry(const MsgLogEntry *entry)
+{
+#ifdef CONFIG_MSG_LOG_COALESCE
+    LogLevel logLevel;
+    const char *funcName;
+    int lineNum;
+
+    entrySite(entry, &logLevel, &funcName, &lineNum);
+    if (lastValid && (logLevel != fatal) && sameEntry(entry, &lastEntry)) {
+        // Just count it
+        repeatCount++;
+        repeatTotal++;
+        return;
+    }
+
+    writeRepeats();
+    lastValid = true;
+    saveEntry(entry);
+    lastLevel = logLevel;
+    lastFuncName = funcName;
+    lastLineNum = lineNum;
+#endif
+
+    outputEntry(entry);
+}
+
+// Update the caller-side latency stats of the current
+// CPU core. The interrupts are masked, so the task can
+// neither be preempted by another one on this core nor
+// migrate to the other core in the meantime.
+static void updCallStats(uint32_t startCycles)
+{
+    uint32_t callCycles = esp_cpu_get_cycle_count() - startCycles;
+    UBaseType_t intMask = portSET_INTERRUPT_MASK_FROM_ISR();
+    CallStats *cs = &callStats[esp_cpu_get_core_id()];
+
+    if (callCycles > cs->maxCallCycles) {
+        cs->maxCallCycles = callCycles;
+    }
+    cs->sumCallCycles += callCycles;
+    cs->msgCount++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(intMask);
+}
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+// Count a message dropped on the current CPU core
+static void updDropStats(void)
+{
+    UBaseType_t intMask = portSET_INTERRUPT_MASK_FROM_ISR();
+    callStats[esp_cpu_get_core_id()].dropCount++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(intMask);
+}
+
+// Get the number of messages dropped on all the cores
+static unsigned getDropCount(void)
+{
+    unsigned drops = 0;
+
+    for (unsigned coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+        drops += *(volatile uint32_t *) &callStats[coreId].dropCount;
+    }
+
+    return drops;
+}
+#endif
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+// Multi-producer / single-consumer lock-free ring buffer
+// based on D. Vyukov's bounded queue. Each slot carries a
+// sequence number that tells whether the slot is free for
+// the producer that reserved it, or holds an entry ready
+// for the consumer. The consumer is whoever holds the
+// mutex: normally the msgLog task, but it can also be a
+// task logging a fatal error.
+//
+// There is one ring for each CPU core, used by the tasks
+// running on it, so the producers on different cores never
+// contend for the same ring. Each entry is tagged with the
+// esp_timer time it was queued at, which the consumer uses
+// to merge the entries of the rings in the order they were
+// logged. On a single-core chip this is just a single ring.
+#define RING_SLOTS  CONFIG_MSG_LOG_ASYNC_SLOTS
+#define RING_MASK   (RING_SLOTS - 1)
+
+_Static_assert(((RING_SLOTS & RING_MASK) == 0), "MSG_LOG_ASYNC_SLOTS must be a power of 2 !");
+
+typedef struct MsgLogSlot {
+    atomic_uint seq;
+    int64_t time;       // esp_timer time [in usec]
+    MsgLogEntry entry;
+} MsgLogSlot;
+
+typedef struct MsgLogRing {
+    MsgLogSlot slot[RING_SLOTS];
+    atomic_uint head;       // next slot to be reserved by a producer
+    atomic_uint tail;       // next slot to be drained by the consumer
+    atomic_uint highWater;  // max number of slots in use
+} MsgLogRing;
+
+static MsgLogRing msgLogRing[portNUM_PROCESSORS];
+static TaskHandle_t msgLogTaskHandle;
+static unsigned lastDropCount;
+
+// Reserve a free slot in the ring of the current CPU
+// core. Returns NULL when the ring is full.
+static MsgLogSlot *ringReserve(unsigned *pos)
+{
+    MsgLogRing *ring = &msgLogRing[esp_cpu_get_core_id()];
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (true) {
+        MsgLogSlot *slot = &ring->slot[head & RING_MASK];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int) (seq - head);
+
+        if (diff == 0) {
+            // Slot is free: try to claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &head, (head + 1), memory_order_relaxed, memory_order_relaxed)) {
+                unsigned used = (head + 1) - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+                unsigned hwm = atomic_load_explicit(&ring->highWater, memory_order_relaxed);
+                while ((used > hwm) && !atomic_compare_exchange_weak_explicit(&ring->highWater, &hwm, used, memory_order_relaxed, memory_order_relaxed))
+                    ;
+                slot->time = esp_timer_get_time();
+                *pos = head;
+                return slot;
+            }
+            // Lost the race: head has been reloaded by the CAS
+        } else if (diff < 0) {
+            // Ring is full!
+            return NULL;
+        } else {
+            // Another producer claimed this slot
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Hand the filled-in slot over to the consumer
+static void ringCommit(MsgLogSlot *slot, unsigned pos)
+{
+    atomic_store_explicit(&slot->seq, (pos + 1), memory_order_release);
+}
+
+// Get the next entry ready in the ring, if any
+static MsgLogSlot *ringPeek(MsgLogRing *ring)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    MsgLogSlot *slot = &ring->slot[tail & RING_MASK];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != (tail + 1)) {
+        // Empty, or the producer is not done yet
+        return NULL;
+    }
+
+    return slot;
+}
+
+// Write out all the entries ready in the rings, oldest
+// first. Must be called with the mutex held.
+static void ringDrain(void)
+{
+    unsigned drops;
+
+    while (true) {
+        MsgLogRing *ring = NULL;
+        MsgLogSlot *slot = NULL;
+        unsigned tail;
+
+        for (unsigned coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+            MsgLogSlot *next = ringPeek(&msgLogRing[coreId]);
+            if ((next != NULL) && ((slot == NULL) || (next->time < slot->time))) {
+                ring = &msgLogRing[coreId];
+                slot = next;
+            }
+        }
+        if (slot == NULL) {
+            break;
+        }
+
+        writeEntry(&slot->entry);
+
+        // Release the slot back to the producers
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        atomic_store_explicit(&slot->seq, (tail + RING_SLOTS), memory_order_release);
+        atomic_store_explicit(&ring->tail, (tail + 1), memory_order_relaxed);
+    }
+
+    // Let the user know if we had to drop any messages
+    if ((drops = getDropCount()) != lastDropCount) {
+        fillEntryFmt(&msgLogEntry, warning, __func__, __LINE__, 0, "%u log messages dropped!", (drops - lastDropCount));
+        writeEntry(&msgLogEntry);
+        lastDropCount = drops;
+    }
+}
+
+// This task writes out the messages queued in the ring
+// buffer. It runs at low priority, so that slow console
+// or flash writes don't hold up the tasks that do the
+// logging.
+static void msgLogTask(void *parms)
+{
+#ifdef CONFIG_FAT_FS
+    const TickType_t flushPeriod = pdMS_TO_TICKS(CONFIG_MSG_LOG_FILE_FLUSH_PERIOD);
+    TickType_t lastFlushTicks = xTaskGetTickCount();
+#else
+    const TickType_t flushPeriod = portMAX_DELAY;
+#endif
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, flushPeriod);
+
+        xSemaphoreTake(mutexHandle, portMAX_DELAY);
+        msgLogDrain();
+#ifdef CONFIG_FAT_FS
+        // Time to flush the log file buffer?
+        if ((xTaskGetTickCount() - lastFlushTicks) >= flushPeriod) {
+#ifdef CONFIG_MSG_LOG_COALESCE
+            writeRepeats();
+#endif
+            flushSinks(true);
+            lastFlushTicks = xTaskGetTickCount();
+        }
+#endif
+        xSemaphoreGive(mutexHandle);
+    }
+}
+#endif  // CONFIG_MSG_LOG_ASYNC
+
+#ifdef CONFIG_MSG_LOG_ISR
+// Single-producer / single-consumer ring buffer of the
+// records logged by the ISRs, one for each CPU core. The
+// producers are the ISRs that run on the core, which are
+// serialized by masking the interrupts while the record
+// is being filled in. The consumer is whoever holds the
+// mutex.
+#define ISR_SLOTS   CONFIG_MSG_LOG_ISR_SLOTS
+#define ISR_MASK    (ISR_SLOTS - 1)
+
+_Static_assert(((ISR_SLOTS & ISR_MASK) == 0), "MSG_LOG_ISR_SLOTS must be a power of 2 !");
+
+// Record logged by an ISR. The message is not formatted
+// in the ISR: only the raw values of its arguments are
+// saved, along with the time it was logged.
+typedef struct MsgLogIsrRec {
+    int64_t time;       // esp_timer time [in usec]
+    const char *fmt;
+    const char *funcName;
+    uint16_t lineNum;
+    uint8_t logLevel;
+    uint32_t args[MSG_LOG_ISR_MAX_ARGS];
+} MsgLogIsrRec;
+
+typedef struct IsrQueue {
+    MsgLogIsrRec rec[ISR_SLOTS];
+    atomic_uint head;   // next slot to be filled in by an ISR
+    atomic_uint tail;   // next slot to be drained by the consumer
+} IsrQueue;
+
+static IsrQueue isrQueue[portNUM_PROCESSORS];
+static MsgLogEntry isrEntry;
+static atomic_uint isrMsgCount;
+static atomic_uint isrDropCount;
+static unsigned lastIsrDropCount;
+static uint32_t maxIsrCycles;
+static uint64_t sumIsrCycles;
+
+// Log a message from an ISR. It doesn't block, and it
+// doesn't touch anything in flash, so it can be called
+// from an IRAM ISR as well.
+void IRAM_ATTR msgLogISR(LogLevel logLevel, const char *funcName, int lineNum, const char *fmt, const uint32_t *args, unsigned numArgs)
+{
+    uint32_t startCycles, isrCycles;
+    UBaseType_t intMask;
+    IsrQueue *q;
+    unsigned head;
+    bool queued = false;
+
+    if (msgLogLevel == none) {
+        // Nothing to do!
+        return;
+    }
+
+    startCycles = esp_cpu_get_cycle_count();
+
+    intMask = portSET_INTERRUPT_MASK_FROM_ISR();
+    q = &isrQueue[esp_cpu_get_core_id()];
+    head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if ((head - atomic_load_explicit(&q->tail, memory_order_acquire)) < ISR_SLOTS) {
+        MsgLogIsrRec *rec = &q->rec[head & ISR_MASK];
+        rec->time = esp_timer_get_time();
+        rec->fmt = fmt;
+        rec->funcName = funcName;
+        rec->lineNum = lineNum;
+        rec->logLevel = logLevel;
+        for (unsigned i = 0; i < MSG_LOG_ISR_MAX_ARGS; i++) {
+            rec->args[i] = (i < numArgs) ? args[i] : 0;
+        }
+        atomic_store_explicit(&q->head, (head + 1), memory_order_release);
+        queued = true;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(intMask);
+
+    if (!queued) {
+        // No room for this message...
+        atomic_fetch_add_explicit(&isrDropCount, 1, memory_order_relaxed);
+        return;
+    }
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+    {
+        // Wake up the msgLog task
+        BaseType_t taskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(msgLogTaskHandle, &taskWoken);
+        portYIELD_FROM_ISR(taskWoken);
+    }
+#endif
+
+    // Same as updCallStats(), but for the ISR path
+    isrCycles = esp_cpu_get_cycle_count() - startCycles;
+    if (isrCycles > maxIsrCycles) {
+        maxIsrCycles = isrCycles;
+    }
+    sumIsrCycles += isrCycles;
+    atomic_fetch_add_explicit(&isrMsgCount, 1, memory_order_relaxed);
+}
+
+// Fill in a log entry from a record logged by an ISR.
+// The entry gets the time the record was logged, and
+// the task name "ISR".
+static void fillIsrEntry(MsgLogEntry *entry, const MsgLogIsrRec *rec, unsigned coreId)
+{
+    int64_t age;
+
+    fillEntryFmt(entry, rec->logLevel, rec->funcName, rec->lineNum, 0, rec->fmt, rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+    age = esp_timer_get_time() - rec->time;
+
+#ifdef CONFIG_MSG_LOG_BINARY
+    {
+        MlogRecHdr *hdr = (MlogRecHdr *) entry->rec;
+        hdr->timeStamp -= age;
+        hdr->taskId = MLOG_REC_ISR_TASK;
+        hdr->logLevel = (hdr->logLevel & MLOG_REC_LEVEL_MASK) | ((coreId != 0) ? MLOG_REC_CORE_BIT : 0);
+    }
+#else
+    {
+        struct timeval ageTv = { .tv_sec = age / 1000000, .tv_usec = age % 1000000 };
+        tvSub(&entry->timeStamp, &entry->timeStamp, &ageTv);
+        strcpy(entry->taskName, "ISR");
+        entry->coreId = coreId;
+    }
+#endif
+}
+
+// Write out the records logged by the ISRs. Must be
+// called with the mutex held.
+static void isrDrain(void)
+{
+    unsigned drops;
+
+    for (unsigned coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+        IsrQueue *q = &isrQueue[coreId];
+        unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+        while (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+            fillIsrEntry(&isrEntry, &q->rec[tail & ISR_MASK], coreId);
+            atomic_store_explicit(&q->tail, ++tail, memory_order_release);
+            writeEntry(&isrEntry);
+        }
+    }
+
+    // Let the user know if we had to drop any messages
+    if ((drops = atomic_load_explicit(&isrDropCount, memory_order_relaxed)) != lastIsrDropCount) {
+        fillEntryFmt(&isrEntry, warning, __func__, __LINE__, 0, "%u ISR log messages dropped!", (drops - lastIsrDropCount));
+        writeEntry(&isrEntry);
+        lastIsrDropCount = drops;
+    }
+}
+#endif  // CONFIG_MSG_LOG_ISR
+
+// Write out all the messages queued by the ISRs and, in
+// asynchronous mode, by the tasks. The ISR messages are
+// written out first, so they may show up after messages
+// logged later on by the tasks, but their timestamps are
+// the time they were logged. Must be called with the mutex
+// held.
+static void msgLogDrain(void)
+{
+#ifdef CONFIG_MSG_LOG_ISR
+    isrDrain();
+#endif
+#ifdef CONFIG_MSG_LOG_ASYNC
+    ringDrain();
+#endif
+}
+
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+// Check the token bucket of the call site, kept as the
+// time its bucket will be empty again (GCRA): each message
+// that is logged pushes that time one emission interval
+// further, and it can't get more than a burst of intervals
+// ahead of the current time. The time is updated with a
+// compare-and-swap, so the tasks logging on both cores
+// never contend on a lock. This is done in the context of
+// the task that called mlog(), before the message is
+// formatted, so that the messages that are dropped cost
+// next to nothing. Returns true if the message can be
+// logged.
+bool msgLogSiteAllow(MsgLogSite *site, LogLevel logLevel, const char *funcName, int lineNum)
+{
+    uint32_t tat, now, base;
+    unsigned suppressed;
+
+    if (logLevel == fatal) {
+        // Always!
+        return true;
+    }
+
+    tat = __atomic_load_n(&site->emptyTime, __ATOMIC_RELAXED);
+    do {
+        // The current time is read after the site's, so
+        // the latter can't be more than a burst ahead,
+        // unless the site was idle for so long that its
+        // 32-bit time wrapped around: then its bucket is
+        // empty, as it is when its time is in the past.
+        now = esp_timer_get_time() / 1000;
+        base = ((uint32_t) (tat - now) <= RL_WINDOW) ? tat : now;
+        if ((base + RL_INTERVAL - now) > RL_WINDOW) {
+            __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+            atomic_fetch_add_explicit(&rateLimitCount, 1, memory_order_relaxed);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&site->emptyTime, &tat, (base + RL_INTERVAL), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if ((suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED)) != 0) {
+        // Preserve the errno value to be logged
+        // by the caller.
+        int errorNum = errno;
+        msgLog(warning, funcName, lineNum, 0, "%u messages suppressed by rate limiting", suppressed);
+        errno = errorNum;
+    }
+
+    return true;
+}
+#endif
+
+void msgLog(LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, ...)
+{
+    uint32_t startCycles;
+    MsgLogEntry *entry;
+    va_list ap;
+
+    // The level of the message has already been
+    // checked against the level of the module by
+    // the mlog() macro.
+    if (msgLogLevel == none) {
+        // Nothing to do!
+        return;
+    }
+
+    startCycles = esp_cpu_get_cycle_count();
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+    if (logLevel != fatal) {
+        MsgLogSlot *slot;
+        unsigned pos;
+
+        if ((slot = ringReserve(&pos)) == NULL) {
+            // No room for this message...
+            updDropStats();
+            return;
+        }
+
+        va_start(ap, fmt);
+        fillEntry(&slot->entry, logLevel, funcName, lineNum, errorNum, fmt, ap);
+        va_end(ap);
+        ringCommit(slot, pos);
+
+        // Wake up the msgLog task
+        xTaskNotifyGive(msgLogTaskHandle);
+
+        updCallStats(startCycles);
+        return;
+    }
+#endif
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+
+    // Flush out any queued messages before this
+    // one.
+    msgLogDrain();
+
+    entry = &msgLogEntry;
+    va_start(ap, fmt);
+    fillEntry(entry, logLevel, funcName, lineNum, errorNum, fmt, ap);
+    va_end(ap);
+    writeEntry(entry);
+
+    if (logLevel == fatal) {
+        // Make sure the log file is up to date
+        flushSinks(false);
+        ledSet(on, red);
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        assert(false);
+    }
+
+    updCallStats(startCycles);
+
+    xSemaphoreGive(mutexHandle);
+}
+
+// Same as msgLog(), but the message is made of the event
+// name and the key/value fields, which are encoded as they
+// are, without any printf-style formatting.
+void msgLogKV(LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    uint32_t startCycles;
+
+    if (msgLogLevel == none) {
+        // Nothing to do!
+        return;
+    }
+
+    startCycles = esp_cpu_get_cycle_count();
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+    if (logLevel != fatal) {
+        MsgLogSlot *slot;
+        unsigned pos;
+
+        if ((slot = ringReserve(&pos)) == NULL) {
+            // No room for this message...
+            updDropStats();
+            return;
+        }
+
+        fillEntryKV(&slot->entry, logLevel, funcName, lineNum, errorNum, event, kv, numKV);
+        ringCommit(slot, pos);
+
+        // Wake up the msgLog task
+        xTaskNotifyGive(msgLogTaskHandle);
+
+        updCallStats(startCycles);
+        return;
+    }
+#endif
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+
+    // Flush out any queued messages before this
+    // one.
+    msgLogDrain();
+
+    fillEntryKV(&msgLogEntry, logLevel, funcName, lineNum, errorNum, event, kv, numKV);
+    writeEntry(&msgLogEntry);
+
+    if (logLevel == fatal) {
+        // Make sure the log file is up to date
+        flushSinks(false);
+        ledSet(on, red);
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        assert(false);
+    }
+
+    updCallStats(startCycles);
+
+    xSemaphoreGive(mutexHandle);
+}
+
+int msgLogInit(AppData *appDataArg, LogLevel defLogLevel, LogDest defLogDest)
+{
+    appData = appDataArg;
+    msgLogLevel = defLogLevel;
+    for (int m = 0; m < lmMax; m++) {
+        msgLogModLevel[m] = defLogLevel;
+    }
+    setDest(defLogDest);
+
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+    // If the device was reset by a crash, show the last
+    // lines logged before it happened, which were saved
+    // in the crash log.
+    if (mlogCrashInit()) {
+        const char *crashLog;
+        mlogCrashGetSaved(&crashLog);
+        printf("### Crash log from previous boot ###\n");
+        while (*crashLog != '\0') {
+            const char *eol = strchr(crashLog, '\n');
+            int n = (eol != NULL) ? (eol - crashLog) : (int) strlen(crashLog);
+            printf("CRASH: %.*s\n", n, crashLog);
+            crashLog += (eol != NULL) ? (n + 1) : n;
+        }
+        printf("### End of crash log ###\n");
+    }
+#endif
+
+    // Semaphore used to serialize the writes to the
+    // log destination.
+    if ((mutexHandle = xSemaphoreCreateMutexStatic(&mutexSem)) == NULL) {
+        // Hu?
+        return -1;
+    }
+
+    // Register the built-in sinks
+    msgLogAddSink(&consoleSink);
+#ifdef CONFIG_FAT_FS
+    msgLogAddSink(&fileSink);
+#endif
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+    msgLogAddSink(&crashSink);
+#endif
+#ifdef CONFIG_MSG_LOG_FOLLOW
+    msgLogAddSink(&followSink);
+#endif
+#ifdef CONFIG_MSG_LOG_SYSLOG
+    if (mlogUdpInit(appData) == 0) {
+        msgLogAddSink(&syslogSink);
+    } else {
+        printf("SPONG! Failed to init the syslog sink! %s\n", strerror(errno));
+    }
+#endif
+
+#ifdef CONFIG_MSG_LOG_ASYNC
+    // Initialize the ring buffers
+    for (unsigned coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+        for (unsigned i = 0; i < RING_SLOTS; i++) {
+            atomic_init(&msgLogRing[coreId].slot[i].seq, i);
+        }
+    }
+
+    // Spawn the task that writes out the queued messages
+    if (xTaskCreatePinnedToCore(msgLogTask, "msgLog", CONFIG_MSG_LOG_TASK_STACK, NULL, CONFIG_MSG_LOG_TASK_PRIO, &msgLogTaskHandle, tskNO_AFFINITY) != pdPASS) {
+        return -1;
+    }
+#elif defined(CONFIG_FAT_FS)
+    // Create the ESP Timer used to periodically flush
+    // the log file buffer.
+    {
+        esp_timer_create_args_t flushTimerArgs = {0};
+        flushTimerArgs.callback = flushTimerCb;
+        flushTimerArgs.dispatch_method = ESP_TIMER_TASK;
+        flushTimerArgs.name = "mlogFlushTmr";
+        if ((esp_timer_create(&flushTimerArgs, &flushTimerHandle) != ESP_OK) ||
+            (esp_timer_start_periodic(flushTimerHandle, (CONFIG_MSG_LOG_FILE_FLUSH_PERIOD * 1000)) != ESP_OK)) {
+            return -1;
+        }
+    }
+#endif
+
+    mlog(info, "Message logging enabled: level=%s", plainLevelName[defLogLevel]);
+
+    return 0;
+}
+
+LogDest msgLogSetDest(LogDest logDest)
+{
+    LogDest prevLogDest = msgLogDest;
+    if (logDest != prevLogDest) {
+#ifdef CONFIG_FAT_FS
+        int err = 0;
+
+        xSemaphoreTake(mutexHandle, portMAX_DELAY);
+        // Write out the queued messages using the
+        // current destination.
+        msgLogDrain();
+        if (prevLogDest == console) {
+            // Open the newest log segment on the FATFS, or
+            // a new one. The segment file is kept open, and
+            // the log lines written to it are buffered in
+            // RAM by mlogFileWrite().
+            err = mlogFileOpen();
+        } else if (logDest == console) {
+            // Flush the buffered log lines and close the
+            // log file.
+            mlogFileClose();
+        }
+        if (err == 0) {
+            setDest(logDest);
+        }
+        xSemaphoreGive(mutexHandle);
+
+        if (err != 0) {
+            // Oops!
+            mlog(errNo, "Failed to open log file: %s", mlogFilePath);
+            return prevLogDest;
+        }
+#else
+        setDest(logDest);
+#endif
+        mlog(info, "New message logging destination is %s", logDestName[msgLogDest]);
+    }
+    return prevLogDest;
+}
+
+LogLevel msgLogSetLevel(LogLevel logLevel)
+{
+    LogLevel prevLogLevel = msgLogLevel;
+
+    // The new level applies to all the modules
+    for (int m = 0; m < lmMax; m++) {
+        msgLogModLevel[m] = logLevel;
+    }
+
+    if (logLevel != prevLogLevel) {
+        msgLogLevel = logLevel;
+        mlog(info, "New message logging level is %s", plainLevelName[msgLogLevel]);
+    }
+    return prevLogLevel;
+}
+
+LogLevel msgLogSetModLevel(LogModule logModule, LogLevel logLevel)
+{
+    LogLevel prevLogLevel = msgLogModLevel[logModule];
+    if (logLevel != prevLogLevel) {
+        msgLogModLevel[logModule] = logLevel;
+        mlog(info, "New message logging level for %s is %s", logModName[logModule], plainLevelName[logLevel]);
+    }
+    return prevLogLevel;
+}
+
+LogLevel msgLogGetModLevel(LogModule logModule)
+{
+    return msgLogModLevel[logModule];
+}
+
+LogDest msgLogGetDest(void)
+{
+    return msgLogDest;
+}
+
+LogLevel msgLogGetLevel(void)
+{
+    return msgLogLevel;
+}
+
+int msgLogFlush(void)
+{
+    int err = 0;
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    msgLogDrain();
+#ifdef CONFIG_MSG_LOG_COALESCE
+    writeRepeats();
+#endif
+    err = flushSinks(false);
+    xSemaphoreGive(mutexHandle);
+
+    return err;
+}
+
+int msgLogDeleteFile(void)
+{
+    int err = 0;
+
+#ifdef CONFIG_FAT_FS
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    err = mlogFileDelete();
+    xSemaphoreGive(mutexHandle);
+#endif
+
+    return err;
+}
+
+int msgLogGetSegPath(unsigned n, char *path, size_t len)
+{
+    int err = -1;
+
+#ifdef CONFIG_FAT_FS
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    err = mlogFileGetSegPath(n, path, len);
+    xSemaphoreGive(mutexHandle);
+#endif
+
+    return err;
+}
+
+// Open a log segment for reading. The compressed
+// segments are decompressed on the fly.
+FILE *msgLogSegOpen(const char *path)
+{
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    return mlogzOpen(path, 0);
+#else
+    return fopen(path, "rb");
+#endif
+}
+
+// Register a log sink. The sink gets the messages
+// logged from now on, if it's enabled.
+int msgLogAddSink(LogSink *sink)
+{
+    int err = 0;
+
+#ifndef CONFIG_MSG_LOG_BINARY
+    if (sink->format == lfBinary) {
+        // No binary records to send
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    if (numSinks < MSG_LOG_MAX_SINKS) {
+        sinkTbl[numSinks++] = sink;
+    } else {
+        errno = ENOSPC;
+        err = -1;
+    }
+    xSemaphoreGive(mutexHandle);
+
+    return err;
+}
+
+// Unregister a log sink, after flushing its
+// buffer.
+int msgLogRemoveSink(LogSink *sink)
+{
+    int err = -1;
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    for (unsigned i = 0; i < numSinks; i++) {
+        if (sinkTbl[i] == sink) {
+            if (sink->enabled && (sink->flush != NULL)) {
+                sink->flush(sink);
+            }
+            for (numSinks--; i < numSinks; i++) {
+                sinkTbl[i] = sinkTbl[i + 1];
+            }
+            err = 0;
+            break;
+        }
+    }
+    xSemaphoreGive(mutexHandle);
+
+    if (err != 0) {
+        errno = ENOENT;
+    }
+
+    return err;
+}
+
+#ifdef CONFIG_FAT_FS
+// Open a reader of the log segments. The log lines still
+// buffered in RAM are written out first or, when the log
+// is compressed, read from a copy of the current block.
+// If 'follow' is true the caller becomes the log follower,
+// and gets the lines written after the reader was opened
+// by calling msgLogFollowRead(). There can only be one
+// follower.
+int msgLogReaderOpen(MsgLogReader *rdr, bool follow)
+{
+    MlogSegIndex segIndex;
+    struct stat fileStat;
+    size_t tailLen = 0;
+    int err = 0;
+
+    memset(rdr, 0, sizeof (*rdr));
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    rdr->tail = malloc(MLOG_FILE_TAIL_SIZE);
+#endif
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    msgLogDrain();
+#ifdef CONFIG_MSG_LOG_COALESCE
+    writeRepeats();
+#endif
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    if (rdr->tail != NULL) {
+        tailLen = mlogFileGetTail(rdr->tail);
+    } else {
+        mlogFileFlush();
+    }
+#else
+    mlogFileFlush();
+#endif
+
+    for (unsigned seg = 0; (rdr->numSegs < CONFIG_MSG_LOG_SEG_COUNT) &&
+                           (mlogFileGetSegPath(seg, rdr->segPath[rdr->numSegs], sizeof (rdr->segPath[0])) == 0); seg++) {
+        // The current segment may not have
+        // been created yet.
+        if (stat(rdr->segPath[rdr->numSegs], &fileStat) == 0) {
+            rdr->segSize[rdr->numSegs++] = fileStat.st_size;
+            rdr->totalSize += fileStat.st_size;
+        }
+    }
+    // The buffered data belongs to the current
+    // segment, which is the newest one.
+    rdr->tailStart = rdr->totalSize;
+    if (rdr->numSegs != 0) {
+        rdr->totalSize += tailLen;
+    }
+    mlogFileGetIndex(&segIndex);
+    rdr->firstTs = segIndex.firstTs[0];
+
+    if (follow) {
+#ifdef CONFIG_MSG_LOG_FOLLOW
+        // The follower gets the lines written from
+        // now on, so that none is missed or repeated.
+        if (followTask == NULL) {
+            followTask = xTaskGetCurrentTaskHandle();
+            followPos = followHead;
+            followSink.enabled = true;
+            rdr->follow = true;
+        } else {
+            errno = EBUSY;
+            err = -1;
+        }
+#else
+        errno = ENOTSUP;
+        err = -1;
+#endif
+    }
+    xSemaphoreGive(mutexHandle);
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    if (err != 0) {
+        free(rdr->tail);
+        rdr->tail = NULL;
+    }
+#endif
+
+    return err;
+}
+
+int msgLogReaderSeek(MsgLogReader *rdr, uint32_t offset)
+{
+    if (offset > rdr->totalSize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rdr->fp != NULL) {
+        fclose(rdr->fp);
+        rdr->fp = NULL;
+    }
+    rdr->seg = 0;
+    rdr->segStart = 0;
+    rdr->offset = offset;
+
+    return 0;
+}
+
+// Read up to 'len' bytes from the log segments, without
+// crossing a segment boundary. Returns the number of bytes
+// read, 0 at the end of the log, or -1 on error.
+int msgLogReaderRead(MsgLogReader *rdr, void *buf, size_t len)
+{
+    size_t n;
+
+    if (rdr->offset >= rdr->totalSize) {
+        return 0;
+    }
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    if (rdr->offset >= rdr->tailStart) {
+        // The copy of the block buffered in RAM
+        n = rdr->totalSize - rdr->offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, &rdr->tail[rdr->offset - rdr->tailStart], n);
+        rdr->offset += n;
+        return n;
+    }
+#endif
+
+    // Find the segment that holds the next byte
+    while (rdr->offset >= (rdr->segStart + rdr->segSize[rdr->seg])) {
+        rdr->segStart += rdr->segSize[rdr->seg++];
+        if (rdr->fp != NULL) {
+            fclose(rdr->fp);
+            rdr->fp = NULL;
+        }
+    }
+
+    if (rdr->fp == NULL) {
+        // The segment may have been deleted by a log
+        // rotation since the reader was opened.
+        if ((rdr->fp = fopen(rdr->segPath[rdr->seg], "rb")) == NULL) {
+            return -1;
+        }
+        if (fseek(rdr->fp, (rdr->offset - rdr->segStart), SEEK_SET) != 0) {
+            return -1;
+        }
+    }
+
+    n = rdr->segStart + rdr->segSize[rdr->seg] - rdr->offset;
+    if (n > len) {
+        n = len;
+    }
+    if (fread(buf, 1, n, rdr->fp) != n) {
+        return -1;
+    }
+    rdr->offset += n;
+
+    return n;
+}
+
+void msgLogReaderClose(MsgLogReader *rdr)
+{
+    if (rdr->fp != NULL) {
+        fclose(rdr->fp);
+        rdr->fp = NULL;
+    }
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    free(rdr->tail);
+    rdr->tail = NULL;
+#endif
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+    if (rdr->follow) {
+        xSemaphoreTake(mutexHandle, portMAX_DELAY);
+        followSink.enabled = false;
+        followTask = NULL;
+        xSemaphoreGive(mutexHandle);
+        rdr->follow = false;
+    }
+#endif
+}
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+#ifdef CONFIG_MSG_LOG_BINARY
+_Static_assert((MLOG_REC_MAX_TASKS <= (sizeof (((MsgLogQuery *) 0)->taskNames) / sizeof (((MsgLogQuery *) 0)->taskNames[0]))),
+               "MsgLogQuery.taskNames is too small !");
+
+// Read the next record. Returns 1 if one was read,
+// 0 at the end of the file, or -1 if the record is
+// truncated or corrupted.
+static int readRec(FILE *fp, uint8_t *rec)
+{
+    if (fread(rec, 1, 1, fp) != 1) {
+        return 0;
+    }
+    if ((rec[0] < sizeof (MlogRecHdr)) || (fread(&rec[1], 1, (rec[0] - 1), fp) != (size_t) (rec[0] - 1))) {
+        errno = EILSEQ;
+        return -1;
+    }
+    return 1;
+}
+
+// Check that the segment was written by the firmware
+// that is running now.
+static bool segHdrValid(const char *path)
+{
+    uint8_t rec[MLOG_REC_MAX_LEN];
+    bool valid = false;
+    FILE *fp;
+
+    if ((fp = msgLogSegOpen(path)) != NULL) {
+        valid = ((readRec(fp, rec) == 1) &&
+                 ((((const MlogRecHdr *) rec)->logLevel & MLOG_REC_LEVEL_MASK) == mrtFileHdr) &&
+                 mlogRecFileHdrValid(rec));
+        fclose(fp);
+    }
+
+    return valid;
+}
+#endif
+
+// Open the current segment of the query, positioned
+// on the first line to be read.
+static FILE *querySegOpen(MsgLogQuery *q)
+{
+    const char *path = q->segPath[q->seg];
+    unsigned skip = q->segSkip[q->seg];
+    FILE *fp;
+
+#ifdef CONFIG_MSG_LOG_BINARY
+    if (!segHdrValid(path)) {
+        errno = EILSEQ;
+        return NULL;
+    }
+#endif
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    fp = mlogzOpen(path, q->segOffset[q->seg]);
+#else
+    if (((fp = fopen(path, "rb")) != NULL) && (fseek(fp, q->segOffset[q->seg], SEEK_SET) != 0)) {
+        fclose(fp);
+        fp = NULL;
+    }
+#endif
+
+    // Skip to the start of the line within
+    // the compressed block.
+    while ((fp != NULL) && (skip != 0) && (fgetc(fp) != EOF)) {
+        skip--;
+    }
+
+    return fp;
+}
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Get the next record of the current segment in the
+// time window, formatted as a text line.
+static int queryReadLine(MsgLogQuery *q, char *buf)
+{
+    uint8_t rec[MLOG_REC_MAX_LEN];
+    char textBuf[CONFIG_MSG_LOG_MAX_LEN];
+    TsBuf tsBuf = {0};
+    int n;
+
+    while ((n = readRec(q->fp, rec)) == 1) {
+        const MlogRecHdr *hdr = (const MlogRecHdr *) rec;
+        uint8_t recType = hdr->logLevel & MLOG_REC_LEVEL_MASK;
+
+        if (recType == mrtFileHdr) {
+            continue;
+        } else if (recType == mrtTaskName) {
+            if (hdr->taskId < MLOG_REC_MAX_TASKS) {
+                strncpy(q->taskNames[hdr->taskId], (const char *) &rec[sizeof (MlogRecHdr)], (configMAX_TASK_NAME_LEN - 1));
+            }
+        } else if (hdr->timeStamp > q->to) {
+            // Past the end of the window
+            return 0;
+        } else if (hdr->timeStamp >= q->from) {
+            const char *taskName = (hdr->taskId < MLOG_REC_MAX_TASKS) ? q->taskNames[hdr->taskId] : mlogRecTaskName(hdr->taskId);
+            mlogRecFmtText(rec, textBuf, sizeof (textBuf));
+            return fmtRecLine(buf, lfPlainText, &tsBuf, rec, taskName, textBuf);
+        }
+    }
+
+    return n;
+}
+#else
+// Parse a decimal number followed by the given separator
+// character. Returns a pointer past the separator, or NULL
+// if there is no such number.
+static const char *tsGetNum(const char *p, char sep, unsigned *num, int *numDigits)
+{
+    const char *start = p;
+
+    *num = 0;
+    while (isdigit((int) *p)) {
+        *num = (*num * 10) + (*p++ - '0');
+    }
+    *numDigits = p - start;
+
+    return ((*numDigits != 0) && (*p == sep)) ? (p + 1) : NULL;
+}
+
+// Get the sub-second part of the timestamp [in usec]
+static const char *tsGetFrac(const char *p, unsigned *usec)
+{
+    int numDigits;
+
+    if ((p = tsGetNum(p, ' ', usec, &numDigits)) == NULL) {
+        return NULL;
+    }
+    for (; numDigits < 6; numDigits++) {
+        *usec *= 10;
+    }
+
+    return p;
+}
+
+#if CONFIG_MSG_LOG_TS_UPTIME_USEC || CONFIG_MSG_LOG_TS_UPTIME_MSEC
+// Get the timestamp [in usec] of a log line starting
+// with "DD HH:MM:SS.xxx". The number of days is not
+// limited to 2 digits.
+static bool parseTimestamp(const char *p, uint64_t *timeStamp)
+{
+    unsigned dd, hh, mm, ss, usec;
+    int n;
+
+    if (((p = tsGetNum(p, ' ', &dd, &n)) == NULL) ||
+        ((p = tsGetNum(p, ':', &hh, &n)) == NULL) ||
+        ((p = tsGetNum(p, ':', &mm, &n)) == NULL) ||
+        ((p = tsGetNum(p, '.', &ss, &n)) == NULL) ||
+        (tsGetFrac(p, &usec) == NULL)) {
+        return false;
+    }
+
+    *timeStamp = ((((((uint64_t) dd * 24) + hh) * 60 + mm) * 60 + ss) * 1000000) + usec;
+
+    return true;
+}
+#else
+// Get the timestamp [in usec] of a log line starting
+// with "YYYY-MM-DD HH:MM:SS.xxx", undoing the UTC offset
+// applied by fmtTimestamp().
+static bool parseTimestamp(const char *p, uint64_t *timeStamp)
+{
+    const int64_t secs2025Jan01 = 1735689600;
+    unsigned yy, mo, dd, hh, mm, ss, usec;
+    int64_t days, secs;
+    int n;
+
+    if (((p = tsGetNum(p, '-', &yy, &n)) == NULL) ||
+        ((p = tsGetNum(p, '-', &mo, &n)) == NULL) ||
+        ((p = tsGetNum(p, ' ', &dd, &n)) == NULL) ||
+        ((p = tsGetNum(p, ':', &hh, &n)) == NULL) ||
+        ((p = tsGetNum(p, ':', &mm, &n)) == NULL) ||
+        ((p = tsGetNum(p, '.', &ss, &n)) == NULL) ||
+        (tsGetFrac(p, &usec) == NULL) ||
+        (mo < 1) || (mo > 12) || (dd < 1)) {
+        return false;
+    }
+
+    // Days since the Epoch of the civil date, counting
+    // the years from March so Feb 29 comes last.
+    if (mo <= 2) {
+        yy--;
+    }
+    days = ((int64_t) yy * 365) + (yy / 4) - (yy / 100) + (yy / 400) + (((153 * ((mo + 9) % 12)) + 2) / 5) + (dd - 1) - 719468;
+    secs = (days * 86400) + (hh * 3600) + (mm * 60) + ss;
+
+    if ((secs - (appData->persData.utcOffset * 3600)) >= secs2025Jan01) {
+        secs -= appData->persData.utcOffset * 3600;
+    }
+    if (secs < 0) {
+        return false;
+    }
+
+    *timeStamp = ((uint64_t) secs * 1000000) + usec;
+
+    return true;
+}
+#endif
+
+// Get the next line of the current segment in the time
+// window. The lines that don't start with a timestamp
+// go with the previous one.
+static int queryReadLine(MsgLogQuery *q, char *buf, size_t len)
+{
+    uint64_t timeStamp;
+
+    while (fgets(buf, len, q->fp) != NULL) {
+        if (parseTimestamp(buf, &timeStamp)) {
+            if (timeStamp > q->to) {
+                // Past the end of the window
+                return 0;
+            }
+            q->inWindow = (timeStamp >= q->from);
+        }
+        if (q->inWindow) {
+            return strlen(buf);
+        }
+    }
+
+    return ferror(q->fp) ? -1 : 0;
+}
+#endif
+
+// Open a query of the log lines with a timestamp in the
+// [from, to] window. The log lines still buffered in RAM
+// are written out first. The timestamps only need to be
+// in order within each segment: a segment is assumed to
+// end where the next one starts, unless the timestamps
+// went back in between (e.g. the uptime at a restart).
+int msgLogQueryOpen(MsgLogQuery *q, uint64_t from, uint64_t to)
+{
+    MlogSegIndex segIndex;
+    MlogSeekEntry entry;
+
+    if (from > to) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(q, 0, sizeof (*q));
+    q->from = from;
+    q->to = to;
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    msgLogDrain();
+#ifdef CONFIG_MSG_LOG_COALESCE
+    writeRepeats();
+#endif
+    mlogFileFlush();
+
+    mlogFileGetIndex(&segIndex);
+    for (unsigned seg = 0; (seg < segIndex.numSegs) && (q->numSegs < CONFIG_MSG_LOG_SEG_COUNT); seg++) {
+        uint64_t firstTs = segIndex.firstTs[seg];
+        bool last = ((seg + 1) == segIndex.numSegs) || (segIndex.firstTs[seg + 1] < firstTs);
+
+        if ((firstTs > to) || (!last && (segIndex.firstTs[seg + 1] < from))) {
+            continue;
+        }
+        if (mlogFileGetSegPath(seg, q->segPath[q->numSegs], sizeof (q->segPath[0])) != 0) {
+            break;
+        }
+        mlogFileGetSeekEntry(seg, from, &entry);
+        q->segOffset[q->numSegs] = entry.offset;
+        q->segSkip[q->numSegs] = entry.skip;
+        q->numSegs++;
+    }
+    xSemaphoreGive(mutexHandle);
+
+    return 0;
+}
+
+// Get the next log line in the time window. The buffer
+// must hold at least MSG_LOG_QUERY_LINE_LEN bytes. With
+// binary log records, the records are formatted as text
+// lines. Returns the length of the line, 0 at the end of
+// the window, or -1 on error.
+int msgLogQueryNext(MsgLogQuery *q, char *buf, size_t len)
+{
+    int n;
+
+    if (len < MSG_LOG_QUERY_LINE_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (q->seg < q->numSegs) {
+        if (q->fp == NULL) {
+            if ((q->fp = querySegOpen(q)) == NULL) {
+                if ((errno == ENOENT) || (errno == EILSEQ)) {
+                    // The segment was deleted by a log rotation,
+                    // or it can't be decoded here: skip it.
+                    q->seg++;
+                    continue;
+                }
+                return -1;
+            }
+            q->inWindow = false;
+        }
+
+#ifdef CONFIG_MSG_LOG_BINARY
+        n = queryReadLine(q, buf);
+#else
+        n = queryReadLine(q, buf, len);
+#endif
+        if (n != 0) {
+            return n;
+        }
+
+        fclose(q->fp);
+        q->fp = NULL;
+        q->seg++;
+    }
+
+    return 0;
+}
+
+void msgLogQueryClose(MsgLogQuery *q)
+{
+    if (q->fp != NULL) {
+        fclose(q->fp);
+        q->fp = NULL;
+    }
+    q->seg = q->numSegs;
+}
+#endif
+#endif  // CONFIG_FAT_FS
+
+#ifdef CONFIG_MSG_LOG_FOLLOW
+// Read the log lines written since the last call, waiting
+// up to 'timeout' msec for new ones. Must only be called by
+// the log follower. Returns the number of bytes read.
+size_t msgLogFollowRead(char *buf, size_t len, uint32_t timeout)
+{
+    uint32_t avail;
+    size_t n;
+
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    if ((avail = followHead - followPos) == 0) {
+        xSemaphoreGive(mutexHandle);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+        xSemaphoreTake(mutexHandle, portMAX_DELAY);
+        avail = followHead - followPos;
+    }
+
+    if (avail > FOLLOW_BUF_SIZE) {
+        // The follower fell behind and the oldest
+        // lines were overwritten: skip them.
+        followPos = followHead - FOLLOW_BUF_SIZE;
+        avail = FOLLOW_BUF_SIZE;
+    }
+
+    n = (avail < len) ? avail : len;
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = followBuf[(followPos + i) % FOLLOW_BUF_SIZE];
+    }
+    followPos += n;
+    xSemaphoreGive(mutexHandle);
+
+    return n;
+}
+#endif
+
+#if defined(CONFIG_MSG_LOG_BINARY) && defined(CONFIG_FAT_FS)
+// Dump the binary log records read from the specified
+// file. The records can only be formatted on the device
+// if they were written by the firmware that is running
+// now, as they refer to its format strings. Otherwise
+// the file must be decoded on the host, using the ELF
+// file of the firmware that wrote it.
+int msgLogDumpRecords(FILE *fp)
+{
+    static char taskNames[MLOG_REC_MAX_TASKS][configMAX_TASK_NAME_LEN];
+    uint8_t rec[MLOG_REC_MAX_LEN];
+    char textBuf[CONFIG_MSG_LOG_MAX_LEN];
+    char lineBuf[CONFIG_MSG_LOG_MAX_LEN + 1];
+    TsBuf tsBuf = {0};
+    bool hdrValid = false;
+    int n = 0;
+
+    memset(taskNames, 0, sizeof (taskNames));
+
+    while (fread(rec, 1, 1, fp) == 1) {
+        const MlogRecHdr *hdr = (const MlogRecHdr *) rec;
+        uint8_t recType;
+
+        if ((rec[0] < sizeof (MlogRecHdr)) || (fread(&rec[1], 1, (rec[0] - 1), fp) != (size_t) (rec[0] - 1))) {
+            printf("MLOG: *** Truncated or corrupted record! ***\n");
+            return -1;
+        }
+
+        recType = hdr->logLevel & MLOG_REC_LEVEL_MASK;
+        if (recType == mrtFileHdr) {
+            if (!(hdrValid = mlogRecFileHdrValid(rec))) {
+                printf("MLOG: *** File written by a different firmware: use mlogdec.py to decode it! ***\n");
+                return -1;
+            }
+        } else if (!hdrValid) {
+            printf("MLOG: *** Missing file header! ***\n");
+            return -1;
+        } else if (recType == mrtTaskName) {
+            if (hdr->taskId < MLOG_REC_MAX_TASKS) {
+                strncpy(taskNames[hdr->taskId], (const char *) &rec[sizeof (MlogRecHdr)], (configMAX_TASK_NAME_LEN - 1));
+            }
+        } else {
+            const char *taskName = (hdr->taskId < MLOG_REC_MAX_TASKS) ? taskNames[hdr->taskId] : mlogRecTaskName(hdr->taskId);
+            mlogRecFmtText(rec, textBuf, sizeof (textBuf));
+            fmtRecLine(lineBuf, lfColorText, &tsBuf, rec, taskName, textBuf);
+            printf("MLOG: %s", lineBuf);
+        }
+
+        if (++n == 100) {
+            // This delay is to prevent the task
+            // watchdog to expire...
+            vTaskDelay(1);
+            n = 0;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+// Get the lines that were saved in the crash log
+// before the last reset, if it was caused by a
+// crash. Returns the length of the text.
+size_t msgLogGetCrashLog(const char **data)
+{
+#ifdef CONFIG_MSG_LOG_CRASH_LOG
+    return mlogCrashGetSaved(data);
+#else
+    *data = NULL;
+    return 0;
+#endif
+}
+
+void msgLogGetStats(MsgLogStats *stats)
+{
+    uint64_t sumCallCycles = 0;
+
+    memset(stats, 0, sizeof (*stats));
+    for (unsigned coreId = 0; coreId < portNUM_PROCESSORS; coreId++) {
+        volatile CallStats *cs = &callStats[coreId];
+        uint64_t sum;
+
+        // The 64-bit sum is read again if it was
+        // updated half way through.
+        do {
+            sum = cs->sumCallCycles;
+        } while (sum != cs->sumCallCycles);
+
+        stats->msgCount += cs->msgCount;
+        stats->dropCount += cs->dropCount;
+        if (cs->maxCallCycles > stats->maxCallCycles) {
+            stats->maxCallCycles = cs->maxCallCycles;
+        }
+        sumCallCycles += sum;
+#ifdef CONFIG_MSG_LOG_ASYNC
+        {
+            unsigned hwm = atomic_load(&msgLogRing[coreId].highWater);
+            if (hwm > stats->highWater) {
+                stats->highWater = hwm;
+            }
+        }
+#endif
+    }
+    stats->avgCallCycles = (stats->msgCount != 0) ? (sumCallCycles / stats->msgCount) : 0;
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+    stats->rateLimited = atomic_load(&rateLimitCount);
+#endif
+#ifdef CONFIG_MSG_LOG_ISR
+    stats->isrMsgCount = atomic_load(&isrMsgCount);
+    stats->isrDropCount = atomic_load(&isrDropCount);
+    stats->maxIsrCycles = maxIsrCycles;
+    stats->avgIsrCycles = (stats->isrMsgCount != 0) ? (sumIsrCycles / stats->isrMsgCount) : 0;
+#endif
+#ifdef CONFIG_MSG_LOG_COALESCE
+    stats->repeated = repeatTotal;
+#endif
+#ifdef CONFIG_FAT_FS
+    xSemaphoreTake(mutexHandle, portMAX_DELAY);
+    mlogFileGetStats(&stats->fileLines, &stats->fileWrites, &stats->fileSegments);
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    mlogFileGetZStats(&stats->fileRawBytes, &stats->fileZBytes, &stats->zCyclesPerKB);
+#endif
+    xSemaphoreGive(mutexHandle);
+#endif
+#ifdef CONFIG_MSG_LOG_SYSLOG
+    {
+        MlogUdpStats udpStats;
+        mlogUdpGetStats(&udpStats);
+        stats->syslogRecords = udpStats.records;
+        stats->syslogDgrams = udpStats.datagrams;
+        stats->syslogBytes = udpStats.bytes;
+        stats->syslogDropped = udpStats.dropped;
+    }
+#endif
+}
+
+// Tell the log sinks that need the network, if any,
+// whether it's up or down.
+void msgLogSetNetState(bool up)
+{
+#ifdef CONFIG_MSG_LOG_SYSLOG
+    mlogUdpSetNetState(up);
+#endif
+}
+#else
+int msgLogInit(AppData *appData, LogLevel defLogLevel, LogDest defLogDest)
+{
+    return 0;
+}
+
+LogDest msgLogSetDest(LogDest logDest)
+{
+    return logDest;
+}
+
+LogLevel msgLogSetLevel(LogLevel logLevel)
+{
+    return none;
+}
+
+LogLevel msgLogSetModLevel(LogModule logModule, LogLevel logLevel)
+{
+    return none;
+}
+
+LogLevel msgLogGetModLevel(LogModule logModule)
+{
+    return none;
+}
+
+LogDest msgLogGetDest(void)
+{
+    return console;
+}
+
+LogLevel msgLogGetLevel(void)
+{
+    return none;
+}
+
+int msgLogFlush(void)
+{
+    return 0;
+}
+
+int msgLogDeleteFile(void)
+{
+    // No log file is ever written
+    errno = ENOENT;
+    return -1;
+}
+
+int msgLogGetSegPath(unsigned n, char *path, size_t len)
+{
+    return -1;
+}
+
+FILE *msgLogSegOpen(const char *path)
+{
+    errno = ENOENT;
+    return NULL;
+}
+
+int msgLogAddSink(LogSink *sink)
+{
+    return 0;
+}
+
+int msgLogRemoveSink(LogSink *sink)
+{
+    return 0;
+}
+
+size_t msgLogGetCrashLog(const char **data)
+{
+    *data = NULL;
+    return 0;
+}
+
+void msgLogGetStats(MsgLogStats *stats)
+{
+    memset(stats, 0, sizeof (*stats));
+}
+
+void msgLogSetNetState(bool up)
 {
-    return none;
 }
 #endif  // CONFIG_MSG_LOG
@@ -2,6 +2,8 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <errno.h>
 
 #include "sdkconfig.h"
@@ -25,22 +27,313 @@ typedef enum LogLevel {
     fatal
 } LogLevel;
 
+// Format of the log lines sent to a sink. The
+// text formats must come first.
+typedef enum LogFormat {
+    lfColorText = 0,    // text with ANSI color escape codes
+    lfPlainText,        // plain text
+    lfBinary,           // binary log records (CONFIG_MSG_LOG_BINARY only)
+} LogFormat;
+
+#define MSG_LOG_MAX_SINKS   8
+
+// Log sink. Each sink has its own level, which is checked
+// after the level of the module, and its own format. The
+// write() function gets a complete log line (or record),
+// with its timestamp and level, and the optional flush() function is called to write
+// out whatever the sink buffered, when the log file is
+// flushed. Both are called with the msgLog mutex held, so
+// they must not call mlog(). The console and file sinks
+// are enabled or disabled by msgLogSetDest().
+typedef struct LogSink {
+    const char *name;
+    LogFormat format;
+    LogLevel level;
+    bool enabled;
+    void (*write)(struct LogSink *sink, const void *data, size_t len, uint64_t timeStamp, LogLevel logLevel);
+    int (*flush)(struct LogSink *sink);
+    void *arg;
+} LogSink;
+
+// Type of a key/value field of mlogKV()
+typedef enum MlogKVType {
+    mktInt = 0,     // int32_t
+    mktUint,        // uint32_t
+    mktBool,        // bool
+    mktStr,         // NUL-terminated string
+    mktIp4,         // IPv4 address, in network byte order
+    mktMac,         // MAC address (6 bytes)
+    mktBleAddr,     // BLE address (6 bytes, in reverse order)
+} MlogKVType;
+
+// Key/value field of mlogKV()
+typedef struct MlogKV {
+    const char *key;
+    MlogKVType type;
+    union {
+        int32_t i;
+        uint32_t u;
+        bool b;
+        const char *s;
+        const uint8_t *p;
+    } v;
+} MlogKV;
+
+#define KV_INT(k, val)      ((MlogKV) { .key = (k), .type = mktInt, .v.i = (val) })
+#define KV_UINT(k, val)     ((MlogKV) { .key = (k), .type = mktUint, .v.u = (val) })
+#define KV_BOOL(k, val)     ((MlogKV) { .key = (k), .type = mktBool, .v.b = (val) })
+#define KV_STR(k, val)      ((MlogKV) { .key = (k), .type = mktStr, .v.s = (val) })
+#define KV_IP4(k, val)      ((MlogKV) { .key = (k), .type = mktIp4, .v.u = (val) })
+#define KV_MAC(k, val)      ((MlogKV) { .key = (k), .type = mktMac, .v.p = (val) })
+#define KV_BLE_ADDR(k, val) ((MlogKV) { .key = (k), .type = mktBleAddr, .v.p = (val) })
+
+// Message logging stats
+typedef struct MsgLogStats {
+    uint32_t msgCount;      // number of messages logged
+    uint32_t dropCount;     // number of messages dropped because the ring buffer was full
+    uint32_t highWater;     // max number of slots in use in a ring buffer
+    uint32_t maxCallCycles; // max CPU cycles spent by the caller in msgLog()
+    uint32_t avgCallCycles; // avg CPU cycles spent by the caller in msgLog()
+    uint32_t fileLines;     // number of lines written to the log file
+    uint32_t fileWrites;    // number of (buffered) writes to the log file
+    uint32_t fileSegments;  // number of log file segments created
+    uint32_t rateLimited;   // number of messages dropped by the per-callsite rate limiter
+    uint32_t repeated;      // number of repeated messages coalesced
+    uint32_t isrMsgCount;   // number of messages logged by ISRs
+    uint32_t isrDropCount;  // number of ISR messages dropped because the queue was full
+    uint32_t maxIsrCycles;  // max CPU cycles spent by the ISR in msgLogISR()
+    uint32_t avgIsrCycles;  // avg CPU cycles spent by the ISR in msgLogISR()
+    uint32_t fileRawBytes;  // raw length of the data written to the compressed log file
+    uint32_t fileZBytes;    // compressed length of the data written to the log file
+    uint32_t zCyclesPerKB;  // CPU cycles spent compressing each KB of log data
+    uint32_t syslogRecords; // number of messages sent to the syslog collector
+    uint32_t syslogDgrams;  // number of datagrams sent to the syslog collector
+    uint32_t syslogBytes;   // number of bytes sent to the syslog collector
+    uint32_t syslogDropped; // number of messages dropped because the syslog backlog was full
+} MsgLogStats;
+
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+// Rate limiter state of an mlog() call site. The
+// token bucket is kept as the time it will be empty
+// again, so that a zero-initialized site starts with
+// an empty bucket, i.e. a full burst of tokens. Both
+// fields are updated atomically, without any lock.
+typedef struct MsgLogSite {
+    uint32_t emptyTime;     // time the bucket will be empty [in msec]
+    uint32_t suppressed;    // messages dropped since the last one logged
+} MsgLogSite;
+#endif
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_FAT_FS)
+// Reader of the log segments, seen as a single stream
+// of bytes, from the oldest to the newest segment. Only
+// the bytes held by the segments when the reader was
+// opened are read. When the log is compressed, they're
+// followed by a copy of the block still buffered in RAM,
+// which is written out later as part of a larger block,
+// so a download can only be resumed from tailStart.
+typedef struct MsgLogReader {
+    FILE *fp;
+    bool follow;            // also reading the new log lines
+    unsigned numSegs;
+    unsigned seg;           // current segment
+    uint32_t segStart;      // offset of the current segment
+    uint32_t offset;        // offset of the next byte to read
+    uint32_t totalSize;     // number of bytes in all the segments
+    uint32_t tailStart;     // offset of the data buffered in RAM
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    uint8_t *tail;          // copy of the block buffered in RAM
+#endif
+    uint64_t firstTs;       // timestamp of the first log line
+    uint32_t segSize[CONFIG_MSG_LOG_SEG_COUNT];
+    char segPath[CONFIG_MSG_LOG_SEG_COUNT][32];
+} MsgLogReader;
+#endif
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+// Size of the buffer passed to msgLogQueryNext()
+#define MSG_LOG_QUERY_LINE_LEN  (CONFIG_MSG_LOG_MAX_LEN + 2)
+
+// Query of the log lines in a time window. The segments
+// that may hold some of the lines, and where to start
+// reading each one of them, are looked up in the segment
+// and seek indexes when the query is opened.
+typedef struct MsgLogQuery {
+    FILE *fp;
+    uint64_t from;          // start of the time window [in usec]
+    uint64_t to;            // end of the time window [in usec]
+    unsigned numSegs;
+    unsigned seg;           // current segment
+    bool inWindow;          // the last line read is in the window
+#ifdef CONFIG_MSG_LOG_BINARY
+    char taskNames[32][configMAX_TASK_NAME_LEN];
+#endif
+    uint32_t segOffset[CONFIG_MSG_LOG_SEG_COUNT];
+    uint16_t segSkip[CONFIG_MSG_LOG_SEG_COUNT];
+    char segPath[CONFIG_MSG_LOG_SEG_COUNT][32];
+} MsgLogQuery;
+#endif
+
+// Message logging modules. Each source file that calls mlog()
+// must define MLOG_MODULE to one of these values.
+typedef enum LogModule {
+    lmApp = 0,
+    lmBle,
+    lmHttps,
+    lmLed,
+    lmMlog,
+    lmNvram,
+    lmOta,
+    lmWifi,
+    lmMax
+} LogModule;
+
 #ifdef CONFIG_MSG_LOG
+// Compile-time log level of each module
+#define MLOG_COMPILE_LEVEL_lmApp    CONFIG_MSG_LOG_COMPILE_LEVEL_APP
+#define MLOG_COMPILE_LEVEL_lmBle    CONFIG_MSG_LOG_COMPILE_LEVEL_BLE
+#define MLOG_COMPILE_LEVEL_lmHttps  CONFIG_MSG_LOG_COMPILE_LEVEL_HTTPS
+#define MLOG_COMPILE_LEVEL_lmLed    CONFIG_MSG_LOG_COMPILE_LEVEL_LED
+#define MLOG_COMPILE_LEVEL_lmMlog   CONFIG_MSG_LOG_COMPILE_LEVEL_MLOG
+#define MLOG_COMPILE_LEVEL_lmNvram  CONFIG_MSG_LOG_COMPILE_LEVEL_NVRAM
+#define MLOG_COMPILE_LEVEL_lmOta    CONFIG_MSG_LOG_COMPILE_LEVEL_OTA
+#define MLOG_COMPILE_LEVEL_lmWifi   CONFIG_MSG_LOG_COMPILE_LEVEL_WIFI
+
+#define mlogCompileLevel(mod)   mlogCompileLevel_(mod)
+#define mlogCompileLevel_(mod)  MLOG_COMPILE_LEVEL_##mod
+
+// Tells whether a message at the given level is to be
+// logged by the module. Warnings and errors are always
+// logged. When the level is a constant above the module's
+// compile-time level, the whole mlog() call is optimized
+// away. Otherwise the module's runtime level is checked
+// before any of the arguments is evaluated.
+#define mlogLevelOn(lvl) \
+    (((lvl) >= warning) || (((lvl) <= mlogCompileLevel(MLOG_MODULE)) && ((lvl) <= msgLogModLevel[MLOG_MODULE])))
+
 // This macro is used to pick up the file name, line number,
-// and errno value from where msgLog() is being called.
-#define mlog(lvl, fmt, args...) msgLog((lvl), __func__, __LINE__, errno, (fmt), ##args)
+// and errno value from where msgLog() is being called. When
+// rate limiting is enabled, each call site gets its own
+// token bucket.
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+#define mlog(lvl, fmt, args...) \
+    do { \
+        static MsgLogSite mlogSite_; \
+        if (mlogLevelOn(lvl) && msgLogSiteAllow(&mlogSite_, (lvl), __func__, __LINE__)) \
+            msgLog((lvl), __func__, __LINE__, errno, (fmt), ##args); \
+    } while (0)
+#else
+#define mlog(lvl, fmt, args...) \
+    do { if (mlogLevelOn(lvl)) msgLog((lvl), __func__, __LINE__, errno, (fmt), ##args); } while (0)
+#endif
+
+// This macro logs a line of a multi-line dump, such as
+// a stats table. It's never rate limited, as all the
+// lines of the dump come from the same call site.
+#define mlogDump(lvl, fmt, args...) \
+    do { if (mlogLevelOn(lvl)) msgLog((lvl), __func__, __LINE__, errno, (fmt), ##args); } while (0)
+
+// Max number of arguments of mlogISR()
+#define MSG_LOG_ISR_MAX_ARGS    4
+
+// This macro can be used to log a message from an ISR.
+// The message is formatted later on, in task context, so
+// the arguments must be integers of up to 32 bits (cast
+// any pointer to uint32_t) and any string they refer to
+// must remain valid, e.g. a string literal.
+#ifdef CONFIG_MSG_LOG_ISR
+#define mlogISR(lvl, fmt, args...) \
+    do { \
+        const uint32_t mlogArgs_[] = { 0, ##args }; \
+        _Static_assert(((sizeof (mlogArgs_) / sizeof (mlogArgs_[0])) <= (MSG_LOG_ISR_MAX_ARGS + 1)), "Too many mlogISR() args !"); \
+        if (mlogLevelOn(lvl)) \
+            msgLogISR((lvl), __func__, __LINE__, (fmt), &mlogArgs_[1], ((sizeof (mlogArgs_) / sizeof (mlogArgs_[0])) - 1)); \
+    } while (0)
+#else
+#define mlogISR(lvl, fmt, args...)
+#endif
+
+// This macro logs an event along with typed key/value
+// fields, e.g.:
+//
+//   mlogKV(info, "wifiConnected", KV_IP4("ipAddr", ipAddr), KV_INT("rssi", rssi));
+//
+// The fields are encoded straight into a JSON object, or
+// a CBOR map in a binary log record, which is rendered
+// as JSON when the text is needed:
+//
+//   {"event":"wifiConnected","ipAddr":"192.168.1.10","rssi":-60}
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+#define mlogKV(lvl, event, fields...) \
+    do { \
+        static MsgLogSite mlogSite_; \
+        if (mlogLevelOn(lvl) && msgLogSiteAllow(&mlogSite_, (lvl), __func__, __LINE__)) { \
+            const MlogKV mlogKV_[] = { fields }; \
+            msgLogKV((lvl), __func__, __LINE__, errno, (event), mlogKV_, (sizeof (mlogKV_) / sizeof (MlogKV))); \
+        } \
+    } while (0)
+#else
+#define mlogKV(lvl, event, fields...) \
+    do { \
+        if (mlogLevelOn(lvl)) { \
+            const MlogKV mlogKV_[] = { fields }; \
+            msgLogKV((lvl), __func__, __LINE__, errno, (event), mlogKV_, (sizeof (mlogKV_) / sizeof (MlogKV))); \
+        } \
+    } while (0)
+#endif
 #else
 #define mlog(lvl, fmt, args...)
+#define mlogDump(lvl, fmt, args...)
+#define mlogISR(lvl, fmt, args...)
+#define mlogKV(lvl, event, fields...)
 #endif
 
 __BEGIN_DECLS
 
+// Runtime log level of each module
+extern uint8_t msgLogModLevel[lmMax];
+
 extern void msgLog(LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, ...)  __attribute__ ((__format__ (__printf__, 5, 6)));
+extern void msgLogKV(LogLevel logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV);
+#ifdef CONFIG_MSG_LOG_ISR
+extern void msgLogISR(LogLevel logLevel, const char *funcName, int lineNum, const char *fmt, const uint32_t *args, unsigned numArgs);
+#endif
+#ifdef CONFIG_MSG_LOG_RATE_LIMIT
+extern bool msgLogSiteAllow(MsgLogSite *site, LogLevel logLevel, const char *funcName, int lineNum);
+#endif
 
 extern int msgLogInit(AppData *appData, LogLevel defLogLevel, LogDest defLogDest);
 extern LogDest msgLogSetDest(LogDest logDest);
 extern LogLevel msgLogSetLevel(LogLevel logLevel);
 extern LogDest msgLogGetDest(void);
 extern LogLevel msgLogGetLevel(void);
+extern LogLevel msgLogSetModLevel(LogModule logModule, LogLevel logLevel);
+extern LogLevel msgLogGetModLevel(LogModule logModule);
+extern int msgLogFlush(void);
+extern int msgLogDeleteFile(void);
+extern int msgLogGetSegPath(unsigned n, char *path, size_t len);
+extern FILE *msgLogSegOpen(const char *path);
+extern int msgLogAddSink(LogSink *sink);
+extern int msgLogRemoveSink(LogSink *sink);
+extern size_t msgLogGetCrashLog(const char **data);
+extern void msgLogGetStats(MsgLogStats *stats);
+extern void msgLogSetNetState(bool up);
+#ifdef CONFIG_MSG_LOG_BINARY
+extern int msgLogDumpRecords(FILE *fp);
+#endif
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_FAT_FS)
+extern int msgLogReaderOpen(MsgLogReader *rdr, bool follow);
+extern int msgLogReaderSeek(MsgLogReader *rdr, uint32_t offset);
+extern int msgLogReaderRead(MsgLogReader *rdr, void *buf, size_t len);
+extern void msgLogReaderClose(MsgLogReader *rdr);
+#endif
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+extern int msgLogQueryOpen(MsgLogQuery *q, uint64_t from, uint64_t to);
+extern int msgLogQueryNext(MsgLogQuery *q, char *buf, size_t len);
+extern void msgLogQueryClose(MsgLogQuery *q);
+#endif
+#ifdef CONFIG_MSG_LOG_FOLLOW
+extern size_t msgLogFollowRead(char *buf, size_t len, uint32_t timeout);
+#endif
 
 __END_DECLS
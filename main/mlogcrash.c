@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "esp32.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "mlogcrash.h"
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_MSG_LOG_CRASH_LOG)
+
+#define RING_SIZE       CONFIG_MSG_LOG_CRASH_LOG_SIZE
+#define CRASH_LOG_MAGIC 0x474F4C43  // "CLOG"
+
+// Crash log header. The CRC is updated every time
+// the header is modified, so a header that was only
+// partially updated when the device crashed is
+// detected as invalid.
+typedef struct CrashLogHdr {
+    uint32_t magic;
+    uint32_t tail;  // offset of the oldest line
+    uint32_t used;  // number of bytes in use
+    uint32_t crc;   // CRC32 of the fields above
+} CrashLogHdr;
+
+// Each line is stored with this header, followed
+// by the text of the line.
+typedef struct LineHdr {
+    uint16_t len;
+    uint16_t crc;   // CRC16 of the text
+} LineHdr;
+
+typedef struct CrashLog {
+    CrashLogHdr hdr;
+    uint8_t data[RING_SIZE];
+} CrashLog;
+
+// The ring buffer lives in RTC memory that is not
+// initialized at boot, so it survives a panic or
+// watchdog reset.
+static RTC_NOINIT_ATTR CrashLog crashLog;
+
+// Lines recovered from the crash log at boot
+static char *savedLog;
+static size_t savedLen;
+
+static uint32_t hdrCrc(const CrashLogHdr *hdr)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) hdr, offsetof(CrashLogHdr, crc));
+}
+
+static void updHdr(uint32_t tail, uint32_t used)
+{
+    CrashLogHdr *hdr = &crashLog.hdr;
+    hdr->tail = tail;
+    hdr->used = used;
+    hdr->crc = hdrCrc(hdr);
+}
+
+static void ringRead(uint32_t pos, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len-- != 0) {
+        *p++ = crashLog.data[pos];
+        pos = (pos + 1) % RING_SIZE;
+    }
+}
+
+static void ringWrite(uint32_t pos, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t n = RING_SIZE - pos;
+
+    if (n > len) {
+        n = len;
+    }
+    memcpy(&crashLog.data[pos], p, n);
+    if (n < len) {
+        memcpy(crashLog.data, (p + n), (len - n));
+    }
+}
+
+// Copy the valid lines of the crash log to RAM.
+// Stops at the first line that fails the CRC
+// check, i.e. one that was being written when the
+// device crashed.
+static void recoverLines(void)
+{
+    const CrashLogHdr *hdr = &crashLog.hdr;
+    uint32_t pos = hdr->tail;
+    uint32_t left = hdr->used;
+
+    if ((savedLog = malloc(hdr->used + 1)) == NULL) {
+        return;
+    }
+
+    while (left > sizeof (LineHdr)) {
+        LineHdr lineHdr;
+
+        ringRead(pos, &lineHdr, sizeof (lineHdr));
+        if (lineHdr.len > (left - sizeof (lineHdr))) {
+            break;
+        }
+        ringRead(((pos + sizeof (lineHdr)) % RING_SIZE), &savedLog[savedLen], lineHdr.len);
+        if (esp_rom_crc16_le(0, (const uint8_t *) &savedLog[savedLen], lineHdr.len) != lineHdr.crc) {
+            break;
+        }
+        savedLen += lineHdr.len;
+        pos = (pos + sizeof (lineHdr) + lineHdr.len) % RING_SIZE;
+        left -= sizeof (lineHdr) + lineHdr.len;
+    }
+    savedLog[savedLen] = '\0';
+}
+
+// Called at boot, before any message is logged. If the
+// device was reset by a crash, the lines found in the
+// crash log are saved in RAM. Returns true if any line
+// was recovered.
+bool mlogCrashInit(void)
+{
+    const CrashLogHdr *hdr = &crashLog.hdr;
+    esp_reset_reason_t resetReason = esp_reset_reason();
+    bool crashed = ((resetReason == ESP_RST_PANIC) || (resetReason == ESP_RST_INT_WDT) ||
+                    (resetReason == ESP_RST_TASK_WDT) || (resetReason == ESP_RST_WDT) ||
+                    (resetReason == ESP_RST_BROWNOUT));
+
+    if (crashed && (hdr->magic == CRASH_LOG_MAGIC) && (hdr->crc == hdrCrc(hdr)) &&
+        (hdr->tail < RING_SIZE) && (hdr->used <= RING_SIZE)) {
+        recoverLines();
+    }
+
+    // Start over with an empty crash log
+    crashLog.hdr.magic = CRASH_LOG_MAGIC;
+    updHdr(0, 0);
+
+    return (savedLen != 0);
+}
+
+void mlogCrashWrite(const char *data, size_t len)
+{
+    const CrashLogHdr *hdr = &crashLog.hdr;
+    uint32_t tail = hdr->tail;
+    uint32_t used = hdr->used;
+    LineHdr lineHdr;
+
+    if (len > (RING_SIZE - sizeof (lineHdr))) {
+        len = RING_SIZE - sizeof (lineHdr);
+    }
+
+    // Drop the oldest lines to make room for this one. The
+    // header is updated before their space is overwritten,
+    // so it never refers to a partially overwritten line.
+    if ((used + sizeof (lineHdr) + len) > RING_SIZE) {
+        while ((used + sizeof (lineHdr) + len) > RING_SIZE) {
+            LineHdr oldHdr;
+            ringRead(tail, &oldHdr, sizeof (oldHdr));
+            tail = (tail + sizeof (oldHdr) + oldHdr.len) % RING_SIZE;
+            used -= sizeof (oldHdr) + oldHdr.len;
+        }
+        updHdr(tail, used);
+    }
+
+    lineHdr.len = len;
+    lineHdr.crc = esp_rom_crc16_le(0, (const uint8_t *) data, len);
+    ringWrite(((tail + used) % RING_SIZE), &lineHdr, sizeof (lineHdr));
+    ringWrite(((tail + used + sizeof (lineHdr)) % RING_SIZE), data, len);
+
+    updHdr(tail, (used + sizeof (lineHdr) + len));
+}
+
+// Get the lines recovered from the crash log at boot
+size_t mlogCrashGetSaved(const char **data)
+{
+    *data = savedLog;
+    return savedLen;
+}
+
+#endif  // CONFIG_MSG_LOG && CONFIG_MSG_LOG_CRASH_LOG
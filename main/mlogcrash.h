@@ -0,0 +1,23 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Crash log: a small ring buffer in RTC no-init memory that
+// always holds the last log lines. Its contents survive a
+// panic or watchdog reset, so on the next boot they can be
+// shown on the console, saved to the FATFS, and read over
+// BLE, without paying for a flash write on every message.
+//
+// NOTE: mlogCrashWrite() must be called with the msgLog
+// mutex held.
+
+__BEGIN_DECLS
+
+extern bool mlogCrashInit(void);
+extern void mlogCrashWrite(const char *data, size_t len);
+extern size_t mlogCrashGetSaved(const char **data);
+
+__END_DECLS
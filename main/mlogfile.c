@@ -0,0 +1,968 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sdkconfig.h"
+
+#include "app.h"
+#include "esp32.h"
+#include "mlogfile.h"
+#include "mlogrec.h"
+#include "mlogz.h"
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_FAT_FS)
+
+#define SECTOR_SIZE CONFIG_WL_SECTOR_SIZE
+#define SEG_SIZE    (CONFIG_MSG_LOG_SEG_SIZE * 1024)
+#define SEG_COUNT   CONFIG_MSG_LOG_SEG_COUNT
+
+// Segment numbers wrap around at 1000, as they are
+// used as the 3-digit file name extension.
+#define SEG_NUM_MAX 1000
+
+_Static_assert((SEG_COUNT <= MLOG_SEG_MAX_COUNT), "MSG_LOG_SEG_COUNT is too large !");
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+#define SEEK_INTERVAL   (CONFIG_MSG_LOG_SEEK_INTERVAL * 1024)
+
+// Max number of seek index entries in a segment
+#define MAX_SEEK_ENTRIES    ((SEG_SIZE / SEEK_INTERVAL) + 1)
+
+_Static_assert((MAX_SEEK_ENTRIES <= 512), "MSG_LOG_SEEK_INTERVAL is too small for MSG_LOG_SEG_SIZE !");
+#endif
+
+// Handle of the open log segment file
+static FILE *mlogFp;
+
+// Current size of the log segment file, including
+// the data still sitting in the RAM buffer.
+static size_t fileSize;
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// When the log is compressed, the RAM buffer holds the
+// raw data of the current block. It's only compressed
+// into a block appended to the file once it's full, or
+// when the log file is flushed or closed, as the blocks
+// are compressed on their own, and small ones hardly
+// compress. The data already written out is never
+// changed, so the readers can rely on the file offsets.
+#define FILE_BUF_SIZE   CONFIG_MSG_LOG_COMPRESS_BLOCK_SIZE
+#else
+#define FILE_BUF_SIZE   (CONFIG_MSG_LOG_FILE_BUF_SECTORS * SECTOR_SIZE)
+#endif
+
+// RAM buffer used to coalesce the log lines
+static char fileBuf[FILE_BUF_SIZE] __attribute__((aligned(4)));
+static size_t bufLen;   // number of bytes in the buffer
+static size_t bufLimit; // flush when the buffer reaches this many bytes
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Buffer used to build the compressed block
+static uint8_t blockBuf[sizeof (MlogzBlkHdr) + FILE_BUF_SIZE] __attribute__((aligned(4)));
+static size_t blockPos;     // offset of the current block in the file
+
+// Compression stats
+static uint32_t zRawBytes;  // raw length of the blocks written out
+static uint32_t zBytes;     // length of the blocks written out
+static uint64_t zCycles;    // CPU cycles spent compressing
+#endif
+
+// Segment index, saved to the MLOG.IDX file
+static MlogSegIndex segIndex;
+static bool indexLoaded;
+
+// Number of the current segment, and whether it
+// has been added to the index yet. A new segment
+// is added when the first log line is written to
+// it, as that sets its first timestamp.
+static unsigned curSeg;
+static bool curSegIndexed;
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+// Seek index of the current segment. It's kept in
+// RAM and saved to its file when the segment is
+// closed.
+static MlogSeekEntry seekTbl[MAX_SEEK_ENTRIES];
+static unsigned numSeekEntries;
+static size_t nextSeekPos;  // add an entry once the segment reaches this size
+static uint64_t lastTs;     // timestamp of the last line written to the segment
+#endif
+
+// Stats counters
+static uint32_t lineCount;  // number of log lines written
+static uint32_t writeCount; // number of writes to the file
+static uint32_t segCount;   // number of segments created
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Whether the file header record must be written
+// before the next record, and the bitmask of the
+// task IDs whose name has already been written to
+// the current log segment, as of the given task
+// table generation.
+static bool needFileHdr;
+static uint32_t taskNameMask;
+static unsigned taskNameGen;
+
+_Static_assert((MLOG_REC_MAX_TASKS <= 32), "MLOG_REC_MAX_TASKS must fit in taskNameMask !");
+#endif
+
+static void getSegPath(char *path, size_t len, unsigned segNum)
+{
+    snprintf(path, len, "%s.%03u", mlogFilePath, segNum);
+}
+
+static void getIndexPath(char *path, size_t len)
+{
+    snprintf(path, len, "%s.IDX", mlogFilePath);
+}
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+static void getSeekPath(char *path, size_t len, unsigned segNum)
+{
+    snprintf(path, len, "%sS.%03u", mlogFilePath, segNum);
+}
+
+// Set a seek index entry pointing to the end of the
+// current segment.
+static void setSeekEntry(MlogSeekEntry *entry, uint64_t timeStamp)
+{
+    entry->timeStamp = timeStamp;
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    entry->offset = blockPos;
+    entry->skip = bufLen;
+#else
+    entry->offset = fileSize;
+    entry->skip = 0;
+#endif
+    entry->reserved = 0;
+}
+
+// Save the seek index of the current segment. The last
+// entry points to the end of the segment, just past the
+// timestamp of its last line, so that the segment can
+// be reopened (see reopenSegment()).
+static void saveSeekIndex(void)
+{
+    char path[64];
+    FILE *fp;
+
+    if (numSeekEntries == 0) {
+        return;
+    }
+
+    if (numSeekEntries == MAX_SEEK_ENTRIES) {
+        numSeekEntries--;
+    }
+    setSeekEntry(&seekTbl[numSeekEntries++], (lastTs + 1));
+
+    getSeekPath(path, sizeof (path), curSeg);
+    if ((fp = fopen(path, "wb")) != NULL) {
+        fwrite(seekTbl, sizeof (seekTbl[0]), numSeekEntries, fp);
+        fclose(fp);
+    }
+    numSeekEntries = 0;
+}
+
+// Add an entry to the seek index, if the segment has
+// grown enough since the last one. Returns true if an
+// entry was added.
+static bool addSeekEntry(uint64_t timeStamp)
+{
+    MlogSeekEntry *entry;
+
+    if ((fileSize < nextSeekPos) || (numSeekEntries == MAX_SEEK_ENTRIES)) {
+        return false;
+    }
+
+    entry = &seekTbl[numSeekEntries++];
+    setSeekEntry(entry, timeStamp);
+    nextSeekPos = fileSize + SEEK_INTERVAL;
+
+    return true;
+}
+
+// Drop the seek index entries pointing past the end
+// of the segment, after some data was lost.
+static void dropSeekEntries(void)
+{
+    while ((numSeekEntries != 0) && (seekTbl[numSeekEntries - 1].offset >= fileSize)) {
+        numSeekEntries--;
+    }
+    nextSeekPos = fileSize;
+}
+
+// Load the seek index of the segment being reopened.
+// It's only valid if it was saved when the segment was
+// last closed, i.e. its last entry points to the end
+// of the segment.
+static bool loadSeekIndex(size_t endPos)
+{
+    char path[64];
+    FILE *fp;
+
+    getSeekPath(path, sizeof (path), curSeg);
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return false;
+    }
+    numSeekEntries = fread(seekTbl, sizeof (seekTbl[0]), MAX_SEEK_ENTRIES, fp);
+    fclose(fp);
+
+    if ((numSeekEntries == 0) || (seekTbl[numSeekEntries - 1].offset != endPos) ||
+        (seekTbl[numSeekEntries - 1].skip != 0)) {
+        numSeekEntries = 0;
+        return false;
+    }
+    lastTs = seekTbl[numSeekEntries - 1].timeStamp;
+
+    return true;
+}
+#endif
+
+// Save the segment index to its file. This is only
+// done when a segment is added or removed, so it
+// doesn't slow down the appends.
+static void saveIndex(void)
+{
+    char path[64];
+    FILE *fp;
+
+    getIndexPath(path, sizeof (path));
+    if ((fp = fopen(path, "wb")) != NULL) {
+        fwrite(&segIndex, 1, sizeof (segIndex), fp);
+        fclose(fp);
+    }
+}
+
+// Delete all the log segment files found on the
+// FATFS, as well as the index files.
+static void purgeSegments(void)
+{
+    const char *baseName = strrchr(mlogFilePath, '/') + 1;
+    size_t baseLen = strlen(baseName);
+    struct dirent *dirEnt;
+    DIR *dir;
+
+    if ((dir = opendir(CONFIG_FAT_FS_MOUNT_POINT)) != NULL) {
+        while ((dirEnt = readdir(dir)) != NULL) {
+            const char *dName = dirEnt->d_name;
+            // MLOG.NNN, MLOG.IDX, and MLOGS.NNN
+            if ((strncasecmp(dName, baseName, baseLen) == 0) &&
+                ((dName[baseLen] == '.') || ((toupper((int) dName[baseLen]) == 'S') && (dName[baseLen + 1] == '.')))) {
+                char path[64 + sizeof (dirEnt->d_name)];
+                snprintf(path, sizeof (path), "%s/%s", CONFIG_FAT_FS_MOUNT_POINT, dName);
+                unlink(path);
+            }
+        }
+        closedir(dir);
+    }
+}
+
+static void resetIndex(void)
+{
+    memset(&segIndex, 0, sizeof (segIndex));
+    segIndex.magic = MLOG_SEG_INDEX_MAGIC;
+    indexLoaded = true;
+}
+
+static void loadIndex(void)
+{
+    char path[64];
+    FILE *fp;
+    bool valid = false;
+
+    getIndexPath(path, sizeof (path));
+    if ((fp = fopen(path, "rb")) != NULL) {
+        valid = ((fread(&segIndex, 1, sizeof (segIndex), fp) == sizeof (segIndex)) &&
+                 (segIndex.magic == MLOG_SEG_INDEX_MAGIC) &&
+                 (segIndex.firstSeg < SEG_NUM_MAX) &&
+                 (segIndex.numSegs <= MLOG_SEG_MAX_COUNT));
+        fclose(fp);
+    }
+
+    if (!valid) {
+        // There is no way to tell the order of the
+        // segments without the index, so just start
+        // over from scratch.
+        purgeSegments();
+        resetIndex();
+    }
+
+    indexLoaded = true;
+}
+
+// Delete the oldest log segment, as long as it's
+// not the current one.
+static int dropOldestSeg(void)
+{
+    char path[64];
+    unsigned minSegs = (curSegIndexed) ? 2 : 1;
+
+    if (segIndex.numSegs < minSegs) {
+        return -1;
+    }
+
+    getSegPath(path, sizeof (path), segIndex.firstSeg);
+    unlink(path);
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    getSeekPath(path, sizeof (path), segIndex.firstSeg);
+    unlink(path);
+#endif
+
+    segIndex.firstSeg = (segIndex.firstSeg + 1) % SEG_NUM_MAX;
+    segIndex.numSegs--;
+    memmove(&segIndex.firstTs[0], &segIndex.firstTs[1], (segIndex.numSegs * sizeof (segIndex.firstTs[0])));
+    segIndex.firstTs[segIndex.numSegs] = 0;
+    saveIndex();
+
+    return 0;
+}
+
+// Set the buffer limit so that a full buffer ends
+// right at a sector boundary in the file.
+static void setBufLimit(void)
+{
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    // The blocks are not aligned anyway
+    bufLimit = sizeof (fileBuf);
+#else
+    size_t flushedSize = fileSize - bufLen;
+    bufLimit = sizeof (fileBuf) - (flushedSize % SECTOR_SIZE);
+#endif
+}
+
+// Close the current segment and create the next
+// one, deleting the oldest segments if needed.
+static int newSegment(void)
+{
+    char path[64];
+
+    mlogFileClose();
+    curSegIndexed = false;
+
+    // Make room for the new segment
+    while ((segIndex.numSegs >= SEG_COUNT) && (dropOldestSeg() == 0))
+        ;
+
+    curSeg = (segIndex.firstSeg + segIndex.numSegs) % SEG_NUM_MAX;
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    // Drop any stale seek index left behind by an
+    // older segment with the same number.
+    getSeekPath(path, sizeof (path), curSeg);
+    unlink(path);
+    numSeekEntries = 0;
+    nextSeekPos = 0;
+#endif
+
+    getSegPath(path, sizeof (path), curSeg);
+    if ((mlogFp = fopen(path, "w")) == NULL) {
+        return -1;
+    }
+
+    // We do our own buffering...
+    setvbuf(mlogFp, NULL, _IONBF, 0);
+
+    fileSize = 0;
+    bufLen = 0;
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    blockPos = 0;
+#endif
+    setBufLimit();
+#ifdef CONFIG_MSG_LOG_BINARY
+    needFileHdr = true;
+    taskNameMask = 0;
+#endif
+    segCount++;
+
+    return 0;
+}
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Get the offset of the end of the last complete block
+// of a compressed segment, and the length of the raw
+// data of its blocks.
+static long getBlocksEnd(const char *path, long fileLen, long *rawLen)
+{
+    MlogzBlkHdr hdr;
+    long pos = 0;
+    FILE *fp;
+
+    *rawLen = 0;
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    while (((pos + (long) sizeof (hdr)) <= fileLen) && (fseek(fp, pos, SEEK_SET) == 0) &&
+           (fread(&hdr, 1, sizeof (hdr), fp) == sizeof (hdr)) && (hdr.magic == MLOGZ_BLK_MAGIC) &&
+           ((pos + (long) sizeof (hdr) + hdr.dataLen) <= fileLen)) {
+        pos += sizeof (hdr) + hdr.dataLen;
+        *rawLen += hdr.rawLen;
+    }
+    fclose(fp);
+
+    return pos;
+}
+#endif
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Get the offset of the end of the last complete record
+// in the raw data of a binary segment. The segment must
+// start with the file header of the running firmware, as
+// the records refer to its format strings. Returns -1 if
+// it doesn't.
+static long getRecsEnd(const char *path)
+{
+    uint8_t rec[MLOG_REC_MAX_LEN];
+    long pos = 0;
+    FILE *fp;
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    fp = mlogzOpen(path, 0);
+#else
+    fp = fopen(path, "rb");
+#endif
+    if (fp == NULL) {
+        return -1;
+    }
+    while ((fread(rec, 1, 1, fp) == 1) && (rec[0] >= sizeof (MlogRecHdr)) &&
+           (fread(&rec[1], 1, (rec[0] - 1), fp) == (size_t) (rec[0] - 1))) {
+        if ((pos == 0) && !mlogRecFileHdrValid(rec)) {
+            break;
+        }
+        pos += rec[0];
+    }
+    fclose(fp);
+
+    return (pos != 0) ? pos : -1;
+}
+#endif
+
+// Reopen the newest segment, if it's not full, so that
+// the log lines are appended to it, rather than starting
+// a new segment at each boot. A partly written block or
+// record left at the end of the segment by a power loss
+// is cut off. The segment is not reopened if it can't be
+// decoded by the running firmware (binary records), or if
+// its seek index wasn't saved when it was last closed.
+static int reopenSegment(void)
+{
+    char path[64];
+    struct stat fileStat;
+    long endPos;
+
+    if (segIndex.numSegs == 0) {
+        return -1;
+    }
+
+    curSeg = (segIndex.firstSeg + segIndex.numSegs - 1) % SEG_NUM_MAX;
+    getSegPath(path, sizeof (path), curSeg);
+    if ((stat(path, &fileStat) != 0) || (fileStat.st_size >= SEG_SIZE)) {
+        return -1;
+    }
+    endPos = fileStat.st_size;
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    {
+        long rawLen;
+        endPos = getBlocksEnd(path, endPos, &rawLen);
+#ifdef CONFIG_MSG_LOG_BINARY
+        // The last record can't be cut off in the
+        // middle of a compressed block.
+        if (getRecsEnd(path) != rawLen) {
+            return -1;
+        }
+#endif
+    }
+#elif defined(CONFIG_MSG_LOG_BINARY)
+    endPos = getRecsEnd(path);
+#endif
+    if (endPos <= 0) {
+        return -1;
+    }
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    if (!loadSeekIndex(endPos)) {
+        return -1;
+    }
+    nextSeekPos = endPos;
+#endif
+
+    if ((mlogFp = fopen(path, "r+")) == NULL) {
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+        numSeekEntries = 0;
+#endif
+        return -1;
+    }
+    if (((endPos != fileStat.st_size) && (ftruncate(fileno(mlogFp), endPos) != 0)) ||
+        (fseek(mlogFp, endPos, SEEK_SET) != 0)) {
+        fclose(mlogFp);
+        mlogFp = NULL;
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+        numSeekEntries = 0;
+#endif
+        return -1;
+    }
+
+    // We do our own buffering...
+    setvbuf(mlogFp, NULL, _IONBF, 0);
+
+    curSegIndexed = true;
+    fileSize = endPos;
+    bufLen = 0;
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    blockPos = endPos;
+#endif
+    setBufLimit();
+#ifdef CONFIG_MSG_LOG_BINARY
+    // Start over with the file header, and the task
+    // names, as the task IDs are assigned at run time.
+    needFileHdr = true;
+    taskNameMask = 0;
+#endif
+
+    return 0;
+}
+
+// Get the current segment ready to take 'len' more
+// bytes, switching to a new segment if it's full.
+static int prepWrite(size_t len, uint64_t timeStamp)
+{
+    if ((mlogFp == NULL) && (mlogFileOpen() != 0)) {
+        return -1;
+    }
+
+    if ((fileSize != 0) && ((fileSize + len) > SEG_SIZE) && (newSegment() != 0)) {
+        return -1;
+    }
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    // The seek index needs the timestamps to be in order
+    // within a segment, so start a new one if they went
+    // back (e.g. the uptime, after the segment was reopened
+    // at boot).
+    if ((numSeekEntries != 0) && (timeStamp < lastTs) && (newSegment() != 0)) {
+        return -1;
+    }
+    lastTs = timeStamp;
+#endif
+
+    if (!curSegIndexed) {
+        segIndex.firstTs[segIndex.numSegs++] = timeStamp;
+        curSegIndexed = true;
+        saveIndex();
+    }
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    if (addSeekEntry(timeStamp)) {
+#ifdef CONFIG_MSG_LOG_BINARY
+        // Write the task names again, so that the
+        // records can be decoded from this point.
+        taskNameMask = 0;
+#endif
+    }
+#endif
+
+    return 0;
+}
+
+// Append the data to the RAM buffer, writing it out
+// to the file when the buffer is full.
+static int bufWrite(const char *data, size_t len)
+{
+    while (len != 0) {
+        size_t n = bufLimit - bufLen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&fileBuf[bufLen], data, n);
+        bufLen += n;
+        fileSize += n;
+        data += n;
+        len -= n;
+
+        if ((bufLen == bufLimit) && (mlogFileFlush() != 0)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int mlogFileOpen(void)
+{
+    if (!indexLoaded) {
+        loadIndex();
+    }
+
+    // Each time the log file is opened (i.e. at boot)
+    // we carry on with the newest segment, unless it's
+    // full, so that a boot loop doesn't rotate out the
+    // log history.
+    if (reopenSegment() == 0) {
+        return 0;
+    }
+
+    return newSegment();
+}
+
+void mlogFileClose(void)
+{
+    if (mlogFp != NULL) {
+        mlogFileFlush();
+        fclose(mlogFp);
+        mlogFp = NULL;
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+        saveSeekIndex();
+#endif
+    }
+}
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Compress the data in the RAM buffer into a block. The
+// data is stored as is if it doesn't compress. Returns
+// the length of the block.
+static size_t packBlock(uint8_t *block)
+{
+    MlogzBlkHdr *hdr = (MlogzBlkHdr *) block;
+    uint8_t *data = &block[sizeof (*hdr)];
+    int n;
+
+    n = mlogzCompress((const uint8_t *) fileBuf, bufLen, data, (bufLen - 1));
+
+    hdr->magic = MLOGZ_BLK_MAGIC;
+    hdr->reserved = 0;
+    hdr->rawLen = bufLen;
+    if (n < 0) {
+        hdr->method = mzmStored;
+        memcpy(data, fileBuf, bufLen);
+        n = bufLen;
+    } else {
+        hdr->method = mzmLz4;
+    }
+    hdr->dataLen = n;
+
+    return sizeof (*hdr) + n;
+}
+#endif
+
+int mlogFileFlush(void)
+{
+    const char *data = fileBuf;
+    size_t len = bufLen;
+    size_t n = 0;
+    int err = 0;
+
+    if ((mlogFp == NULL) || (bufLen == 0)) {
+        return 0;
+    }
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    // Append the current block
+    {
+        uint32_t startCycles = esp_cpu_get_cycle_count();
+        len = packBlock(blockBuf);
+        zCycles += esp_cpu_get_cycle_count() - startCycles;
+        data = (const char *) blockBuf;
+    }
+#endif
+
+    while ((n += fwrite(&data[n], 1, (len - n), mlogFp)) != len) {
+        // If the FATFS is full, delete the oldest
+        // segment to make room, and try again.
+        if ((errno != ENOSPC) || (dropOldestSeg() != 0)) {
+            err = -1;
+            break;
+        }
+        clearerr(mlogFp);
+    }
+    if ((err == 0) && (fsync(fileno(mlogFp)) != 0)) {
+        err = -1;
+    }
+    writeCount++;
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    if (err != 0) {
+        // The current block is lost. Cut off what
+        // was written of it, so the next block is
+        // appended right after the last complete one.
+        if ((n != 0) && (ftruncate(fileno(mlogFp), blockPos) == 0)) {
+            fseek(mlogFp, blockPos, SEEK_SET);
+        }
+        clearerr(mlogFp);
+    } else {
+        zRawBytes += bufLen;
+        zBytes += len;
+        blockPos += len;
+    }
+    fileSize = blockPos;
+    bufLen = 0;
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    if (err != 0) {
+        dropSeekEntries();
+    }
+#endif
+#else
+    // If the write failed the buffered data
+    // is lost, but there isn't much we can
+    // do about it...
+    if (err != 0) {
+        fileSize -= (bufLen - n);
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+        dropSeekEntries();
+#endif
+    }
+    bufLen = 0;
+    setBufLimit();
+#endif
+
+    return err;
+}
+
+// Periodic flush of the log file. When the log is
+// compressed, the current block is kept in RAM until
+// it's full.
+int mlogFileSync(void)
+{
+#ifdef CONFIG_MSG_LOG_COMPRESS
+    return 0;
+#else
+    return mlogFileFlush();
+#endif
+}
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Get a copy of the data still buffered in RAM, as a
+// block that would be appended to the current segment,
+// so the readers can get the whole log without writing
+// out a partly filled block. The buffer must hold at
+// least MLOG_FILE_TAIL_SIZE bytes. Returns the length
+// of the block, or 0 if there is no data buffered.
+size_t mlogFileGetTail(uint8_t *block)
+{
+    if ((mlogFp == NULL) || (bufLen == 0)) {
+        return 0;
+    }
+
+    return packBlock(block);
+}
+#endif
+
+int mlogFileWrite(const char *data, size_t len, uint64_t timeStamp)
+{
+    if ((prepWrite(len, timeStamp) != 0) || (bufWrite(data, len) != 0)) {
+        return -1;
+    }
+
+    lineCount++;
+
+    return 0;
+}
+
+#ifdef CONFIG_MSG_LOG_BINARY
+int mlogFileWriteRec(const uint8_t *rec, int8_t utcOffset)
+{
+    const MlogRecHdr *hdr = (const MlogRecHdr *) rec;
+    uint8_t metaRec[MLOG_REC_MAX_LEN];
+    int n;
+
+    if (prepWrite(hdr->len, hdr->timeStamp) != 0) {
+        return -1;
+    }
+
+    // A log segment starts with the header record, which
+    // is written again each time the segment is reopened.
+    if (needFileHdr) {
+        n = mlogRecFileHdr(metaRec, utcOffset);
+        if (bufWrite((const char *) metaRec, n) != 0) {
+            return -1;
+        }
+        needFileHdr = false;
+    }
+
+    // The name of a task is written to the segment
+    // the first time one of its records shows up, so
+    // that each segment can be decoded on its own,
+    // and again when its ID was given to a new task.
+    if (taskNameGen != mlogRecTaskTblGen()) {
+        taskNameGen = mlogRecTaskTblGen();
+        taskNameMask = 0;
+    }
+    if ((hdr->taskId < MLOG_REC_MAX_TASKS) && !(taskNameMask & (1 << hdr->taskId))) {
+        n = mlogRecTaskNameRec(metaRec, hdr->taskId);
+        if (bufWrite((const char *) metaRec, n) != 0) {
+            return -1;
+        }
+        taskNameMask |= (1 << hdr->taskId);
+    }
+
+    if (bufWrite((const char *) rec, hdr->len) != 0) {
+        return -1;
+    }
+
+    lineCount++;
+
+    return 0;
+}
+#endif
+
+int mlogFileDelete(void)
+{
+    bool found;
+
+    if (!indexLoaded) {
+        loadIndex();
+    }
+    found = (segIndex.numSegs != 0);
+
+    // The current segment must be closed before it
+    // can be deleted. A new one will be created by
+    // the next call to mlogFileWrite().
+    bufLen = 0;
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+    numSeekEntries = 0;
+#endif
+    mlogFileClose();
+    purgeSegments();
+    resetIndex();
+    curSegIndexed = false;
+
+    if (!found) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return 0;
+}
+
+int mlogFileGetSegPath(unsigned n, char *path, size_t len)
+{
+    if (!indexLoaded) {
+        loadIndex();
+    }
+
+    if (n >= segIndex.numSegs) {
+        return -1;
+    }
+
+    getSegPath(path, len, ((segIndex.firstSeg + n) % SEG_NUM_MAX));
+
+    return 0;
+}
+
+void mlogFileGetIndex(MlogSegIndex *index)
+{
+    if (!indexLoaded) {
+        loadIndex();
+    }
+
+    *index = segIndex;
+}
+
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+// Binary search of the seek index entries of a segment,
+// read from its file, for the last one at or before the
+// given timestamp.
+static bool searchSeekFile(FILE *fp, uint64_t timeStamp, MlogSeekEntry *entry)
+{
+    struct stat fileStat;
+    unsigned lo = 0;
+    unsigned hi;
+    bool found = false;
+
+    if ((fstat(fileno(fp), &fileStat) != 0) || ((fileStat.st_size % sizeof (*entry)) != 0)) {
+        return false;
+    }
+    hi = fileStat.st_size / sizeof (*entry);
+
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        MlogSeekEntry midEntry;
+
+        if ((fseek(fp, (mid * sizeof (midEntry)), SEEK_SET) != 0) ||
+            (fread(&midEntry, 1, sizeof (midEntry), fp) != sizeof (midEntry))) {
+            return false;
+        }
+        if (midEntry.timeStamp <= timeStamp) {
+            *entry = midEntry;
+            found = true;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return found;
+}
+
+// Get the seek index entry of segment 'n' where to start
+// reading the log lines from the given timestamp on. When
+// there is none, e.g. the index of the segment was lost,
+// the entry points to the start of the segment.
+void mlogFileGetSeekEntry(unsigned n, uint64_t timeStamp, MlogSeekEntry *entry)
+{
+    unsigned segNum;
+
+    memset(entry, 0, sizeof (*entry));
+
+    if (!indexLoaded) {
+        loadIndex();
+    }
+
+    if (n >= segIndex.numSegs) {
+        return;
+    }
+    segNum = (segIndex.firstSeg + n) % SEG_NUM_MAX;
+
+    if ((mlogFp != NULL) && curSegIndexed && (segNum == curSeg)) {
+        // The current segment: its index is in RAM
+        unsigned lo = 0;
+        unsigned hi = numSeekEntries;
+
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (seekTbl[mid].timeStamp <= timeStamp) {
+                *entry = seekTbl[mid];
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    } else {
+        char path[64];
+        FILE *fp;
+
+        getSeekPath(path, sizeof (path), segNum);
+        if ((fp = fopen(path, "rb")) != NULL) {
+            if (!searchSeekFile(fp, timeStamp, entry)) {
+                memset(entry, 0, sizeof (*entry));
+            }
+            fclose(fp);
+        }
+    }
+}
+#endif
+
+void mlogFileGetStats(uint32_t *lines, uint32_t *writes, uint32_t *segs)
+{
+    *lines = lineCount;
+    *writes = writeCount;
+    *segs = segCount;
+}
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Get the raw and compressed length of the data written
+// to the log file, and the CPU cycles spent compressing
+// each KB of raw data.
+void mlogFileGetZStats(uint32_t *rawBytes, uint32_t *compBytes, uint32_t *cyclesPerKB)
+{
+    *rawBytes = zRawBytes;
+    *compBytes = zBytes;
+    *cyclesPerKB = (*rawBytes != 0) ? ((zCycles * 1024) / *rawBytes) : 0;
+}
+#endif
+
+#endif  // CONFIG_MSG_LOG && CONFIG_FAT_FS
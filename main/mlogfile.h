@@ -0,0 +1,83 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+#include "mlogz.h"
+#endif
+
+// Log file sink used by msgLog(). The log is stored on the
+// FATFS as a set of size-capped segment files (MLOG.000 ...
+// MLOG.999) and, once the max number of segments is reached,
+// the oldest one is deleted to make room for a new one. The
+// current segment is kept open and the log lines are collected
+// in a RAM buffer, sized in multiples of the wear leveling
+// sector size, so that the flash is written in whole sectors.
+// When the log is compressed, the segments are made of LZ
+// compressed blocks instead (see mlogz.h), and the buffer
+// holds the raw data of the current block until it's full.
+//
+// NOTE: these functions must be called with the msgLog
+// mutex held.
+
+#ifdef CONFIG_MSG_LOG_COMPRESS
+// Size of the buffer passed to mlogFileGetTail()
+#define MLOG_FILE_TAIL_SIZE     (sizeof (MlogzBlkHdr) + CONFIG_MSG_LOG_COMPRESS_BLOCK_SIZE)
+#endif
+
+// Max number of segments
+#define MLOG_SEG_MAX_COUNT      64
+
+#define MLOG_SEG_INDEX_MAGIC    0x5844494D  // "MIDX"
+
+// Segment index, saved to the MLOG.IDX file. It records the
+// timestamp of the first log line in each segment, from the
+// oldest to the newest one.
+typedef struct MlogSegIndex {
+    uint32_t magic;
+    uint16_t firstSeg;  // number of the oldest segment
+    uint16_t numSegs;   // number of segments
+    uint64_t firstTs[MLOG_SEG_MAX_COUNT];
+} MlogSegIndex;
+
+// Seek index entry. The entries of each segment are saved
+// to its MLOGS.NNN file, one every MSG_LOG_SEEK_INTERVAL KB
+// of log data. Each one gives the timestamp of a log line
+// and where it starts in the segment: its offset in the
+// file, or the offset of its block and its position in
+// the raw block data when the log is compressed.
+typedef struct __attribute__((packed)) MlogSeekEntry {
+    uint64_t timeStamp;
+    uint32_t offset;
+    uint16_t skip;      // number of raw bytes to skip from the offset
+    uint16_t reserved;
+} MlogSeekEntry;
+
+__BEGIN_DECLS
+
+extern int mlogFileOpen(void);
+extern void mlogFileClose(void);
+extern int mlogFileWrite(const char *data, size_t len, uint64_t timeStamp);
+extern int mlogFileWriteRec(const uint8_t *rec, int8_t utcOffset);
+extern int mlogFileFlush(void);
+extern int mlogFileSync(void);
+#ifdef CONFIG_MSG_LOG_COMPRESS
+extern size_t mlogFileGetTail(uint8_t *block);
+#endif
+extern int mlogFileDelete(void);
+extern int mlogFileGetSegPath(unsigned n, char *path, size_t len);
+extern void mlogFileGetIndex(MlogSegIndex *index);
+#ifdef CONFIG_MSG_LOG_SEEK_INDEX
+extern void mlogFileGetSeekEntry(unsigned n, uint64_t timeStamp, MlogSeekEntry *entry);
+#endif
+extern void mlogFileGetStats(uint32_t *lines, uint32_t *writes, uint32_t *segs);
+#ifdef CONFIG_MSG_LOG_COMPRESS
+extern void mlogFileGetZStats(uint32_t *rawBytes, uint32_t *compBytes, uint32_t *cyclesPerKB);
+#endif
+
+__END_DECLS
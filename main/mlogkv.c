@@ -0,0 +1,437 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "mlogkv.h"
+
+#ifdef CONFIG_MSG_LOG
+
+// Output buffer. Once something doesn't fit, the
+// buffer is marked as full and nothing else is
+// written to it.
+typedef struct OutBuf {
+    uint8_t *p;
+    uint8_t *end;
+    bool full;
+} OutBuf;
+
+// Input buffer
+typedef struct InBuf {
+    const uint8_t *p;
+    const uint8_t *end;
+} InBuf;
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static void putByte(OutBuf *ob, uint8_t c)
+{
+    if (ob->p < ob->end) {
+        *ob->p++ = c;
+    } else {
+        ob->full = true;
+    }
+}
+
+static void putBytes(OutBuf *ob, const void *data, size_t len)
+{
+    if ((size_t) (ob->end - ob->p) >= len) {
+        memcpy(ob->p, data, len);
+        ob->p += len;
+    } else {
+        ob->full = true;
+    }
+}
+
+static void jsonUint(OutBuf *ob, uint32_t value)
+{
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (n != 0) {
+        putByte(ob, digits[--n]);
+    }
+}
+
+static void jsonInt(OutBuf *ob, int32_t value)
+{
+    if (value < 0) {
+        putByte(ob, '-');
+        jsonUint(ob, -(uint32_t) value);
+    } else {
+        jsonUint(ob, value);
+    }
+}
+
+// Quoted string, with the quotes, backslashes and
+// control characters escaped.
+static void jsonStr(OutBuf *ob, const char *s, size_t len)
+{
+    putByte(ob, '"');
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = s[i];
+        if ((c == '"') || (c == '\\')) {
+            putByte(ob, '\\');
+            putByte(ob, c);
+        } else if (c < 0x20) {
+            putBytes(ob, "\\u00", 4);
+            putByte(ob, hexDigits[c >> 4]);
+            putByte(ob, hexDigits[c & 0x0F]);
+        } else {
+            putByte(ob, c);
+        }
+    }
+    putByte(ob, '"');
+}
+
+static void jsonIp4(OutBuf *ob, const uint8_t *addr)
+{
+    putByte(ob, '"');
+    for (int i = 0; i < 4; i++) {
+        if (i != 0) {
+            putByte(ob, '.');
+        }
+        jsonUint(ob, addr[i]);
+    }
+    putByte(ob, '"');
+}
+
+static void jsonMac(OutBuf *ob, const uint8_t *addr)
+{
+    putByte(ob, '"');
+    for (int i = 0; i < 6; i++) {
+        if (i != 0) {
+            putByte(ob, ':');
+        }
+        putByte(ob, hexDigits[addr[i] >> 4]);
+        putByte(ob, hexDigits[addr[i] & 0x0F]);
+    }
+    putByte(ob, '"');
+}
+
+// Get the address bytes of a field, in the order
+// they are usually displayed.
+static const uint8_t *getAddr(const MlogKV *kv, uint8_t *addrBuf)
+{
+    if (kv->type == mktIp4) {
+        memcpy(addrBuf, &kv->v.u, 4);
+    } else if (kv->type == mktBleAddr) {
+        for (int i = 0; i < 6; i++) {
+            addrBuf[i] = kv->v.p[5 - i];
+        }
+    } else {
+        memcpy(addrBuf, kv->v.p, 6);
+    }
+    return addrBuf;
+}
+
+static void jsonValue(OutBuf *ob, const MlogKV *kv)
+{
+    uint8_t addrBuf[6];
+
+    switch (kv->type) {
+    case mktInt:
+        jsonInt(ob, kv->v.i);
+        break;
+    case mktUint:
+        jsonUint(ob, kv->v.u);
+        break;
+    case mktBool:
+        if (kv->v.b) {
+            putBytes(ob, "true", 4);
+        } else {
+            putBytes(ob, "false", 5);
+        }
+        break;
+    case mktStr:
+        if (kv->v.s != NULL) {
+            jsonStr(ob, kv->v.s, strlen(kv->v.s));
+        } else {
+            putBytes(ob, "null", 4);
+        }
+        break;
+    case mktIp4:
+        jsonIp4(ob, getAddr(kv, addrBuf));
+        break;
+    case mktMac:
+    case mktBleAddr:
+        jsonMac(ob, getAddr(kv, addrBuf));
+        break;
+    default:
+        putBytes(ob, "null", 4);
+        break;
+    }
+}
+
+int mlogKVToJson(char *buf, size_t bufLen, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    // Leave room for the closing brace and
+    // the NUL character.
+    OutBuf ob = { .p = (uint8_t *) buf, .end = (uint8_t *) buf + bufLen - 2 };
+    uint8_t *mark;
+
+    putByte(&ob, '{');
+    mark = ob.p;
+    jsonStr(&ob, MLOG_KV_EVENT_KEY, strlen(MLOG_KV_EVENT_KEY));
+    putByte(&ob, ':');
+    jsonStr(&ob, event, strlen(event));
+
+    for (unsigned i = 0; (i < numKV) && !ob.full; i++) {
+        mark = ob.p;
+        putByte(&ob, ',');
+        jsonStr(&ob, kv[i].key, strlen(kv[i].key));
+        putByte(&ob, ':');
+        jsonValue(&ob, &kv[i]);
+    }
+    if (ob.full) {
+        // Drop the field that didn't fit
+        ob.p = mark;
+    }
+
+    *ob.p++ = '}';
+    *ob.p = '\0';
+
+    return (char *) ob.p - buf;
+}
+
+#ifdef CONFIG_MSG_LOG_BINARY
+// Initial byte and argument of a CBOR data item
+static void cborHead(OutBuf *ob, uint8_t major, uint32_t value)
+{
+    major <<= 5;
+    if (value < 24) {
+        putByte(ob, (major | value));
+    } else if (value <= 0xFF) {
+        putByte(ob, (major | 24));
+        putByte(ob, value);
+    } else if (value <= 0xFFFF) {
+        putByte(ob, (major | 25));
+        putByte(ob, (value >> 8));
+        putByte(ob, value);
+    } else {
+        putByte(ob, (major | 26));
+        putByte(ob, (value >> 24));
+        putByte(ob, (value >> 16));
+        putByte(ob, (value >> 8));
+        putByte(ob, value);
+    }
+}
+
+static void cborStr(OutBuf *ob, const char *s)
+{
+    size_t len = strlen(s);
+    cborHead(ob, 3, len);
+    putBytes(ob, s, len);
+}
+
+static void cborValue(OutBuf *ob, const MlogKV *kv)
+{
+    uint8_t addrBuf[6];
+
+    switch (kv->type) {
+    case mktInt:
+        if (kv->v.i < 0) {
+            cborHead(ob, 1, -(kv->v.i + 1));
+        } else {
+            cborHead(ob, 0, kv->v.i);
+        }
+        break;
+    case mktUint:
+        cborHead(ob, 0, kv->v.u);
+        break;
+    case mktBool:
+        putByte(ob, (kv->v.b) ? 0xF5 : 0xF4);
+        break;
+    case mktStr:
+        if (kv->v.s != NULL) {
+            cborStr(ob, kv->v.s);
+        } else {
+            putByte(ob, 0xF6);
+        }
+        break;
+    case mktIp4:
+        cborHead(ob, 6, MLOG_KV_TAG_IP4);
+        cborHead(ob, 2, 4);
+        putBytes(ob, getAddr(kv, addrBuf), 4);
+        break;
+    case mktMac:
+    case mktBleAddr:
+        cborHead(ob, 6, MLOG_KV_TAG_MAC);
+        cborHead(ob, 2, 6);
+        putBytes(ob, getAddr(kv, addrBuf), 6);
+        break;
+    default:
+        putByte(ob, 0xF6);
+        break;
+    }
+}
+
+int mlogKVToCbor(uint8_t *buf, size_t bufLen, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    // Leave room for the "break" byte
+    OutBuf ob = { .p = buf, .end = buf + bufLen - 1 };
+    uint8_t *mark;
+
+    // Indefinite-length map
+    putByte(&ob, 0xBF);
+    mark = ob.p;
+    cborStr(&ob, MLOG_KV_EVENT_KEY);
+    cborStr(&ob, event);
+
+    for (unsigned i = 0; (i < numKV) && !ob.full; i++) {
+        mark = ob.p;
+        cborStr(&ob, kv[i].key);
+        cborValue(&ob, &kv[i]);
+    }
+    if (ob.full) {
+        // Drop the field that didn't fit
+        ob.p = mark;
+    }
+
+    *ob.p++ = 0xFF;
+
+    return ob.p - buf;
+}
+
+// Get the initial byte and argument of a CBOR data
+// item. Only the encodings produced by mlogKVToCbor()
+// are supported.
+static bool cborGetHead(InBuf *ib, uint8_t *major, uint32_t *value)
+{
+    uint8_t info;
+    int n;
+
+    if (ib->p >= ib->end) {
+        return false;
+    }
+    *major = *ib->p >> 5;
+    info = *ib->p++ & 0x1F;
+
+    if (info < 24) {
+        *value = info;
+        return true;
+    }
+    if (info > 26) {
+        return false;
+    }
+    n = 1 << (info - 24);
+    if ((ib->end - ib->p) < n) {
+        return false;
+    }
+    *value = 0;
+    while (n-- != 0) {
+        *value = (*value << 8) | *ib->p++;
+    }
+    return true;
+}
+
+// Render a CBOR text string
+static bool cborGetStr(InBuf *ib, OutBuf *ob)
+{
+    uint8_t major;
+    uint32_t len;
+
+    if (!cborGetHead(ib, &major, &len) || (major != 3) || (len > (uint32_t) (ib->end - ib->p))) {
+        return false;
+    }
+    jsonStr(ob, (const char *) ib->p, len);
+    ib->p += len;
+    return true;
+}
+
+static bool cborGetValue(InBuf *ib, OutBuf *ob)
+{
+    const uint8_t *start = ib->p;
+    uint8_t major;
+    uint32_t value;
+
+    if (!cborGetHead(ib, &major, &value)) {
+        return false;
+    }
+
+    switch (major) {
+    case 0:
+        jsonUint(ob, value);
+        return true;
+    case 1:
+        if (value > INT32_MAX) {
+            return false;
+        }
+        jsonInt(ob, (-1 - (int32_t) value));
+        return true;
+    case 3:
+        ib->p = start;
+        return cborGetStr(ib, ob);
+    case 6: {
+        uint32_t tag = value;
+        if (!cborGetHead(ib, &major, &value) || (major != 2) || (value > (uint32_t) (ib->end - ib->p))) {
+            return false;
+        }
+        if ((tag == MLOG_KV_TAG_IP4) && (value == 4)) {
+            jsonIp4(ob, ib->p);
+        } else if ((tag == MLOG_KV_TAG_MAC) && (value == 6)) {
+            jsonMac(ob, ib->p);
+        } else {
+            return false;
+        }
+        ib->p += value;
+        return true;
+    }
+    case 7:
+        if (value == 20) {
+            putBytes(ob, "false", 5);
+        } else if (value == 21) {
+            putBytes(ob, "true", 4);
+        } else if (value == 22) {
+            putBytes(ob, "null", 4);
+        } else {
+            return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Render the CBOR map of a binary log record as a
+// JSON object.
+int mlogKVCborToJson(const uint8_t *cbor, size_t cborLen, char *buf, size_t bufLen)
+{
+    InBuf ib = { .p = cbor, .end = cbor + cborLen };
+    OutBuf ob = { .p = (uint8_t *) buf, .end = (uint8_t *) buf + bufLen - 2 };
+    bool first = true;
+
+    putByte(&ob, '{');
+    if ((ib.p < ib.end) && (*ib.p == 0xBF)) {
+        ib.p++;
+        while ((ib.p < ib.end) && (*ib.p != 0xFF)) {
+            uint8_t *mark = ob.p;
+            bool valid;
+
+            if (!first) {
+                putByte(&ob, ',');
+            }
+            valid = cborGetStr(&ib, &ob);
+            putByte(&ob, ':');
+            if (!valid || !cborGetValue(&ib, &ob) || ob.full) {
+                // Corrupted, or doesn't fit
+                ob.p = mark;
+                break;
+            }
+            first = false;
+        }
+    }
+
+    *ob.p++ = '}';
+    *ob.p = '\0';
+
+    return (char *) ob.p - buf;
+}
+#endif
+
+#endif  // CONFIG_MSG_LOG
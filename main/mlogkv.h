@@ -0,0 +1,33 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mlog.h"
+
+// Encoders of the key/value fields logged by mlogKV(). The
+// fields are encoded as a JSON object, with the event name
+// as the "event" member, or as the equivalent CBOR map to be
+// stored in a binary log record. The values are encoded
+// directly, without going through snprintf(). When a field
+// doesn't fit in the buffer, it's dropped along with the
+// ones that follow, so the result is always well formed.
+//
+// The IPv4 and MAC addresses are encoded in CBOR as byte
+// strings tagged as such (RFC 9164 and RFC 9542), and as
+// strings in their usual text form in JSON.
+
+#define MLOG_KV_EVENT_KEY   "event"
+
+// CBOR tags
+#define MLOG_KV_TAG_IP4     52
+#define MLOG_KV_TAG_MAC     48
+
+__BEGIN_DECLS
+
+extern int mlogKVToJson(char *buf, size_t bufLen, const char *event, const MlogKV *kv, unsigned numKV);
+extern int mlogKVToCbor(uint8_t *buf, size_t bufLen, const char *event, const MlogKV *kv, unsigned numKV);
+extern int mlogKVCborToJson(const uint8_t *cbor, size_t cborLen, char *buf, size_t bufLen);
+
+__END_DECLS
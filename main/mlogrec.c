@@ -0,0 +1,511 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "esp32.h"
+#include "esp_memory_utils.h"
+#include "mlogkv.h"
+#include "mlogrec.h"
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_MSG_LOG_BINARY)
+
+// Conversion specification parsed from a printf-style
+// format string.
+typedef struct FmtSpec {
+    const char *start;  // points to the '%' character
+    const char *end;    // points past the conversion character
+    char conv;          // conversion character
+    uint8_t argSize;    // size of the argument: 4 or 8 bytes
+    bool lenLong;       // 'l' length modifier
+    bool starWidth;     // width given as an argument
+    bool starPrec;      // precision given as an argument
+} FmtSpec;
+
+// Table of interned task names, indexed by task ID. The
+// slots are looked up without holding the lock. Once the
+// table is full, the slot of a task that is gone is given
+// to the next new task, and the generation count of the
+// table is bumped, so that the sinks know to write the
+// task names again.
+static TaskHandle_t taskHandleTbl[MLOG_REC_MAX_TASKS];
+static char taskNameTbl[MLOG_REC_MAX_TASKS][configMAX_TASK_NAME_LEN];
+static atomic_uint numTasks;
+static atomic_uint taskTblGen;
+static portMUX_TYPE taskTblLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Parse the conversion specification that starts at
+// the given '%' character.
+static const char *parseSpec(const char *fmt, FmtSpec *spec)
+{
+    const char *p = fmt + 1;
+
+    memset(spec, 0, sizeof (*spec));
+    spec->start = fmt;
+    spec->argSize = 4;
+
+    // Flags
+    while ((*p == '-') || (*p == '+') || (*p == ' ') || (*p == '#') || (*p == '0')) {
+        p++;
+    }
+
+    // Width
+    if (*p == '*') {
+        spec->starWidth = true;
+        p++;
+    } else {
+        while ((*p >= '0') && (*p <= '9')) {
+            p++;
+        }
+    }
+
+    // Precision
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->starPrec = true;
+            p++;
+        } else {
+            while ((*p >= '0') && (*p <= '9')) {
+                p++;
+            }
+        }
+    }
+
+    // Length modifier
+    if ((p[0] == 'h') && (p[1] == 'h')) {
+        p += 2;
+    } else if ((p[0] == 'l') && (p[1] == 'l')) {
+        spec->argSize = 8;
+        p += 2;
+    } else if ((*p == 'j') || (*p == 'q')) {
+        spec->argSize = 8;
+        p++;
+    } else if (*p == 'l') {
+        spec->lenLong = true;
+        p++;
+    } else if ((*p == 'h') || (*p == 'z') || (*p == 't') || (*p == 'L')) {
+        p++;
+    }
+
+    // Conversion
+    spec->conv = *p;
+    if ((spec->conv == 'f') || (spec->conv == 'F') || (spec->conv == 'e') || (spec->conv == 'E') ||
+        (spec->conv == 'g') || (spec->conv == 'G') || (spec->conv == 'a') || (spec->conv == 'A')) {
+        spec->argSize = 8;
+    }
+    if (*p != '\0') {
+        p++;
+    }
+    spec->end = p;
+
+    return p;
+}
+
+static inline uint8_t *putU32(uint8_t *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof (value));
+    return (p + sizeof (value));
+}
+
+static inline uint8_t *putU64(uint8_t *p, uint64_t value)
+{
+    memcpy(p, &value, sizeof (value));
+    return (p + sizeof (value));
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof (value));
+    return value;
+}
+
+static inline uint64_t getU64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof (value));
+    return value;
+}
+
+// Find a slot of the full task table whose task is gone.
+// It can't be called with the lock held, as looking up
+// a task suspends the scheduler.
+static int findStaleSlot(TaskHandle_t *staleHandle)
+{
+    char name[configMAX_TASK_NAME_LEN];
+
+    for (unsigned i = 0; i < MLOG_REC_MAX_TASKS; i++) {
+        *staleHandle = taskHandleTbl[i];
+        memcpy(name, taskNameTbl[i], sizeof (name));
+        name[sizeof (name) - 1] = '\0';
+        if (xTaskGetHandle(name) != *staleHandle) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Get the ID of the calling task, adding its
+// name to the table if needed.
+static uint8_t getTaskId(void)
+{
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+    const char *name = pcTaskGetName(handle);
+    unsigned n = atomic_load_explicit(&numTasks, memory_order_acquire);
+    TaskHandle_t staleHandle = NULL;
+    uint8_t taskId = MLOG_REC_NO_TASK;
+    int slot = -1;
+
+    // The tasks are looked up by handle. As the handle of
+    // a task that is gone can be reused by a new task, the
+    // name of the matching slot is checked as well.
+    for (unsigned i = 0; i < n; i++) {
+        if (taskHandleTbl[i] == handle) {
+            if (strncmp(taskNameTbl[i], name, configMAX_TASK_NAME_LEN) == 0) {
+                return i;
+            }
+            staleHandle = handle;
+            slot = i;
+            break;
+        }
+    }
+
+    if ((slot < 0) && (n == MLOG_REC_MAX_TASKS)) {
+        slot = findStaleSlot(&staleHandle);
+    }
+
+    portENTER_CRITICAL(&taskTblLock);
+    n = atomic_load_explicit(&numTasks, memory_order_relaxed);
+    if ((slot < 0) && (n < MLOG_REC_MAX_TASKS)) {
+        taskHandleTbl[n] = handle;
+        strncpy(taskNameTbl[n], name, (configMAX_TASK_NAME_LEN - 1));
+        atomic_store_explicit(&numTasks, (n + 1), memory_order_release);
+        taskId = n;
+    } else if ((slot >= 0) && (taskHandleTbl[slot] == staleHandle)) {
+        // Take over the slot, unless another new
+        // task got there first.
+        taskHandleTbl[slot] = NULL;
+        atomic_thread_fence(memory_order_release);
+        strncpy(taskNameTbl[slot], name, (configMAX_TASK_NAME_LEN - 1));
+        atomic_thread_fence(memory_order_release);
+        taskHandleTbl[slot] = handle;
+        atomic_fetch_add_explicit(&taskTblGen, 1, memory_order_release);
+        taskId = slot;
+    }
+    portEXIT_CRITICAL(&taskTblLock);
+
+    return taskId;
+}
+
+// Fill in the common fields of the record header
+static void fillHdr(MlogRecHdr *hdr, uint64_t timeStamp, int logLevel, const char *funcName, int lineNum, int errorNum)
+{
+    hdr->logLevel = (logLevel & MLOG_REC_LEVEL_MASK) | ((esp_cpu_get_core_id() != 0) ? MLOG_REC_CORE_BIT : 0);
+    hdr->taskId = getTaskId();
+    hdr->errorNum = (errorNum < 256) ? errorNum : 255;
+    hdr->lineNum = lineNum;
+    hdr->funcId = (uint32_t) (uintptr_t) funcName;
+    hdr->timeStamp = timeStamp;
+}
+
+int mlogRecEncode(uint8_t *rec, uint64_t timeStamp, int logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, va_list ap)
+{
+    MlogRecHdr hdr;
+    uint8_t *p = rec + sizeof (hdr);
+    uint8_t *end = rec + MLOG_REC_MAX_LEN;
+
+    fillHdr(&hdr, timeStamp, logLevel, funcName, lineNum, errorNum);
+
+    if (!esp_ptr_in_drom(fmt)) {
+        // The format string is not in flash, so we
+        // can't refer to it later on. Just format the
+        // text now and store it inline.
+        int n = vsnprintf((char *) p, (end - p), fmt, ap);
+        hdr.fmtId = MLOG_REC_FMT_TEXT;
+        p += ((n < (end - p)) ? n : ((end - p) - 1)) + 1;
+    } else {
+        hdr.fmtId = (uint32_t) (uintptr_t) fmt;
+
+        while (*fmt != '\0') {
+            FmtSpec spec;
+
+            if (*fmt != '%') {
+                fmt++;
+                continue;
+            }
+
+            fmt = parseSpec(fmt, &spec);
+            if (spec.conv == '%') {
+                continue;
+            }
+
+            // Make sure we have room for the worst case: the
+            // two '*' args plus an 8-byte value.
+            if ((end - p) < 16) {
+                break;
+            }
+
+            if (spec.starWidth) {
+                p = putU32(p, va_arg(ap, int));
+            }
+            if (spec.starPrec) {
+                p = putU32(p, va_arg(ap, int));
+            }
+
+            if (spec.conv == 's') {
+                const char *str = va_arg(ap, const char *);
+                if (str == NULL) {
+                    str = "(null)";
+                }
+                if (esp_ptr_in_drom(str)) {
+                    // String literal: just store its address
+                    *p++ = MLOG_REC_STR_ADDR;
+                    p = putU32(p, (uint32_t) (uintptr_t) str);
+                } else {
+                    // Copy the string, truncating it if
+                    // needed.
+                    size_t maxLen = (end - p) - 2;
+                    size_t len = strnlen(str, maxLen);
+                    *p++ = MLOG_REC_STR_INLINE;
+                    memcpy(p, str, len);
+                    p += len;
+                    *p++ = '\0';
+                }
+            } else if (spec.conv == 'n') {
+                (void) va_arg(ap, void *);
+            } else if (spec.argSize == 8) {
+                if (spec.conv == 'd' || spec.conv == 'i' || spec.conv == 'u' || spec.conv == 'x' || spec.conv == 'X' || spec.conv == 'o') {
+                    p = putU64(p, va_arg(ap, long long));
+                } else {
+                    double value = va_arg(ap, double);
+                    uint64_t bits;
+                    memcpy(&bits, &value, sizeof (bits));
+                    p = putU64(p, bits);
+                }
+            } else if (spec.conv == 'p') {
+                p = putU32(p, (uint32_t) (uintptr_t) va_arg(ap, void *));
+            } else if (spec.lenLong) {
+                p = putU32(p, va_arg(ap, long));
+            } else {
+                p = putU32(p, va_arg(ap, int));
+            }
+        }
+    }
+
+    hdr.len = p - rec;
+    memcpy(rec, &hdr, sizeof (hdr));
+
+    return hdr.len;
+}
+
+// Encode a record with the event name and key/value
+// fields of mlogKV(), as a CBOR map.
+int mlogRecEncodeKV(uint8_t *rec, uint64_t timeStamp, int logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV)
+{
+    MlogRecHdr hdr;
+    uint8_t *p = rec + sizeof (hdr);
+
+    fillHdr(&hdr, timeStamp, logLevel, funcName, lineNum, errorNum);
+    hdr.fmtId = MLOG_REC_FMT_KV;
+    p += mlogKVToCbor(p, (MLOG_REC_MAX_LEN - sizeof (hdr)), event, kv, numKV);
+
+    hdr.len = p - rec;
+    memcpy(rec, &hdr, sizeof (hdr));
+
+    return hdr.len;
+}
+
+int mlogRecFmtText(const uint8_t *rec, char *buf, size_t bufLen)
+{
+    MlogRecHdr hdr;
+    const uint8_t *p = rec + sizeof (hdr);
+    const uint8_t *end;
+    const char *fmt;
+    size_t n = 0;
+
+    memcpy(&hdr, rec, sizeof (hdr));
+    end = rec + hdr.len;
+
+    if (hdr.fmtId == MLOG_REC_FMT_TEXT) {
+        // Inline text
+        return snprintf(buf, bufLen, "%s", (const char *) p);
+    }
+    if (hdr.fmtId == MLOG_REC_FMT_KV) {
+        // Key/value fields
+        return mlogKVCborToJson(p, (end - p), buf, bufLen);
+    }
+
+    // The record may have been read back from flash, so
+    // make sure the addresses it holds do point to strings
+    // in this firmware image before using them.
+    fmt = (const char *) (uintptr_t) hdr.fmtId;
+    if (!esp_ptr_in_drom(fmt)) {
+        return snprintf(buf, bufLen, "<?>");
+    }
+
+    while ((*fmt != '\0') && (n < (bufLen - 1))) {
+        FmtSpec spec;
+        char specBuf[24];
+        size_t specLen = 0;
+        int len;
+
+        if (*fmt != '%') {
+            buf[n++] = *fmt++;
+            continue;
+        }
+
+        fmt = parseSpec(fmt, &spec);
+        if (spec.conv == '%') {
+            buf[n++] = '%';
+            continue;
+        }
+
+        // Rebuild the conversion specification,
+        // replacing any '*' with the actual value.
+        for (const char *s = spec.start; (s < spec.end) && (specLen < (sizeof (specBuf) - 12)); s++) {
+            if (*s == '*') {
+                if ((end - p) < 4) {
+                    break;
+                }
+                specLen += snprintf(&specBuf[specLen], (sizeof (specBuf) - specLen), "%d", (int) getU32(p));
+                p += 4;
+            } else {
+                specBuf[specLen++] = *s;
+            }
+        }
+        specBuf[specLen] = '\0';
+
+        if (spec.conv == 's') {
+            const char *str = "<?>";
+            if ((end - p) >= 5 && (*p == MLOG_REC_STR_ADDR)) {
+                str = (const char *) (uintptr_t) getU32(p + 1);
+                if (!esp_ptr_in_drom(str)) {
+                    str = "<?>";
+                }
+                p += 5;
+            } else if ((end - p) >= 2 && (*p == MLOG_REC_STR_INLINE)) {
+                str = (const char *) (p + 1);
+                p += strnlen(str, (end - p) - 1) + 2;
+            } else {
+                p = end;
+            }
+            len = snprintf(&buf[n], (bufLen - n), specBuf, str);
+        } else if (spec.conv == 'n') {
+            len = 0;
+        } else if ((end - p) < spec.argSize) {
+            // Missing argument: the record was truncated
+            len = snprintf(&buf[n], (bufLen - n), "<?>");
+            p = end;
+        } else if (spec.argSize == 8) {
+            uint64_t bits = getU64(p);
+            p += 8;
+            if (spec.conv == 'd' || spec.conv == 'i' || spec.conv == 'u' || spec.conv == 'x' || spec.conv == 'X' || spec.conv == 'o') {
+                len = snprintf(&buf[n], (bufLen - n), specBuf, (long long) bits);
+            } else {
+                double value;
+                memcpy(&value, &bits, sizeof (value));
+                len = snprintf(&buf[n], (bufLen - n), specBuf, value);
+            }
+        } else {
+            uint32_t value = getU32(p);
+            p += 4;
+            if (spec.conv == 'p') {
+                len = snprintf(&buf[n], (bufLen - n), specBuf, (void *) (uintptr_t) value);
+            } else if (spec.lenLong) {
+                len = snprintf(&buf[n], (bufLen - n), specBuf, (long) value);
+            } else {
+                len = snprintf(&buf[n], (bufLen - n), specBuf, (int) value);
+            }
+        }
+
+        if (len > 0) {
+            n += len;
+        }
+    }
+
+    if (n >= bufLen) {
+        n = bufLen - 1;
+    }
+    buf[n] = '\0';
+
+    return n;
+}
+
+int mlogRecFileHdr(uint8_t *rec, int8_t utcOffset)
+{
+    MlogRecHdr hdr = {0};
+    uint8_t *p = rec + sizeof (hdr);
+
+    hdr.logLevel = mrtFileHdr;
+    hdr.taskId = MLOG_REC_NO_TASK;
+    memcpy(p, "MLOG", 4);
+    p += 4;
+    *p++ = MLOG_REC_VERSION;
+#if CONFIG_MSG_LOG_TS_TOD_USEC || CONFIG_MSG_LOG_TS_TOD_MSEC
+    *p++ = MLOG_REC_TS_TOD;
+#else
+    *p++ = MLOG_REC_TS_UPTIME;
+#endif
+    *p++ = utcOffset;
+    memcpy(p, esp_app_get_description()->app_elf_sha256, 8);
+    p += 8;
+
+    hdr.len = p - rec;
+    memcpy(rec, &hdr, sizeof (hdr));
+
+    return hdr.len;
+}
+
+bool mlogRecFileHdrValid(const uint8_t *rec)
+{
+    const MlogRecHdr *hdr = (const MlogRecHdr *) rec;
+    const uint8_t *p = rec + sizeof (*hdr);
+
+    // Check the magic number, and whether the file
+    // was written by the firmware that is running
+    // now, as the records refer to its format strings.
+    return ((hdr->logLevel == mrtFileHdr) && (hdr->len >= (sizeof (*hdr) + 15)) &&
+            (memcmp(p, "MLOG", 4) == 0) && (p[4] == MLOG_REC_VERSION) &&
+            (memcmp(&p[7], esp_app_get_description()->app_elf_sha256, 8) == 0));
+}
+
+int mlogRecTaskNameRec(uint8_t *rec, uint8_t taskId)
+{
+    MlogRecHdr hdr = {0};
+    uint8_t *p = rec + sizeof (hdr);
+    const char *name = mlogRecTaskName(taskId);
+    size_t len = strlen(name) + 1;
+
+    hdr.logLevel = mrtTaskName;
+    hdr.taskId = taskId;
+    memcpy(p, name, len);
+    p += len;
+
+    hdr.len = p - rec;
+    memcpy(rec, &hdr, sizeof (hdr));
+
+    return hdr.len;
+}
+
+// Get the generation count of the task table, which
+// changes each time a task ID is given to a new task.
+unsigned mlogRecTaskTblGen(void)
+{
+    return atomic_load_explicit(&taskTblGen, memory_order_acquire);
+}
+
+const char *mlogRecTaskName(uint8_t taskId)
+{
+    if (taskId < atomic_load_explicit(&numTasks, memory_order_acquire)) {
+        return taskNameTbl[taskId];
+    } else if (taskId == MLOG_REC_ISR_TASK) {
+        return "ISR";
+    }
+
+    return "???";
+}
+
+#endif  // CONFIG_MSG_LOG && CONFIG_MSG_LOG_BINARY
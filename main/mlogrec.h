@@ -0,0 +1,79 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "mlog.h"
+
+// Binary log records. Instead of formatting the message text,
+// the caller of msgLog() stores the address of the format string,
+// followed by the raw values of its arguments. The text is only
+// formatted when the record is dumped, either on the device
+// itself or on the host by the mlogdec.py tool.
+//
+// All multi-byte values are stored in little-endian order.
+
+// Max length of a binary log record
+#define MLOG_REC_MAX_LEN    255
+
+// Binary log record header
+typedef struct __attribute__((packed)) MlogRecHdr {
+    uint8_t len;        // +00  UINT8: Record length (header + args)
+    uint8_t logLevel;   // +01  UINT8: bits 0-3: LogLevel or MlogRecType; bit 7: CPU core
+    uint8_t taskId;     // +02  UINT8: Task ID (see mrtTaskName)
+    uint8_t errorNum;   // +03  UINT8: errno value
+    uint16_t lineNum;   // +04  UINT16: Line number
+    uint32_t fmtId;     // +06  UINT32: Address of the format string, or MLOG_REC_FMT_xxx
+    uint32_t funcId;    // +10  UINT32: Address of the function name string
+    uint64_t timeStamp; // +14  UINT64: Timestamp [in usec]
+} MlogRecHdr;           // +22
+
+// Special record types, stored in the logLevel
+// field of the header.
+typedef enum MlogRecType {
+    mrtFileHdr = 0x0E,      // {CHAR[4]: "MLOG", UINT8: version, UINT8: timestamp type, INT8: UTC offset, UINT8[8]: app ELF SHA256}
+    mrtTaskName = 0x0F,     // {CHAR[]: task name}
+} MlogRecType;
+
+#define MLOG_REC_LEVEL_MASK 0x0F
+#define MLOG_REC_CORE_BIT   0x80
+
+#define MLOG_REC_VERSION    2
+
+// Special values of the fmtId field, which can't be
+// the address of a format string.
+#define MLOG_REC_FMT_TEXT   0       // {CHAR[]: inline text}
+#define MLOG_REC_FMT_KV     1       // {CBOR map: mlogKV() event and fields}
+
+// Timestamp type, stored in the file header record
+#define MLOG_REC_TS_UPTIME  0
+#define MLOG_REC_TS_TOD     1
+
+// Max number of task names that can be interned. Once
+// they're all taken, the IDs of the tasks that are gone
+// are given to the new tasks.
+#define MLOG_REC_MAX_TASKS  32
+#define MLOG_REC_NO_TASK    0xFF
+#define MLOG_REC_ISR_TASK   0xFE    // logged by an ISR
+
+// String argument tags
+#define MLOG_REC_STR_INLINE 0x00    // NUL-terminated string follows
+#define MLOG_REC_STR_ADDR   0x01    // UINT32 address of the string follows
+
+__BEGIN_DECLS
+
+extern int mlogRecEncode(uint8_t *rec, uint64_t timeStamp, int logLevel, const char *funcName, int lineNum, int errorNum, const char *fmt, va_list ap);
+extern int mlogRecEncodeKV(uint8_t *rec, uint64_t timeStamp, int logLevel, const char *funcName, int lineNum, int errorNum, const char *event, const MlogKV *kv, unsigned numKV);
+extern int mlogRecFmtText(const uint8_t *rec, char *buf, size_t bufLen);
+extern int mlogRecFileHdr(uint8_t *rec, int8_t utcOffset);
+extern bool mlogRecFileHdrValid(const uint8_t *rec);
+extern int mlogRecTaskNameRec(uint8_t *rec, uint8_t taskId);
+extern const char *mlogRecTaskName(uint8_t taskId);
+extern unsigned mlogRecTaskTblGen(void);
+
+__END_DECLS
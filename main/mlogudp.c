@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+#include "esp32.h"
+#include "mlog.h"
+#include "mlogudp.h"
+
+#define MLOG_MODULE lmMlog
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_MSG_LOG_SYSLOG)
+
+#define BACKLOG_SIZE    CONFIG_MSG_LOG_SYSLOG_BACKLOG
+#define MAX_DGRAM_LEN   CONFIG_MSG_LOG_SYSLOG_MTU
+
+// How long to wait before trying again to send
+// a datagram that failed [in msec].
+#define RETRY_DELAY     1000
+
+// Syslog facility: local0
+#define FACILITY        16
+
+_Static_assert(((BACKLOG_SIZE & (BACKLOG_SIZE - 1)) == 0), "MSG_LOG_SYSLOG_BACKLOG must be a power of 2 !");
+_Static_assert((BACKLOG_SIZE >= (2 * MAX_DGRAM_LEN)), "MSG_LOG_SYSLOG_BACKLOG is too small !");
+
+// Syslog severity of each log level
+static const uint8_t severity[] = {
+    [none] = 7,
+    [info] = 6,
+    [trace] = 7,
+    [debug] = 7,
+    [warning] = 4,
+    [error] = 3,
+    [errNo] = 3,
+    [fatal] = 2,
+};
+
+// Backlog of the messages to be sent, each one ending
+// with a newline. The positions are free running byte
+// counters.
+static char backlog[BACKLOG_SIZE];
+static uint32_t head;   // next byte to be written
+static uint32_t tail;   // next byte to be sent
+static SemaphoreHandle_t backlogMutex;
+
+static TaskHandle_t udpTaskHandle;
+static volatile bool netUp;
+static char hostName[16];
+static const char *appName;
+static char msgBuf[MAX_DGRAM_LEN];      // message being queued
+static char dgramBuf[MAX_DGRAM_LEN];    // datagram being sent
+static MlogUdpStats udpStats;
+
+// Queue the message, dropping the oldest ones if
+// there is not enough room for it.
+static void queueMsg(const char *msg, size_t len)
+{
+    uint32_t pending;
+
+    xSemaphoreTake(backlogMutex, portMAX_DELAY);
+    while ((BACKLOG_SIZE - (head - tail)) < len) {
+        while (backlog[tail++ % BACKLOG_SIZE] != '\n')
+            ;
+        udpStats.dropped++;
+    }
+    for (size_t i = 0; i < len; i++) {
+        backlog[(head + i) % BACKLOG_SIZE] = msg[i];
+    }
+    head += len;
+    pending = head - tail;
+    xSemaphoreGive(backlogMutex);
+
+    // Wake up the task once there is enough
+    // data to fill a datagram.
+    if (pending >= MAX_DGRAM_LEN) {
+        xTaskNotifyGive(udpTaskHandle);
+    }
+}
+
+void mlogUdpWrite(const char *data, size_t len, uint64_t timeStamp, LogLevel logLevel)
+{
+    time_t t = timeStamp / 1000000;
+    struct tm tm;
+    char tsBuf[32];
+    size_t n;
+
+    // Skip the newline at the end of the log line
+    if ((len != 0) && (data[len - 1] == '\n')) {
+        len--;
+    }
+
+    // Until the date & time is set by NTP the
+    // collector is left to timestamp the message.
+    gmtime_r(&t, &tm);
+    if (tm.tm_year < (2020 - 1900)) {
+        strcpy(tsBuf, "-");
+    } else {
+        snprintf(tsBuf, sizeof (tsBuf), "%04d-%02d-%02dT%02d:%02d:%02d.%06luZ",
+                 (tm.tm_year + 1900), (tm.tm_mon + 1), tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 (unsigned long) (timeStamp % 1000000));
+    }
+
+    // RFC 5424 header: <PRI>VERSION TIMESTAMP HOSTNAME
+    // APP-NAME PROCID MSGID STRUCTURED-DATA
+    n = snprintf(msgBuf, sizeof (msgBuf), "<%u>1 %s %s %s - - - ", ((FACILITY * 8) + severity[logLevel]), tsBuf, hostName, appName);
+
+    // The newlines within the message text, if any,
+    // would break the framing of the messages.
+    if (len > (sizeof (msgBuf) - n - 1)) {
+        len = sizeof (msgBuf) - n - 1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        msgBuf[n++] = (data[i] != '\n') ? data[i] : ' ';
+    }
+    msgBuf[n++] = '\n';
+
+    queueMsg(msgBuf, n);
+}
+
+int mlogUdpFlush(void)
+{
+    // Send whatever is in the backlog
+    if (head != tail) {
+        xTaskNotifyGive(udpTaskHandle);
+    }
+    return 0;
+}
+
+// Called when the network goes up or down
+void mlogUdpSetNetState(bool up)
+{
+    netUp = up;
+    if (up && (udpTaskHandle != NULL)) {
+        xTaskNotifyGive(udpTaskHandle);
+    }
+}
+
+void mlogUdpGetStats(MlogUdpStats *stats)
+{
+    *stats = udpStats;
+}
+
+// Copy as many whole messages as fit in a datagram,
+// starting at the given position, to the datagram
+// buffer. Returns the length of the datagram. Must
+// be called with the backlog mutex held.
+static size_t packDgram(uint32_t pos, unsigned *numMsgs)
+{
+    size_t len = 0;
+    size_t dgramLen = 0;
+
+    *numMsgs = 0;
+    while (((pos + len) != head) && (len < sizeof (dgramBuf))) {
+        char c = backlog[(pos + len) % BACKLOG_SIZE];
+        dgramBuf[len++] = c;
+        if (c == '\n') {
+            dgramLen = len;
+            (*numMsgs)++;
+        }
+    }
+
+    return dgramLen;
+}
+
+// This task sends the messages in the backlog to the
+// collector. It's woken up when a datagram can be
+// filled, when the log is flushed, and when the network
+// comes up. While it can't send, the messages are kept
+// in the backlog.
+static void mlogUdpTask(void *parms)
+{
+    struct sockaddr_in collector = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_MSG_LOG_SYSLOG_PORT),
+    };
+    bool sendErr = false;
+    int sock = -1;
+
+    inet_pton(AF_INET, CONFIG_MSG_LOG_SYSLOG_HOST, &collector.sin_addr);
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, (sendErr) ? pdMS_TO_TICKS(RETRY_DELAY) : portMAX_DELAY);
+
+        while (netUp) {
+            unsigned numMsgs;
+            uint32_t pos;
+            size_t len;
+
+            if ((sock < 0) && ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)) {
+                if (!sendErr) {
+                    mlog(errNo, "Failed to create the syslog socket!");
+                }
+                sendErr = true;
+                break;
+            }
+
+            xSemaphoreTake(backlogMutex, portMAX_DELAY);
+            pos = tail;
+            len = packDgram(pos, &numMsgs);
+            xSemaphoreGive(backlogMutex);
+            if (len == 0) {
+                break;
+            }
+
+            if (sendto(sock, dgramBuf, len, 0, (struct sockaddr *) &collector, sizeof (collector)) != (ssize_t) len) {
+                // Keep the messages and try again later,
+                // only complaining the first time.
+                if (!sendErr) {
+                    mlog(errNo, "Failed to send to the syslog collector!");
+                }
+                sendErr = true;
+                break;
+            }
+            sendErr = false;
+
+            // Some of the messages may have been dropped
+            // already, to make room for new ones.
+            xSemaphoreTake(backlogMutex, portMAX_DELAY);
+            if ((int32_t) (tail - (pos + len)) < 0) {
+                tail = pos + len;
+            }
+            xSemaphoreGive(backlogMutex);
+
+            udpStats.records += numMsgs;
+            udpStats.datagrams++;
+            udpStats.bytes += len;
+        }
+    }
+}
+
+int mlogUdpInit(AppData *appData)
+{
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, CONFIG_MSG_LOG_SYSLOG_HOST, &addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    snprintf(hostName, sizeof (hostName), "esp32-%02X%02X%02X%02X",
+             appData->serialNumber[0], appData->serialNumber[1], appData->serialNumber[2], appData->serialNumber[3]);
+    appName = appData->appDesc->project_name;
+
+    if ((backlogMutex = xSemaphoreCreateMutex()) == NULL) {
+        return -1;
+    }
+
+    if (xTaskCreatePinnedToCore(mlogUdpTask, "mlogUdp", CONFIG_MSG_LOG_SYSLOG_TASK_STACK, NULL,
+                                CONFIG_MSG_LOG_SYSLOG_TASK_PRIO, &udpTaskHandle, tskNO_AFFINITY) != pdPASS) {
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif  // CONFIG_MSG_LOG && CONFIG_MSG_LOG_SYSLOG
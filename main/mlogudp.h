@@ -0,0 +1,38 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "app.h"
+#include "mlog.h"
+
+// Remote syslog sink. The log lines are sent over UDP to
+// a collector, as RFC 5424 syslog messages. The messages
+// are queued in a RAM backlog, and a separate task packs
+// as many of them as fit in each datagram, one message
+// per line. While the network is down nothing is sent,
+// and when the backlog is full the oldest messages are
+// dropped, so the callers of mlog() never wait for it.
+//
+// NOTE: mlogUdpWrite() and mlogUdpFlush() must be called
+// with the msgLog mutex held.
+
+// Syslog sink stats
+typedef struct MlogUdpStats {
+    uint32_t records;       // number of messages sent
+    uint32_t datagrams;     // number of datagrams sent
+    uint32_t bytes;         // number of bytes sent
+    uint32_t dropped;       // number of messages dropped because the backlog was full
+} MlogUdpStats;
+
+__BEGIN_DECLS
+
+extern int mlogUdpInit(AppData *appData);
+extern void mlogUdpWrite(const char *data, size_t len, uint64_t timeStamp, LogLevel logLevel);
+extern int mlogUdpFlush(void);
+extern void mlogUdpSetNetState(bool up);
+extern void mlogUdpGetStats(MlogUdpStats *stats);
+
+__END_DECLS
@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "mlogz.h"
+
+#if defined(CONFIG_MSG_LOG) && defined(CONFIG_MSG_LOG_COMPRESS)
+
+#define BLOCK_SIZE      CONFIG_MSG_LOG_COMPRESS_BLOCK_SIZE
+
+// LZ4 block format parameters
+#define MIN_MATCH       4
+#define LAST_LITERALS   5   // the last 5 bytes are always literals
+#define MF_LIMIT        12  // the last match must start 12 bytes before the end
+#define MAX_OFFSET      65535
+
+#define HASH_BITS       10
+
+_Static_assert((BLOCK_SIZE < 65535), "MSG_LOG_COMPRESS_BLOCK_SIZE is too large !");
+
+// Hash table of the positions (+1) of the last 4-byte
+// sequences seen, used by the compressor. The block size
+// is less than 64KB, so the positions fit in 16 bits,
+// and no match can be farther than MAX_OFFSET.
+static uint16_t hashTbl[1 << HASH_BITS];
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof (value));
+    return value;
+}
+
+static inline unsigned hashSeq(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Store the extra bytes of a literal or match length
+static uint8_t *putLen(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+// Number of extra bytes needed to store a length
+static inline size_t lenBytes(size_t len)
+{
+    return (len >= 15) ? (((len - 15) / 255) + 1) : 0;
+}
+
+// Store a sequence: the literals, followed by the match,
+// if any (matchLen == 0 means no match). Returns NULL if
+// it doesn't fit in the output buffer.
+static uint8_t *putSeq(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t litLen, unsigned offset, size_t matchLen)
+{
+    size_t mlCode = (matchLen != 0) ? (matchLen - MIN_MATCH) : 0;
+    size_t seqLen = 1 + lenBytes(litLen) + litLen;
+    uint8_t *token;
+
+    if (matchLen != 0) {
+        seqLen += 2 + lenBytes(mlCode);
+    }
+    if (seqLen > (size_t) (oend - op)) {
+        return NULL;
+    }
+
+    token = op++;
+    *token = ((litLen < 15) ? litLen : 15) << 4;
+    if (litLen >= 15) {
+        op = putLen(op, (litLen - 15));
+    }
+    memcpy(op, lit, litLen);
+    op += litLen;
+
+    if (matchLen != 0) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        *token |= (mlCode < 15) ? mlCode : 15;
+        if (mlCode >= 15) {
+            op = putLen(op, (mlCode - 15));
+        }
+    }
+
+    return op;
+}
+
+// Compress the data. Returns the length of the compressed
+// data, or -1 if it doesn't fit in the output buffer. Not
+// reentrant, as it uses a static hash table: it's only
+// called by the log file sink, with the msgLog mutex held.
+int mlogzCompress(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + srcLen;
+    const uint8_t *mfLimit = (srcLen > MF_LIMIT) ? (end - MF_LIMIT) : src;
+    const uint8_t *matchLimit = (srcLen > LAST_LITERALS) ? (end - LAST_LITERALS) : src;
+    const uint8_t *oend = dst + dstLen;
+    uint8_t *op = dst;
+
+    if (srcLen > BLOCK_SIZE) {
+        return -1;
+    }
+
+    memset(hashTbl, 0, sizeof (hashTbl));
+
+    while (ip < mfLimit) {
+        uint32_t seq = getU32(ip);
+        unsigned h = hashSeq(seq);
+        const uint8_t *ref = (hashTbl[h] != 0) ? (src + hashTbl[h] - 1) : NULL;
+        const uint8_t *mp, *rp;
+
+        hashTbl[h] = (ip - src) + 1;
+        if ((ref == NULL) || ((ip - ref) > MAX_OFFSET) || (getU32(ref) != seq)) {
+            ip++;
+            continue;
+        }
+
+        // Extend the match as far as possible
+        mp = ip + MIN_MATCH;
+        rp = ref + MIN_MATCH;
+        while ((mp < matchLimit) && (*mp == *rp)) {
+            mp++;
+            rp++;
+        }
+
+        if ((op = putSeq(op, oend, anchor, (ip - anchor), (ip - ref), (mp - ip))) == NULL) {
+            return -1;
+        }
+        ip = anchor = mp;
+    }
+
+    // The last literals
+    if ((op = putSeq(op, oend, anchor, (end - anchor), 0, 0)) == NULL) {
+        return -1;
+    }
+
+    return op - dst;
+}
+
+// Get the extra bytes of a literal or match length
+static const uint8_t *getLen(const uint8_t *ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (ip >= iend) {
+            return NULL;
+        }
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+// Decompress the data. Returns the length of the raw
+// data, or -1 if the compressed data is corrupted or
+// it doesn't fit in the output buffer.
+int mlogzDecompress(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + srcLen;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + dstLen;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t len = token >> 4;
+        const uint8_t *ref;
+        unsigned offset;
+
+        // Literals
+        if ((len == 15) && ((ip = getLen(ip, iend, &len)) == NULL)) {
+            return -1;
+        }
+        if ((len > (size_t) (iend - ip)) || (len > (size_t) (oend - op))) {
+            return -1;
+        }
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend) {
+            // The last sequence has no match
+            break;
+        }
+
+        // Match
+        if ((iend - ip) < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (op - dst))) {
+            return -1;
+        }
+        len = token & 0x0F;
+        if ((len == 15) && ((ip = getLen(ip, iend, &len)) == NULL)) {
+            return -1;
+        }
+        len += MIN_MATCH;
+        if (len > (size_t) (oend - op)) {
+            return -1;
+        }
+        // The match can overlap the output, so it
+        // must be copied one byte at a time.
+        ref = op - offset;
+        while (len-- != 0) {
+            *op++ = *ref++;
+        }
+    }
+
+    return op - dst;
+}
+
+// State of a compressed segment opened for reading
+typedef struct MlogzFile {
+    FILE *fp;
+    size_t rawLen;  // length of the raw data of the current block
+    size_t pos;     // offset of the next byte to read in the block
+    uint8_t raw[BLOCK_SIZE];
+    uint8_t data[BLOCK_SIZE];
+} MlogzFile;
+
+// Read and decompress the next block
+static int nextBlock(MlogzFile *zf)
+{
+    MlogzBlkHdr hdr;
+
+    zf->rawLen = zf->pos = 0;
+
+    if (fread(&hdr, 1, sizeof (hdr), zf->fp) != sizeof (hdr)) {
+        // End of the file
+        return -1;
+    }
+    if ((hdr.magic != MLOGZ_BLK_MAGIC) || (hdr.rawLen > BLOCK_SIZE) || (hdr.dataLen > BLOCK_SIZE)) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    if (hdr.method == mzmStored) {
+        if ((hdr.dataLen != hdr.rawLen) || (fread(zf->raw, 1, hdr.dataLen, zf->fp) != hdr.dataLen)) {
+            errno = EILSEQ;
+            return -1;
+        }
+    } else if ((hdr.method != mzmLz4) ||
+               (fread(zf->data, 1, hdr.dataLen, zf->fp) != hdr.dataLen) ||
+               (mlogzDecompress(zf->data, hdr.dataLen, zf->raw, sizeof (zf->raw)) != hdr.rawLen)) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    zf->rawLen = hdr.rawLen;
+
+    return 0;
+}
+
+static int zRead(void *cookie, char *buf, int len)
+{
+    MlogzFile *zf = cookie;
+    int n = 0;
+
+    while (n < len) {
+        size_t m;
+
+        if ((zf->pos == zf->rawLen) && (nextBlock(zf) != 0)) {
+            break;
+        }
+        m = zf->rawLen - zf->pos;
+        if (m > (size_t) (len - n)) {
+            m = len - n;
+        }
+        memcpy(&buf[n], &zf->raw[zf->pos], m);
+        zf->pos += m;
+        n += m;
+    }
+
+    return n;
+}
+
+static int zClose(void *cookie)
+{
+    MlogzFile *zf = cookie;
+    int err = fclose(zf->fp);
+    free(zf);
+    return err;
+}
+
+// Open a compressed log segment for reading, starting at
+// the block at the given offset. The returned stream reads
+// the raw log data, decompressing the blocks on the fly.
+FILE *mlogzOpen(const char *path, long offset)
+{
+    MlogzFile *zf;
+    FILE *fp;
+
+    if ((zf = malloc(sizeof (*zf))) == NULL) {
+        return NULL;
+    }
+    memset(zf, 0, offsetof(MlogzFile, raw));
+
+    if ((zf->fp = fopen(path, "rb")) == NULL) {
+        int errorNum = errno;
+        free(zf);
+        errno = errorNum;
+        return NULL;
+    }
+
+    if ((offset != 0) && (fseek(zf->fp, offset, SEEK_SET) != 0)) {
+        int errorNum = errno;
+        fclose(zf->fp);
+        free(zf);
+        errno = errorNum;
+        return NULL;
+    }
+
+    if ((fp = funopen(zf, zRead, NULL, NULL, zClose)) == NULL) {
+        fclose(zf->fp);
+        free(zf);
+    }
+
+    return fp;
+}
+
+#endif  // CONFIG_MSG_LOG && CONFIG_MSG_LOG_COMPRESS
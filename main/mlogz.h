@@ -0,0 +1,42 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sdkconfig.h"
+
+// Compressed log segments. The log data is stored as a
+// sequence of blocks, each one made of this header followed
+// by the block data: either the raw data, when it doesn't
+// compress, or the data compressed using the LZ4 block
+// format, so it can be decoded on the host by any LZ4
+// implementation. The compressor is a simple greedy one,
+// that only needs a small hash table.
+//
+// All multi-byte values are stored in little-endian order.
+
+#define MLOGZ_BLK_MAGIC     0x5A4C  // "LZ"
+
+typedef enum MlogzMethod {
+    mzmStored = 0,
+    mzmLz4 = 1,
+} MlogzMethod;
+
+// Block header
+typedef struct __attribute__((packed)) MlogzBlkHdr {
+    uint16_t magic;     // +00  UINT16: MLOGZ_BLK_MAGIC
+    uint8_t method;     // +02  UINT8: MlogzMethod
+    uint8_t reserved;   // +03  UINT8: 0
+    uint16_t rawLen;    // +04  UINT16: Length of the raw data
+    uint16_t dataLen;   // +06  UINT16: Length of the block data
+} MlogzBlkHdr;          // +08
+
+__BEGIN_DECLS
+
+extern int mlogzCompress(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen);
+extern int mlogzDecompress(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen);
+extern FILE *mlogzOpen(const char *path, long offset);
+
+__END_DECLS
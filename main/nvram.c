@@ -2,6 +2,8 @@
 #include "mlog.h"
 #include "nvram.h"
 
+#define MLOG_MODULE lmNvram
+
 static const char *configInfoBlobName = "configInfo";
 static nvs_handle_t nvsHandle;
 
@@ -69,7 +71,14 @@ int nvramRead(AppPersData *configInfo)
         // size match the size used by this new firmware image, and
         // we write it back to NVRAM.
         mlog(warning, "\"%s\" blob shrunk: old=%zu new=%zu", configInfoBlobName, blobLen, configInfoBlobSize);
+        // This only happens once after a firmware update,
+        // so the buffer comes from the heap: the blob can
+        // be larger than the largest memory pool block.
         uint8_t *blobBuf = malloc(blobLen);
+        if (blobBuf == NULL) {
+            mlog(error, "Can't alloc %zu bytes for \"%s\" blob!", blobLen, configInfoBlobName);
+            return -1;
+        }
         nvs_get_blob(nvsHandle, configInfoBlobName, blobBuf, &blobLen);
         nvs_erase_all(nvsHandle);
         memcpy(configInfo, blobBuf, configInfoBlobSize);
@@ -4,11 +4,14 @@
 
 #include <stdio.h>
 
+#include "apppm.h"
 #include "esp32.h"
 #include "led.h"
 #include "mlog.h"
 #include "ota.h"
 
+#define MLOG_MODULE lmOta
+
 // Delay (in ms) before the system auto-resets after
 // a successful OTA firmware update.
 #define POST_UPDATE_RESET_DELAY 5000
@@ -166,6 +169,11 @@ static void otaUpdTask(void *arg)
     // Disable WiFi power-saving mode to speed up the
     // firmware download...
     esp_wifi_set_ps(WIFI_PS_NONE);
+#ifdef CONFIG_APP_POWER_SAVE
+    // ... and keep the CPU at full speed while
+    // it's in progress.
+    appPmAcquire(aplOta);
+#endif
 
     esp_http_client_config_t config = {
         .url = otaUpdateUrl,
@@ -182,24 +190,27 @@ static void otaUpdTask(void *arg)
     // the OTA firmware update is in progress...
     ledSet(blink4, cyan);
 
-    mlog(info, "Starting OTA firmware update from %s", config.url);
+    mlogKV(info, "otaUpdate", KV_STR("state", "start"), KV_STR("url", config.url));
 
     httpErrno = 0;
     otaUpdState = otaUpdStart;
     versionChecked = false;
 
     if ((err = esp_https_ota(&otaConfig)) == ESP_OK) {
-        mlog(info, "OTA firmware update succeeded.");
+        mlogKV(info, "otaUpdate", KV_STR("state", "success"));
         autoRestart = true;
         delayTicks = pdMS_TO_TICKS(POST_UPDATE_RESET_DELAY);
     } else if (otaUpdState == otaUpdTerminated) {
-        mlog(info, "OTA update terminated.");
+        mlogKV(info, "otaUpdate", KV_STR("state", "terminated"));
     } else {
-        mlog(error, "%s", (otaUpdState < otaUpdConnected) ? "Unable to connect to OTA update server." : "OTA update failed!");
+        mlogKV(error, "otaUpdate", KV_STR("state", (otaUpdState < otaUpdConnected) ? "connectFailed" : "failed"), KV_INT("err", err));
         ledMode = blink4;
         ledColor = red;
         delayTicks = pdMS_TO_TICKS(FAIL_UPDATE_RESET_DELAY);
     }
+#ifdef CONFIG_APP_POWER_SAVE
+    appPmRelease(aplOta);
+#endif
 
     // Give the user a visual indication of the result
     // of the firmware update.
@@ -209,6 +220,7 @@ static void otaUpdTask(void *arg)
 
     if (autoRestart) {
         // Restart the device to activate the new firmware
+        msgLogFlush();
         esp_restart();
     }
 
@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "appsched.h"
+#include "esp32.h"
+#include "mlog.h"
+#include "taskmon.h"
+
+#define MLOG_MODULE lmApp
+
+#ifdef CONFIG_TASK_MONITOR
+
+#define MAX_TASKS   CONFIG_TASK_MONITOR_MAX_TASKS
+#define WINDOW      CONFIG_TASK_MONITOR_WINDOW
+
+// Stack sizes of the tasks created by SkelApp
+static const struct {
+    const char *name;
+    uint32_t stackSize;
+} knownTaskTbl[] = {
+    { "appMain", CONFIG_MAIN_TASK_STACK },
+#ifdef CONFIG_APP_WORK_POOL
+    { "appWork0", CONFIG_APP_WORK_TASK_STACK },
+    { "appWork1", CONFIG_APP_WORK_TASK_STACK },
+#endif
+#if defined(CONFIG_BLE_PERIPHERAL) || defined(CONFIG_BLE_CENTRAL)
+    { "bleHostTask", CONFIG_BLE_HOST_TASK_STACK },
+#endif
+#ifdef CONFIG_DCS_MLOG_DOWNLOAD
+    { "mlogDl", CONFIG_DCS_MLOG_DOWNLOAD_TASK_STACK },
+#endif
+#ifdef CONFIG_WEB_SERVER
+    { "httpd", CONFIG_WEB_SERVER_TASK_STACK },
+#ifdef CONFIG_MSG_LOG_FOLLOW
+    { "mlogFollow", CONFIG_WEB_SERVER_TASK_STACK },
+#endif
+#endif
+#ifdef CONFIG_OTA_UPDATE
+    { "otaUpd", CONFIG_OTA_TASK_STACK },
+#endif
+#ifdef CONFIG_RGB_LED
+    { "ledMgr", CONFIG_RGB_LED_TASK_STACK },
+#endif
+#ifdef CONFIG_MSG_LOG_ASYNC
+    { "msgLog", CONFIG_MSG_LOG_TASK_STACK },
+#endif
+#ifdef CONFIG_MSG_LOG_SYSLOG
+    { "mlogUdp", CONFIG_MSG_LOG_SYSLOG_TASK_STACK },
+#endif
+};
+
+// Sampling state of a task
+typedef struct TaskSlot {
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE lastRunTime;
+    bool seen;
+    bool fresh;                     // first seen in this period
+    uint8_t numSamples;
+    uint8_t nextSample;
+    uint16_t cpuSample[WINDOW];     // [in 0.01% of a core]
+    TaskMonInfo info;
+} TaskSlot;
+
+// The samples are taken by the appMain task, which is
+// the only one to use the sampling state.
+static TaskSlot slotTbl[MAX_TASKS];
+static unsigned numSlots;
+static configRUN_TIME_COUNTER_TYPE lastTotalRunTime;
+static unsigned numSamples;
+
+// Copy of the info of the tasks, made at the end of
+// each sample, and read by the BLE and HTTP server
+// tasks.
+static TaskMonInfo infoTbl[MAX_TASKS];
+static unsigned numInfo;
+static portMUX_TYPE infoLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Scratch buffer for uxTaskGetSystemState()
+static TaskStatus_t statusTbl[MAX_TASKS];
+
+static uint32_t knownStackSize(const char *name)
+{
+    for (int i = 0; i < (sizeof (knownTaskTbl) / sizeof (knownTaskTbl[0])); i++) {
+        if (strcmp(knownTaskTbl[i].name, name) == 0) {
+            return knownTaskTbl[i].stackSize;
+        }
+    }
+
+    return 0;
+}
+
+// Recommend a stack size for the observed peak usage,
+// rounded up to a multiple of 256 bytes.
+static uint32_t recStackSize(uint32_t stackSize, uint32_t minFree)
+{
+    uint32_t peak = (minFree < stackSize) ? (stackSize - minFree) : 0;
+    uint32_t margin = peak / 4;
+
+    if (margin < TASK_MON_MIN_STACK_MARGIN) {
+        margin = TASK_MON_MIN_STACK_MARGIN;
+    }
+
+    return ((peak + margin + 255) & ~255UL);
+}
+
+static TaskSlot *getSlot(const TaskStatus_t *ts)
+{
+    TaskSlot *slot;
+
+    for (unsigned i = 0; i < numSlots; i++) {
+        if (slotTbl[i].handle == ts->xHandle) {
+            return &slotTbl[i];
+        }
+    }
+
+    // New task: start sampling it at the next period
+    if (numSlots == MAX_TASKS) {
+        return NULL;
+    }
+    slot = &slotTbl[numSlots++];
+    memset(slot, 0, sizeof (*slot));
+    slot->handle = ts->xHandle;
+    slot->fresh = true;
+    slot->lastRunTime = ts->ulRunTimeCounter;
+    snprintf(slot->info.name, sizeof (slot->info.name), "%s", ts->pcTaskName);
+    slot->info.stackSize = knownStackSize(ts->pcTaskName);
+    slot->info.minFree = ts->usStackHighWaterMark;
+
+    return slot;
+}
+
+static void updateSlot(TaskSlot *slot, const TaskStatus_t *ts, uint32_t elapsed)
+{
+    TaskMonInfo *info = &slot->info;
+    uint32_t sum = 0;
+    uint16_t max = 0;
+
+    info->core = (ts->xCoreID == tskNO_AFFINITY) ? -1 : ts->xCoreID;
+    info->prio = ts->uxCurrentPriority;
+    if (ts->usStackHighWaterMark < info->minFree) {
+        info->minFree = ts->usStackHighWaterMark;
+    }
+    if (info->stackSize != 0) {
+        info->recStackSize = recStackSize(info->stackSize, info->minFree);
+    }
+
+    // The run time of a new task is only known from
+    // its first period on.
+    if ((elapsed != 0) && !slot->fresh) {
+        uint64_t runTime = (configRUN_TIME_COUNTER_TYPE) (ts->ulRunTimeCounter - slot->lastRunTime);
+        uint32_t cpu = (runTime * 10000) / elapsed;
+        info->cpuLast = (cpu > 10000) ? 10000 : cpu;
+        slot->cpuSample[slot->nextSample] = info->cpuLast;
+        slot->nextSample = (slot->nextSample + 1) % WINDOW;
+        if (slot->numSamples < WINDOW) {
+            slot->numSamples++;
+        }
+        for (unsigned i = 0; i < slot->numSamples; i++) {
+            sum += slot->cpuSample[i];
+            if (slot->cpuSample[i] > max) {
+                max = slot->cpuSample[i];
+            }
+        }
+        info->cpuAvg = sum / slot->numSamples;
+        info->cpuMax = max;
+    }
+    slot->lastRunTime = ts->ulRunTimeCounter;
+    slot->fresh = false;
+}
+
+// Take a sample of the run time stats and of the stack
+// high water marks of all the tasks. The CPU usage is
+// given in % of a single core, so the sum over all the
+// tasks, including the idle ones, is 100% per core.
+static void taskMonJob(AppData *appData)
+{
+    configRUN_TIME_COUNTER_TYPE totalRunTime;
+    UBaseType_t numTasks;
+    uint32_t elapsed;
+    unsigned i;
+
+    numTasks = uxTaskGetSystemState(statusTbl, MAX_TASKS, &totalRunTime);
+    if (numTasks == 0) {
+        mlog(warning, "Too many tasks to monitor!");
+        return;
+    }
+
+    elapsed = (lastTotalRunTime != 0) ? (configRUN_TIME_COUNTER_TYPE) (totalRunTime - lastTotalRunTime) : 0;
+    lastTotalRunTime = totalRunTime;
+
+    for (i = 0; i < numSlots; i++) {
+        slotTbl[i].seen = false;
+    }
+    for (i = 0; i < numTasks; i++) {
+        TaskSlot *slot = getSlot(&statusTbl[i]);
+        if (slot != NULL) {
+            slot->seen = true;
+            updateSlot(slot, &statusTbl[i], elapsed);
+        }
+    }
+
+    // Forget the tasks that were deleted
+    for (i = 0; i < numSlots; ) {
+        if (!slotTbl[i].seen) {
+            slotTbl[i] = slotTbl[--numSlots];
+        } else {
+            i++;
+        }
+    }
+
+    portENTER_CRITICAL(&infoLock);
+    for (i = 0; i < numSlots; i++) {
+        infoTbl[i] = slotTbl[i].info;
+    }
+    numInfo = numSlots;
+    portEXIT_CRITICAL(&infoLock);
+
+    // Log the stats once per window
+    if (++numSamples == WINDOW) {
+        numSamples = 0;
+        taskMonLogStats();
+    }
+}
+
+// Get the info of the n-th task monitored. Returns -1,
+// with errno set to ENOENT, past the last task.
+int taskMonGetInfo(unsigned n, TaskMonInfo *info)
+{
+    int rc = 0;
+
+    portENTER_CRITICAL(&infoLock);
+    if (n < numInfo) {
+        *info = infoTbl[n];
+    } else {
+        rc = -1;
+    }
+    portEXIT_CRITICAL(&infoLock);
+
+    if (rc != 0) {
+        errno = ENOENT;
+    }
+
+    return rc;
+}
+
+// Log the info of each task, as: cpu=last/avg/max
+// stack=free/size rec=recommended size
+void taskMonLogStats(void)
+{
+    TaskMonInfo info;
+
+    for (unsigned n = 0; taskMonGetInfo(n, &info) == 0; n++) {
+        if (info.stackSize != 0) {
+            mlogDump(trace, "Task %s: cpu=%u.%02u/%u.%02u/%u.%02u%% stack=%lu/%lu rec=%lu", info.name,
+                 (info.cpuLast / 100), (info.cpuLast % 100), (info.cpuAvg / 100), (info.cpuAvg % 100),
+                 (info.cpuMax / 100), (info.cpuMax % 100), info.minFree, info.stackSize, info.recStackSize);
+        } else {
+            mlogDump(trace, "Task %s: cpu=%u.%02u/%u.%02u/%u.%02u%% stack=%lu", info.name,
+                 (info.cpuLast / 100), (info.cpuLast % 100), (info.cpuAvg / 100), (info.cpuAvg % 100),
+                 (info.cpuMax / 100), (info.cpuMax % 100), info.minFree);
+        }
+    }
+}
+
+// Add the sampling job to the appMain task. Must be
+// called by the appMain task.
+int taskMonInit(void)
+{
+    if (appSchedAdd("taskMon", (CONFIG_TASK_MONITOR_PERIOD * 1000000), 0, taskMonJob) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+#else
+
+int taskMonGetInfo(unsigned n, TaskMonInfo *info)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif  // CONFIG_TASK_MONITOR
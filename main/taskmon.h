@@ -0,0 +1,40 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#include "esp32.h"
+
+// Task monitor: samples the FreeRTOS run time stats and
+// the stack high water marks of all the tasks, as a job
+// of the appMain task, every TASK_MONITOR_PERIOD secs. The
+// CPU usage of each task is kept over a sliding window of
+// TASK_MONITOR_WINDOW samples, and the stack headroom over
+// the whole run. For the tasks created by SkelApp, whose
+// stack size is known, a stack size is recommended based
+// on the observed peak usage.
+
+// Stack headroom used when recommending a stack size:
+// 25% of the peak usage, but at least this many bytes.
+#define TASK_MON_MIN_STACK_MARGIN   512
+
+// Info about a task
+typedef struct TaskMonInfo {
+    char name[configMAX_TASK_NAME_LEN];
+    int8_t core;            // CPU core the task is pinned to, or -1
+    uint8_t prio;           // current priority
+    uint16_t cpuLast;       // CPU usage in the last period [in 0.01% of a core]
+    uint16_t cpuAvg;        // avg CPU usage over the window [in 0.01% of a core]
+    uint16_t cpuMax;        // max CPU usage over the window [in 0.01% of a core]
+    uint32_t stackSize;     // stack size [in bytes], or 0 if unknown
+    uint32_t minFree;       // min free stack space seen [in bytes]
+    uint32_t recStackSize;  // recommended stack size [in bytes], or 0 if unknown
+} TaskMonInfo;
+
+__BEGIN_DECLS
+
+extern int taskMonInit(void);
+extern int taskMonGetInfo(unsigned n, TaskMonInfo *info);
+extern void taskMonLogStats(void);
+
+__END_DECLS
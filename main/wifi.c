@@ -6,6 +6,8 @@
 #include "mlog.h"
 #include "wifi.h"
 
+#define MLOG_MODULE lmWifi
+
 #ifdef CONFIG_WIFI_STATION
 
 static TaskHandle_t callingTaskHandle = NULL;
@@ -83,17 +85,17 @@ static void ipEvtHandler(void *arg, esp_event_base_t evtBase, int32_t evtId, voi
         ip_event_got_ip_t *gotIp = evtData;
         appData->wifiIpAddr = gotIp->ip_info.ip.addr;
         appData->wifiGwAddr = gotIp->ip_info.gw.addr;
-        char ipBuf[INET_ADDRSTRLEN];
-        char gwBuf[INET_ADDRSTRLEN];
 
-        inet_ntop(AF_INET, &appData->wifiIpAddr, ipBuf, sizeof (ipBuf));
-        inet_ntop(AF_INET, &appData->wifiGwAddr, gwBuf, sizeof (gwBuf));
-        mlog(info, "Connected to WiFi AP: ipAddr=%s gwAddr=%s mac=%s rssi=%s chan=%u", ipBuf, gwBuf, fmtLanMac(appData->wifiMac), fmtRssi(appData->wifiRssi), appData->wifiPriChan);
+        mlogKV(info, "wifiConnected", KV_IP4("ipAddr", appData->wifiIpAddr), KV_IP4("gwAddr", appData->wifiGwAddr),
+               KV_MAC("mac", appData->wifiMac), KV_INT("rssi", appData->wifiRssi), KV_UINT("chan", appData->wifiPriChan));
 
         // Set the LED solid blue to indicate we are
         // connected to the network.
         ledSet(on, blue);
 
+        // Let the log sinks use the network
+        msgLogSetNetState(true);
+
 #ifdef CONFIG_WPS
         wpsState = wpsIdle;
 #endif
@@ -241,6 +243,7 @@ static void wifiEvtHandler(void *arg, esp_event_base_t evtBase, int32_t evtId, v
         }
 
         wifiConnState = wifiDisconnected;
+        msgLogSetNetState(false);
 
         if (retry) {
             // Let's try again...
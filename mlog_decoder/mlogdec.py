@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+
+# This script decodes the binary log segments (MLOGB.NNN) written by msgLog()
+# when the "Binary Log Records" option is enabled. The records only hold
+# the address of the format string and the raw values of its arguments,
+# so the ELF file of the firmware that wrote the log segments is needed
+# to look up the strings. The segments must be listed from the oldest
+# to the newest one. Compressed segments (MLOGBZ.NNN) are decompressed
+# on the fly.
+#
+# Requires pyelftools: pip install pyelftools
+#
+# Usage: mlogdec.py <firmware.elf> <MLOGB.NNN> ...
+
+import argparse
+import datetime
+import hashlib
+import json
+import os
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+import mlogunz
+
+# Record header: len, logLevel, taskId, errorNum, lineNum, fmtId, funcId, timeStamp
+HDR_FMT = '<BBBBHIIQ'
+HDR_LEN = struct.calcsize(HDR_FMT)
+
+LEVEL_MASK = 0x0F
+CORE_BIT = 0x80
+
+REC_FILE_HDR = 0x0E
+REC_TASK_NAME = 0x0F
+
+ISR_TASK = 0xFE
+
+REC_VERSIONS = (1, 2)
+TS_TOD = 1
+
+STR_INLINE = 0x00
+STR_ADDR = 0x01
+
+# Special format IDs
+FMT_TEXT = 0
+FMT_KV = 1
+
+# CBOR tags of the mlogKV() fields
+TAG_IP4 = 52
+TAG_MAC = 48
+
+LEVEL_NAMES = ['NONE', 'INFO', 'TRACE', 'DEBUG', 'WARNING', 'ERROR', 'ERROR', 'FATAL']
+TRACE = 2
+ERRNO = 6
+FATAL = 7
+
+SECS_2025_JAN_01 = 1735689600
+
+SPEC_RE = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L|q)?([diouxXeEfFgGaAcspn%])')
+
+
+class ElfStrings:
+    """Reads NUL-terminated strings from the ELF file sections."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        self.sha256 = hashlib.sha256(data).digest()
+        self.sections = []
+        with open(path, 'rb') as f:
+            elf = ELFFile(f)
+            for sect in elf.iter_sections():
+                if sect['sh_type'] == 'SHT_PROGBITS' and sect['sh_addr'] != 0:
+                    self.sections.append((sect['sh_addr'], sect.data()))
+
+    def get(self, addr):
+        for base, data in self.sections:
+            if base <= addr < base + len(data):
+                end = data.find(b'\0', addr - base)
+                if end < 0:
+                    end = len(data)
+                return data[addr - base:end].decode('utf-8', 'replace')
+        return '<0x%08x?>' % addr
+
+
+def fmt_timestamp(ts, ts_type, utc_offset):
+    secs, usecs = divmod(ts, 1000000)
+    if ts_type == TS_TOD:
+        if secs >= SECS_2025_JAN_01:
+            secs += utc_offset * 3600
+        tod = datetime.datetime.fromtimestamp(secs, datetime.timezone.utc)
+        return '%s.%06u' % (tod.strftime('%Y-%m-%d %H:%M:%S'), usecs)
+    dd, secs = divmod(secs, 86400)
+    hh, secs = divmod(secs, 3600)
+    mm, ss = divmod(secs, 60)
+    return '%02u %02u:%02u:%02u.%06u' % (dd, hh, mm, ss, usecs)
+
+
+def fmt_text(fmt, args, strings):
+    """Format the message text using the raw argument values."""
+    out = []
+    pos = 0
+    off = 0
+
+    def take(size):
+        nonlocal off
+        if off + size > len(args):
+            raise IndexError
+        val = args[off:off + size]
+        off += size
+        return val
+
+    for m in SPEC_RE.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+        try:
+            if width == '*':
+                width = str(struct.unpack('<i', take(4))[0])
+            if prec == '*':
+                prec = str(struct.unpack('<i', take(4))[0])
+            spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+
+            if conv == 's':
+                tag = take(1)[0]
+                if tag == STR_ADDR:
+                    value = strings.get(struct.unpack('<I', take(4))[0])
+                else:
+                    end = args.find(b'\0', off)
+                    if end < 0:
+                        end = len(args)
+                    value = args[off:end].decode('utf-8', 'replace')
+                    off = end + 1
+                out.append((spec + 's') % value)
+            elif conv == 'n':
+                pass
+            elif conv in 'eEfFgGaA':
+                value = struct.unpack('<d', take(8))[0]
+                if conv in 'aA':
+                    out.append(value.hex())
+                else:
+                    out.append((spec + conv) % value)
+            else:
+                size = 8 if length in ('ll', 'j', 'q') else 4
+                value = int.from_bytes(take(size), 'little', signed=(conv in 'di'))
+                if length == 'hh':
+                    value = (value & 0xFF) - (0x100 if conv in 'di' and value & 0x80 else 0)
+                elif length == 'h':
+                    value = (value & 0xFFFF) - (0x10000 if conv in 'di' and value & 0x8000 else 0)
+                if conv == 'p':
+                    out.append('0x%x' % value)
+                elif conv == 'c':
+                    out.append((spec + 'c') % chr(value & 0xFF))
+                elif conv == 'u':
+                    out.append((spec + 'd') % value)
+                else:
+                    out.append((spec + conv) % value)
+        except IndexError:
+            # The record was truncated
+            out.append('<?>')
+    out.append(fmt[pos:])
+
+    return ''.join(out)
+
+
+def cbor_item(data, pos):
+    """Decodes the CBOR data item at the given position, only supporting
+    what mlogKV() encodes. Returns the value and the next position."""
+    ib = data[pos]
+    major, info = ib >> 5, ib & 0x1F
+    pos += 1
+    if info < 24:
+        value = info
+    elif info <= 27:
+        n = 1 << (info - 24)
+        value = int.from_bytes(data[pos:pos + n], 'big')
+        pos += n
+    else:
+        raise ValueError('unsupported CBOR item 0x%02x' % ib)
+
+    if major == 0:
+        return value, pos
+    if major == 1:
+        return -1 - value, pos
+    if major in (2, 3):
+        raw = data[pos:pos + value]
+        if len(raw) != value:
+            raise ValueError('truncated CBOR string')
+        return (raw if major == 2 else raw.decode('utf-8', 'replace')), pos + value
+    if major == 6:
+        raw, pos = cbor_item(data, pos)
+        if value == TAG_IP4 and len(raw) == 4:
+            return '.'.join(str(b) for b in raw), pos
+        if value == TAG_MAC and len(raw) == 6:
+            return ':'.join('%02X' % b for b in raw), pos
+        return raw.hex(), pos
+    if major == 7 and value in (20, 21, 22):
+        return {20: False, 21: True, 22: None}[value], pos
+    raise ValueError('unsupported CBOR item 0x%02x' % ib)
+
+
+def kv_text(args):
+    """Renders the CBOR map of a mlogKV() record as a JSON object."""
+    fields = {}
+    try:
+        if args[0] != 0xBF:
+            raise ValueError('not a CBOR map')
+        pos = 1
+        while args[pos] != 0xFF:
+            key, pos = cbor_item(args, pos)
+            fields[key], pos = cbor_item(args, pos)
+    except (ValueError, IndexError):
+        pass
+    return json.dumps(fields, separators=(',', ':'))
+
+
+def decode(strings, mlog_path, out):
+    task_names = {}
+    ts_type = 0
+    utc_offset = 0
+
+    with open(mlog_path, 'rb') as f:
+        data = f.read()
+    if mlogunz.is_compressed(data):
+        data = mlogunz.decompress(data, mlog_path)
+
+    pos = 0
+    while pos < len(data):
+        rec_len = data[pos]
+        if rec_len < HDR_LEN or pos + rec_len > len(data):
+            print('*** %s: truncated or corrupted record at offset %u! ***' % (mlog_path, pos), file=sys.stderr)
+            return 1
+        rec = data[pos:pos + rec_len]
+        pos += rec_len
+
+        _, log_level, task_id, error_num, line_num, fmt_id, func_id, ts = struct.unpack(HDR_FMT, rec[:HDR_LEN])
+        args = rec[HDR_LEN:]
+        rec_type = log_level & LEVEL_MASK
+
+        if rec_type == REC_FILE_HDR:
+            if args[0:4] != b'MLOG' or args[4] not in REC_VERSIONS:
+                print('*** %s: not a MLOG file, or unsupported version! ***' % mlog_path, file=sys.stderr)
+                return 1
+            ts_type = args[5]
+            utc_offset = struct.unpack('<b', args[6:7])[0]
+            if args[7:15] != strings.sha256[:8]:
+                print('*** WARNING: %s was not written by this ELF file! ***' % mlog_path, file=sys.stderr)
+            continue
+        if rec_type == REC_TASK_NAME:
+            task_names[task_id] = args.split(b'\0')[0].decode('utf-8', 'replace')
+            continue
+
+        if fmt_id == FMT_TEXT:
+            text = args.split(b'\0')[0].decode('utf-8', 'replace')
+        elif fmt_id == FMT_KV:
+            text = kv_text(args)
+        else:
+            text = fmt_text(strings.get(fmt_id), args, strings)
+
+        line = '%s %s ' % (fmt_timestamp(ts, ts_type, utc_offset), LEVEL_NAMES[rec_type] if rec_type < len(LEVEL_NAMES) else '???')
+        if rec_type >= TRACE:
+            line += '%s@%u:%s:%d ' % (task_names.get(task_id, 'ISR' if task_id == ISR_TASK else '???'), 1 if log_level & CORE_BIT else 0, strings.get(func_id), line_num)
+        line += text
+        if rec_type in (ERRNO, FATAL) and error_num != 0:
+            line += ' errno=%d (%s)' % (error_num, os.strerror(error_num))
+        print(line, file=out)
+
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary MLOG segments')
+    parser.add_argument('elf', help='ELF file of the firmware that wrote the log segments')
+    parser.add_argument('mlog', nargs='+', help='binary log segments (MLOGB.NNN), oldest first')
+    args = parser.parse_args()
+
+    strings = ElfStrings(args.elf)
+    rc = 0
+    for mlog_path in args.mlog:
+        rc |= decode(strings, mlog_path, sys.stdout)
+
+    return rc
+
+
+if __name__ == '__main__':
+    sys.exit(main())
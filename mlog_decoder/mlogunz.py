@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+
+# This script decompresses the log segments (MLOGZ.NNN or MLOGBZ.NNN)
+# written by msgLog() when the "Compress Log Segments" option is enabled.
+# Each segment is a sequence of blocks, made of an 8-byte header followed
+# by the block data, either stored as is or compressed using the LZ4 block
+# format. The raw log data is written to stdout, or to the output file.
+# Binary log segments (MLOGBZ.NNN) can also be passed straight to mlogdec.py,
+# which decompresses them on the fly.
+#
+# Usage: mlogunz.py [-o <output>] <MLOGZ.NNN> ...
+
+import argparse
+import struct
+import sys
+
+# Block header: magic, method, reserved, rawLen, dataLen
+BLK_HDR_FMT = '<HBBHH'
+BLK_HDR_LEN = struct.calcsize(BLK_HDR_FMT)
+BLK_MAGIC = 0x5A4C
+
+METHOD_STORED = 0
+METHOD_LZ4 = 1
+
+
+def lz4_decompress(data, raw_len):
+    out = bytearray()
+    pos = 0
+
+    def get_len(length):
+        nonlocal pos
+        while True:
+            b = data[pos]
+            pos += 1
+            length += b
+            if b != 255:
+                return length
+
+    while pos < len(data):
+        token = data[pos]
+        pos += 1
+        length = token >> 4
+        if length == 15:
+            length = get_len(length)
+        out += data[pos:pos + length]
+        pos += length
+        if pos >= len(data):
+            break
+        offset = data[pos] | (data[pos + 1] << 8)
+        pos += 2
+        if offset == 0 or offset > len(out):
+            raise ValueError('invalid match offset')
+        length = token & 0x0F
+        if length == 15:
+            length = get_len(length)
+        length += 4
+        start = len(out) - offset
+        for i in range(length):
+            out.append(out[start + i])
+
+    if len(out) != raw_len:
+        raise ValueError('invalid block length')
+
+    return bytes(out)
+
+
+def is_compressed(data):
+    return len(data) >= BLK_HDR_LEN and struct.unpack('<H', data[:2])[0] == BLK_MAGIC
+
+
+def decompress(data, path='<data>'):
+    out = bytearray()
+    pos = 0
+
+    while pos < len(data):
+        if pos + BLK_HDR_LEN > len(data):
+            print('*** %s: truncated block header at offset %u! ***' % (path, pos), file=sys.stderr)
+            break
+        magic, method, _, raw_len, data_len = struct.unpack(BLK_HDR_FMT, data[pos:pos + BLK_HDR_LEN])
+        blk_data = data[pos + BLK_HDR_LEN:pos + BLK_HDR_LEN + data_len]
+        if magic != BLK_MAGIC or len(blk_data) != data_len:
+            print('*** %s: truncated or corrupted block at offset %u! ***' % (path, pos), file=sys.stderr)
+            break
+        try:
+            if method == METHOD_STORED:
+                out += blk_data
+            elif method == METHOD_LZ4:
+                out += lz4_decompress(blk_data, raw_len)
+            else:
+                raise ValueError('unknown method %u' % method)
+        except (ValueError, IndexError) as e:
+            print('*** %s: corrupted block at offset %u: %s! ***' % (path, pos, e), file=sys.stderr)
+            break
+        pos += BLK_HDR_LEN + data_len
+
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decompress MLOG segments')
+    parser.add_argument('-o', '--output', help='output file (default: stdout)')
+    parser.add_argument('mlog', nargs='+', help='compressed log segments (MLOGZ.NNN), oldest first')
+    args = parser.parse_args()
+
+    out = open(args.output, 'wb') if args.output else sys.stdout.buffer
+    for mlog_path in args.mlog:
+        with open(mlog_path, 'rb') as f:
+            out.write(decompress(f.read(), mlog_path))
+    if args.output:
+        out.close()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+
+# This script is a minimal stand-in for a syslog collector, to check the
+# "Remote Syslog" log sink. It receives the UDP datagrams sent by the device,
+# each one holding one or more RFC 5424 messages (one per line), prints the
+# messages, and on exit (Ctrl-C) reports the number of datagrams, messages,
+# and bytes received, and the average bytes per message.
+#
+# Usage: syslogrx.py [-a <addr>] [-p <port>] [-q]
+
+import argparse
+import re
+import socket
+import sys
+
+# <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+MSG_RE = re.compile(r'^<(\d{1,3})>1 (\S+) (\S+) (\S+) (\S+) (\S+) (-|\[.*?\]) ?(.*)$')
+
+SEVERITY = ['EMERG', 'ALERT', 'CRIT', 'ERR', 'WARNING', 'NOTICE', 'INFO', 'DEBUG']
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Receive the syslog messages sent by msgLog()')
+    parser.add_argument('-a', '--addr', default='0.0.0.0', help='address to listen on (default: 0.0.0.0)')
+    parser.add_argument('-p', '--port', type=int, default=514, help='UDP port to listen on (default: 514)')
+    parser.add_argument('-q', '--quiet', action='store_true', help='only report the stats')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.addr, args.port))
+
+    num_dgrams = 0
+    num_msgs = 0
+    num_bytes = 0
+    num_bad = 0
+
+    try:
+        while True:
+            data, peer = sock.recvfrom(65535)
+            num_dgrams += 1
+            num_bytes += len(data)
+            for line in data.decode('utf-8', errors='replace').splitlines():
+                m = MSG_RE.match(line)
+                if m is None:
+                    num_bad += 1
+                    print('*** %s: malformed message: %s ***' % (peer[0], line), file=sys.stderr)
+                    continue
+                num_msgs += 1
+                if not args.quiet:
+                    pri = int(m.group(1))
+                    print('%s %s %-7s %s' % (m.group(3), m.group(2), SEVERITY[pri & 7], m.group(8)))
+    except KeyboardInterrupt:
+        pass
+
+    print('\n%u datagrams, %u messages, %u bytes, %u malformed' % (num_dgrams, num_msgs, num_bytes, num_bad))
+    if num_dgrams != 0:
+        print('%.1f messages/datagram, %.1f bytes/datagram' % (num_msgs / num_dgrams, num_bytes / num_dgrams))
+    if num_msgs != 0:
+        print('%.1f bytes/message' % (num_bytes / num_msgs))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,190 @@
+// Host test of the MLOG segment compressor: compresses a
+// mix of log-like, repetitive and random inputs into output
+// buffers of every size around the compressed length, and
+// checks that the compressor never writes past the end of
+// the buffer, and that the data decompresses back to the
+// original.
+//
+// When log files are given on the command line, it compresses
+// them the way the log file sink does, in full blocks, and
+// reports the compression ratio and the (host) CPU time spent
+// per KB. On the device, the CPU cycles per KB are available
+// via msgLogGetStats().
+//
+// Build and run from the top directory:
+//   gcc -Wall -O2 -I test/host -I main -o mlogz_test test/host/mlogz_test.c && ./mlogz_test [MLOG.000 ...]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+// newlib and the BSDs have funopen(), glibc has fopencookie()
+static FILE *funopen(void *cookie, int (*readFn)(void *, char *, int), void *writeFn, void *seekFn, int (*closeFn)(void *))
+{
+    cookie_io_functions_t funcs = {
+        .read = (cookie_read_function_t *) readFn,
+        .close = closeFn,
+    };
+    return fopencookie(cookie, "r", funcs);
+}
+#endif
+
+#include "mlogz.c"
+
+#define GUARD_LEN   64
+#define GUARD_BYTE  0xA5
+#define NUM_RUNS    20000
+
+static uint8_t src[BLOCK_SIZE];
+static uint8_t dst[BLOCK_SIZE + 64 + GUARD_LEN];
+static uint8_t raw[BLOCK_SIZE];
+
+static const char *words[] = {
+    "I (1234) ", "wifi", "ble", "Connected to ", "rssi=-67 ", "\n",
+    "0123456789", "error: ", "appMain ", "heap=123456 ", "[mlog] ",
+};
+
+static void fillSrc(size_t len)
+{
+    int kind = rand() % 3;
+
+    for (size_t i = 0; i < len;) {
+        if (kind == 0) {
+            // Random bytes: incompressible
+            src[i++] = rand();
+        } else if (kind == 1) {
+            // Runs of the same byte
+            size_t n = 1 + (rand() % 600);
+            uint8_t b = rand();
+            while ((n-- != 0) && (i < len)) {
+                src[i++] = b;
+            }
+        } else {
+            // Log-like text, with some noise
+            const char *w = words[rand() % (sizeof (words) / sizeof (words[0]))];
+            while ((*w != '\0') && (i < len)) {
+                src[i++] = ((rand() % 50) == 0) ? rand() : *w;
+                w++;
+            }
+        }
+    }
+}
+
+static int checkOne(size_t srcLen, size_t dstLen)
+{
+    int n;
+
+    memset(dst, GUARD_BYTE, sizeof (dst));
+    n = mlogzCompress(src, srcLen, dst, dstLen);
+
+    for (size_t i = dstLen; i < sizeof (dst); i++) {
+        if (dst[i] != GUARD_BYTE) {
+            printf("FAIL: srcLen=%zu dstLen=%zu: write past the end at +%zu\n", srcLen, dstLen, (i - dstLen));
+            return -1;
+        }
+    }
+    if (n < 0) {
+        return 0;
+    }
+    if ((size_t) n > dstLen) {
+        printf("FAIL: srcLen=%zu dstLen=%zu: returned %d\n", srcLen, dstLen, n);
+        return -1;
+    }
+    if ((mlogzDecompress(dst, n, raw, sizeof (raw)) != (int) srcLen) || (memcmp(raw, src, srcLen) != 0)) {
+        printf("FAIL: srcLen=%zu dstLen=%zu: round trip mismatch\n", srcLen, dstLen);
+        return -1;
+    }
+
+    return 1;
+}
+
+// Compress a log file in full blocks, each one stored
+// as is when it doesn't compress.
+static int benchFile(const char *path)
+{
+    struct timespec start, end;
+    size_t rawLen = 0, compLen = 0;
+    double nsec = 0;
+    unsigned numBlocks = 0;
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while ((n = fread(src, 1, BLOCK_SIZE, fp)) != 0) {
+        int len;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        len = mlogzCompress(src, n, dst, (n - 1));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        nsec += ((end.tv_sec - start.tv_sec) * 1e9) + (end.tv_nsec - start.tv_nsec);
+
+        if ((len >= 0) && ((mlogzDecompress(dst, len, raw, sizeof (raw)) != (int) n) || (memcmp(raw, src, n) != 0))) {
+            printf("FAIL: %s: round trip mismatch in block %u\n", path, numBlocks);
+            fclose(fp);
+            return -1;
+        }
+        rawLen += n;
+        compLen += sizeof (MlogzBlkHdr) + ((len >= 0) ? (size_t) len : n);
+        numBlocks++;
+    }
+    fclose(fp);
+
+    printf("%s: %zu -> %zu bytes in %u blocks, ratio %.2f, %.0f ns/KB\n", path, rawLen, compLen, numBlocks,
+           ((compLen != 0) ? ((double) rawLen / compLen) : 0), ((rawLen != 0) ? ((nsec * 1024) / rawLen) : 0));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned fits = 0;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            if (benchFile(argv[i]) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    srand(1);
+
+    for (int run = 0; run < NUM_RUNS; run++) {
+        size_t srcLen = (run < 32) ? run : ((rand() % 4) == 0) ? BLOCK_SIZE : (rand() % (BLOCK_SIZE + 1));
+        int fullLen, rc;
+
+        fillSrc(srcLen);
+        if ((fullLen = mlogzCompress(src, srcLen, dst, sizeof (dst) - GUARD_LEN)) < 0) {
+            printf("FAIL: srcLen=%zu doesn't fit in %zu bytes\n", srcLen, (sizeof (dst) - GUARD_LEN));
+            return 1;
+        }
+
+        // Every output size around the compressed length,
+        // plus the one the log file sink uses.
+        for (int d = -8; d <= 8; d++) {
+            if ((fullLen + d) < 0) {
+                continue;
+            }
+            if ((rc = checkOne(srcLen, (fullLen + d))) < 0) {
+                return 1;
+            }
+            fits += rc;
+        }
+        if ((srcLen != 0) && (checkOne(srcLen, (srcLen - 1)) < 0)) {
+            return 1;
+        }
+        if (checkOne(srcLen, 0) < 0) {
+            return 1;
+        }
+    }
+
+    printf("OK: %d inputs, %u round trips\n", NUM_RUNS, fits);
+
+    return 0;
+}
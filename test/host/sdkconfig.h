@@ -0,0 +1,6 @@
+#pragma once
+
+// Configuration used to build the host tests
+#define CONFIG_MSG_LOG                      1
+#define CONFIG_MSG_LOG_COMPRESS             1
+#define CONFIG_MSG_LOG_COMPRESS_BLOCK_SIZE  4096